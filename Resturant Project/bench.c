@@ -0,0 +1,567 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include "protocol.h"
+#include "schedule.h"
+
+#define PIPELINE_DEPTH 16 // Requests in flight per connection in pipe mode
+#define SIMULATED_SERVICE_SECONDS (3 * 3600) // Length of the evening the schedule simulation spreads tables over
+#define SIMULATED_COURSE_CHANCE 75           // Percent of tables ordering every course
+#define SIMULATED_ORDER_GAP 10               // Seconds between the courses a table orders in one go
+#define SIMULATED_PREP_JITTER 20             // Percent a real prep time differs from its estimate at most
+#define SIMULATED_BATCH_WINDOW 60            // Seconds apart orders of one dish may be placed to be cooked together
+
+// Struct for the work given to one benchmark thread
+typedef struct BenchWorker
+{
+    pthread_t thread;   // Thread running the worker
+    const char *mode;   // Benchmark mode ("conn", "cmd", "pipe", "order" or "kitchen")
+    int id;             // Number of the worker
+    int count;          // Number of connections or commands to run
+    double *latencies;  // Latency of every command in microseconds
+    bool framed;        // Negotiate the framed protocol instead of the legacy one
+    int batch;          // Orders taken and marked ready per round trip in kitchen mode
+    int completed;      // Number of finished connections or commands
+    size_t bytes;       // Bytes sent and received by the worker
+} BenchWorker;
+
+// Struct for one order of the kitchen schedule simulation
+typedef struct SimulatedOrder
+{
+    Order order;     // Order as the server would store it
+    int table;       // Simulated table that placed the order
+    uint32_t prep;   // Estimated prep time
+    uint32_t actual; // Prep time the kitchen really needs
+    uint32_t key;    // Key of the order under the simulated policy
+    uint32_t taken;  // Time a kitchen device took the order
+    bool first;      // Order is the first course of its table
+    bool done;       // Order was taken
+} SimulatedOrder;
+
+void *runWorker(void *arg);
+void runConnectionChurn(BenchWorker *worker);
+void runCommandLatency(BenchWorker *worker);
+void runPipelined(BenchWorker *worker);
+void runOrderThroughput(BenchWorker *worker);
+void runKitchenLatency(BenchWorker *worker);
+int runScheduleSimulation(int devices, int tables);
+int simulateOrders(SimulatedOrder orders[], const PrepTimes *times, int tables);
+void simulatePolicy(int policy, int batch_window, SimulatedOrder orders[], int count, int devices, int tables);
+int checkInTable(Link *link, int id);
+int connectToServer(Link *link, bool framed);
+double nowMicroseconds();
+int compareDoubles(const void *a, const void *b);
+void printUsage(const char *program);
+
+int main(int argc, const char *argv[])
+{
+    // The schedule simulation runs without a server
+    if (argc >= 4 && strcmp(argv[1], "schedule") == 0)
+        return runScheduleSimulation(atoi(argv[2]), atoi(argv[3]));
+
+    bool framed = argc > 4 && strcmp(argv[4], "framed") == 0;
+    if (argc < 4 || (strcmp(argv[1], "conn") != 0 && strcmp(argv[1], "cmd") != 0 && strcmp(argv[1], "pipe") != 0 && strcmp(argv[1], "order") != 0 && strcmp(argv[1], "kitchen") != 0) || (argc > 4 && !framed && strcmp(argv[4], "legacy") != 0))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const char *mode = argv[1];
+    int clients = atoi(argv[2]);
+    int count = atoi(argv[3]);
+    int batch = argc > 5 ? atoi(argv[5]) : 1;
+    batch = batch < 1 ? 1 : batch > MAX_TAKE_BATCH ? MAX_TAKE_BATCH : batch;
+    BenchWorker *workers = calloc(clients, sizeof(BenchWorker));
+
+    fprintf(stdout, "--------------------------------BENCH--------------------------------\n");
+    fprintf(stdout, "Mode: %s, protocol: %s, clients: %d, %s per client: %d\n", mode, framed ? "framed" : "legacy", clients, strcmp(mode, "conn") == 0 ? "connections" : "commands", count);
+
+    double start = nowMicroseconds();
+    for (int i = 0; i < clients; i++)
+    {
+        workers[i].mode = mode;
+        workers[i].id = i;
+        workers[i].count = count;
+        workers[i].framed = framed;
+        workers[i].batch = batch;
+        workers[i].latencies = calloc(count, sizeof(double));
+        pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]);
+    }
+
+    int total = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < clients; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].completed;
+        bytes += workers[i].bytes;
+    }
+    double elapsed = (nowMicroseconds() - start) / 1e6;
+
+    // Merge latencies of all workers to compute percentiles
+    double *latencies = calloc(total > 0 ? total : 1, sizeof(double));
+    int merged = 0;
+    for (int i = 0; i < clients; i++)
+    {
+        memcpy(latencies + merged, workers[i].latencies, workers[i].completed * sizeof(double));
+        merged += workers[i].completed;
+        free(workers[i].latencies);
+    }
+    qsort(latencies, merged, sizeof(double), compareDoubles);
+
+    fprintf(stdout, "Completed: %d in %.3f s\n", total, elapsed);
+    fprintf(stdout, "%s/sec: %.0f\n", strcmp(mode, "conn") == 0 ? "Connections" : strcmp(mode, "order") == 0 ? "Orders" : "Commands", total / elapsed);
+    if (merged > 0)
+    {
+        fprintf(stdout, "Bytes on the wire per %s: %.0f\n", strcmp(mode, "conn") == 0 ? "connection" : "command", (double)bytes / merged);
+        fprintf(stdout, "Latency p50: %.1f us\n", latencies[merged / 2]);
+        fprintf(stdout, "Latency p99: %.1f us\n", latencies[(int)(merged * 0.99)]);
+    }
+
+    free(latencies);
+    free(workers);
+    return 0;
+}
+
+void *runWorker(void *arg)
+{
+    BenchWorker *worker = (BenchWorker *)arg;
+    if (strcmp(worker->mode, "conn") == 0)
+        runConnectionChurn(worker);
+    else if (strcmp(worker->mode, "cmd") == 0)
+        runCommandLatency(worker);
+    else if (strcmp(worker->mode, "order") == 0)
+        runOrderThroughput(worker);
+    else if (strcmp(worker->mode, "kitchen") == 0)
+        runKitchenLatency(worker);
+    else
+        runPipelined(worker);
+    return NULL;
+}
+
+void runConnectionChurn(BenchWorker *worker)
+{
+    // Every iteration opens a connection, sends one command and disconnects
+    for (int i = 0; i < worker->count; i++)
+    {
+        Link link;
+        double start = nowMicroseconds();
+        if (connectToServer(&link, worker->framed) < 0)
+            continue;
+
+        int total;
+        if (linkSendRequest(&link, MSG_BILL, NULL, 0) != 0 && linkRecvReply(&link) > 0 && linkRecvInt(&link, &total) > 0)
+        {
+            worker->latencies[worker->completed] = nowMicroseconds() - start;
+            worker->completed++;
+        }
+        linkSendRequest(&link, MSG_ESC, NULL, 0);
+        worker->bytes += link.bytes_sent + link.bytes_received;
+        linkClose(&link);
+    }
+}
+
+void runCommandLatency(BenchWorker *worker)
+{
+    Link link;
+    char buffer[MAX_BUFFER_SIZE];
+    if (connectToServer(&link, worker->framed) < 0)
+        return;
+
+    // Only the find requests and their replies are counted, not the hello
+    size_t start_bytes = link.bytes_sent + link.bytes_received;
+    sprintf(buffer, "Bench %d %s %s", 2, "01-01-2030", "20:00");
+    for (int i = 0; i < worker->count; i++)
+    {
+        double start = nowMicroseconds();
+        if (linkSendRequest(&link, MSG_FIND, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0)
+            break;
+
+        int result;
+        char text[MAX_BUFFER_SIZE];
+        if (linkRecvInt(&link, &result) <= 0)
+            break;
+        int texts = result > 0 ? result : 1;
+        for (int k = 0; k < texts; k++)
+            linkRecvText(&link, text, MAX_BUFFER_SIZE);
+
+        worker->latencies[worker->completed] = nowMicroseconds() - start;
+        worker->completed++;
+    }
+    worker->bytes += link.bytes_sent + link.bytes_received - start_bytes;
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+}
+
+void runPipelined(BenchWorker *worker)
+{
+    Link link;
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE];
+    double sent_at[PIPELINE_DEPTH];
+    int sent = 0;
+    if (connectToServer(&link, worker->framed) < 0)
+        return;
+
+    // Keep PIPELINE_DEPTH finds in flight, a new one leaves whenever a reply arrives
+    size_t start_bytes = link.bytes_sent + link.bytes_received;
+    sprintf(buffer, "Bench %d %s %s", 2, "01-01-2030", "20:00");
+    while (worker->completed < worker->count)
+    {
+        while (sent < worker->count && sent - worker->completed < PIPELINE_DEPTH)
+        {
+            uint32_t id = linkSendRequest(&link, MSG_FIND, buffer, strlen(buffer));
+            if (id == 0)
+                break;
+            sent_at[id % PIPELINE_DEPTH] = nowMicroseconds();
+            sent++;
+        }
+
+        int result;
+        if (linkRecvReply(&link) <= 0 || linkRecvInt(&link, &result) <= 0)
+            break;
+        int texts = result > 0 ? result : 1;
+        for (int k = 0; k < texts; k++)
+            linkRecvText(&link, text, MAX_BUFFER_SIZE);
+
+        worker->latencies[worker->completed] = nowMicroseconds() - sent_at[link.reply_id % PIPELINE_DEPTH];
+        worker->completed++;
+    }
+    worker->bytes += link.bytes_sent + link.bytes_received - start_bytes;
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+}
+
+void runOrderThroughput(BenchWorker *worker)
+{
+    Link link;
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE];
+    if (connectToServer(&link, worker->framed) < 0)
+        return;
+    if (checkInTable(&link, worker->id) <= 0)
+    {
+        fprintf(stderr, "[-] Worker %d could not check in a table\n", worker->id);
+        linkClose(&link);
+        return;
+    }
+
+    // Every order is a record the server has to make durable before it replies; each
+    // gets its own course code, so the kitchen can mark exactly that order ready
+    size_t start_bytes = link.bytes_sent + link.bytes_received;
+    for (int i = 0; i < worker->count; i++)
+    {
+        sprintf(buffer, "Course: %d Order: A1-1", i % 10000);
+        double start = nowMicroseconds();
+        if (linkSendRequest(&link, MSG_ORDER, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0 ||
+            linkRecvText(&link, text, MAX_BUFFER_SIZE) <= 0)
+            break;
+
+        worker->latencies[worker->completed] = nowMicroseconds() - start;
+        worker->completed++;
+    }
+    worker->bytes += link.bytes_sent + link.bytes_received - start_bytes;
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+}
+
+void runKitchenLatency(BenchWorker *worker)
+{
+    Link link;
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE];
+    if (connectToServer(&link, worker->framed) < 0)
+        return;
+
+    // One take of up to batch orders and the ready of the taken orders count as one round,
+    // every order of the round is given the latency of the round
+    size_t start_bytes = link.bytes_sent + link.bytes_received;
+    while (worker->completed < worker->count)
+    {
+        int found = 0, listed = 0, length = 0;
+        int wanted = worker->count - worker->completed < worker->batch ? worker->count - worker->completed : worker->batch;
+        double start = nowMicroseconds();
+        sprintf(buffer, "%d", wanted);
+        if (linkSendRequest(&link, MSG_TAKE, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0 || linkRecvInt(&link, &found) <= 0)
+            break;
+        for (int k = 0; k < (found > 0 ? found : 1); k++)
+        {
+            int code = 0;
+            char table[MAX_BUFFER_SIZE], course[MAX_COURSE_LENGTH];
+            if (linkRecvText(&link, text, MAX_BUFFER_SIZE) <= 0 || (found > 0 && sscanf(text, "%d %s %4s", &code, table, course) != 3))
+                found = 0;
+            else if (found > 0 && length < (int)sizeof(buffer))
+            {
+                // Orders that do not fit in the request stay preparing
+                int added = snprintf(buffer + length, sizeof(buffer) - length, "%s%d %s", length > 0 ? " " : "", code, course);
+                if (added < (int)sizeof(buffer) - length)
+                {
+                    length += added;
+                    listed++;
+                }
+                else
+                {
+                    buffer[length] = '\0';
+                    length = sizeof(buffer);
+                }
+            }
+        }
+        if (found < 1)
+        {
+            fprintf(stderr, "[-] No order left to take, fill the server with the order mode first\n");
+            break;
+        }
+
+        if (linkSendRequest(&link, MSG_READY, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0)
+            break;
+        for (int k = 0; k < listed; k++)
+            linkRecvText(&link, text, MAX_BUFFER_SIZE);
+
+        double latency = nowMicroseconds() - start;
+        for (int k = 0; k < listed && worker->completed < worker->count; k++)
+            worker->latencies[worker->completed++] = latency;
+    }
+    worker->bytes += link.bytes_sent + link.bytes_received - start_bytes;
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+}
+
+int runScheduleSimulation(int devices, int tables)
+{
+    PrepTimes times;
+    if (devices < 1 || tables < 1 || !loadPrepTimes(PREP_TIMES_FILE, &times))
+    {
+        fprintf(stderr, "[-] The simulation needs devices, tables and the prep times of %s\n", PREP_TIMES_FILE);
+        return 1;
+    }
+
+    fprintf(stdout, "--------------------------------BENCH--------------------------------\n");
+    fprintf(stdout, "Mode: schedule, kitchen devices: %d, tables: %d in %d minutes\n", devices, tables, SIMULATED_SERVICE_SECONDS / 60);
+
+    // Every policy cooks the same evening, only the order the kitchen takes them in differs
+    SimulatedOrder *orders = calloc((size_t)tables * MAX_PREP_DISHES, sizeof(SimulatedOrder));
+    int count = simulateOrders(orders, &times, tables);
+    fprintf(stdout, "Orders: %d\n", count);
+    for (int policy = 0; policy < SCHEDULE_POLICIES; policy++)
+        simulatePolicy(policy, 0, orders, count, devices, tables);
+    for (int policy = 0; policy < SCHEDULE_POLICIES; policy++)
+        simulatePolicy(policy, SIMULATED_BATCH_WINDOW, orders, count, devices, tables);
+    free(orders);
+    return 0;
+}
+
+int simulateOrders(SimulatedOrder orders[], const PrepTimes *times, int tables)
+{
+    // Courses are the first letters of the dish codes (A1 is an appetizer); a table
+    // orders a random dish of some courses at once, a few seconds apart
+    char courses[MAX_PREP_DISHES];
+    int course_count = 0;
+    for (int i = 0; i < times->count; i++)
+    {
+        if (memchr(courses, times->dishes[i][0], course_count) == NULL)
+            courses[course_count++] = times->dishes[i][0];
+    }
+
+    srand(1);
+    int count = 0;
+    for (int table = 0; table < tables; table++)
+    {
+        uint32_t arrival = (uint64_t)SIMULATED_SERVICE_SECONDS * table / tables + rand() % 60;
+        int ordered = 0;
+        for (int c = 0; c < course_count; c++)
+        {
+            if (rand() % 100 >= SIMULATED_COURSE_CHANCE && !(ordered == 0 && c == course_count - 1))
+                continue;
+            int dishes[MAX_PREP_DISHES], dish_count = 0;
+            for (int i = 0; i < times->count; i++)
+            {
+                if (times->dishes[i][0] == courses[c])
+                    dishes[dish_count++] = i;
+            }
+            int dish = dishes[rand() % dish_count];
+
+            SimulatedOrder *simulated = &orders[count++];
+            simulated->table = table;
+            simulated->first = ordered == 0;
+            simulated->order.time = arrival + ordered++ * SIMULATED_ORDER_GAP;
+            simulated->order.course[0] = courses[c];
+            simulated->order.item_count = 1;
+            memcpy(simulated->order.items[0].dish, times->dishes[dish], DISH_CODE_SIZE);
+            simulated->order.items[0].quantity = 1;
+            simulated->prep = estimatePrepTime(times, &simulated->order);
+            int jitter = simulated->prep * SIMULATED_PREP_JITTER / 100;
+            simulated->actual = simulated->prep - jitter + (jitter > 0 ? rand() % (2 * jitter + 1) : 0);
+        }
+    }
+    return count;
+}
+
+void simulatePolicy(int policy, int batch_window, SimulatedOrder orders[], int count, int devices, int tables)
+{
+    // Keys are given as the orders come in, like the server does; tables order in
+    // the order of their arrival, so the array is already sorted by time
+    uint32_t *paced_until = calloc(tables, sizeof(uint32_t));
+    for (int i = 0; i < count; i++)
+    {
+        orders[i].key = scheduleKey(policy, orders[i].order.time, orders[i].prep, &paced_until[orders[i].table]);
+        orders[i].done = false;
+    }
+
+    // The device that is free first takes the order with the smallest key of those placed by
+    // then, with a batch window also the orders of the same dish placed around it
+    uint32_t *free_at = calloc(devices, sizeof(uint32_t));
+    double *waits = calloc(count, sizeof(double));
+    double *readies = calloc(count, sizeof(double));
+    double wait_sum = 0, ready_sum = 0, first_sum = 0, busy = 0;
+    int taken = 0;
+    while (taken < count)
+    {
+        int device = 0;
+        for (int d = 1; d < devices; d++)
+        {
+            if (free_at[d] < free_at[device])
+                device = d;
+        }
+        uint32_t now = free_at[device];
+        int next = -1;
+        uint32_t first_placed = UINT32_MAX;
+        for (int i = 0; i < count; i++)
+        {
+            if (orders[i].done)
+                continue;
+            if (orders[i].order.time < first_placed)
+                first_placed = orders[i].order.time;
+            if (orders[i].order.time <= now && (next < 0 || orders[i].key < orders[next].key))
+                next = i;
+        }
+        // An idle device waits for the next order
+        if (next < 0)
+        {
+            free_at[device] = first_placed;
+            continue;
+        }
+
+        // A batch is cooked in the time of its slowest order
+        int batch[MAX_TAKE_BATCH], size = 0;
+        uint32_t cook = orders[next].actual;
+        batch[size++] = next;
+        orders[next].done = true;
+        for (int i = 0; i < count && batch_window > 0 && size < MAX_TAKE_BATCH; i++)
+        {
+            if (orders[i].done || orders[i].order.time > now || memcmp(orders[i].order.items[0].dish, orders[next].order.items[0].dish, DISH_CODE_SIZE) != 0 ||
+                orders[i].order.time + batch_window < orders[next].order.time || orders[i].order.time > orders[next].order.time + batch_window)
+                continue;
+            orders[i].done = true;
+            batch[size++] = i;
+            cook = orders[i].actual > cook ? orders[i].actual : cook;
+        }
+        free_at[device] = now + cook;
+        busy += cook;
+        for (int i = 0; i < size; i++, taken++)
+        {
+            SimulatedOrder *order = &orders[batch[i]];
+            order->taken = now;
+            waits[taken] = now - order->order.time;
+            readies[taken] = free_at[device] - order->order.time;
+            wait_sum += waits[taken];
+            ready_sum += readies[taken];
+            if (order->first)
+                first_sum += readies[taken];
+        }
+    }
+    qsort(waits, count, sizeof(double), compareDoubles);
+    qsort(readies, count, sizeof(double), compareDoubles);
+
+    fprintf(stdout, "%-6s %s wait for a device: mean %.0f s, p95 %.0f s | until ready: mean %.0f s, p95 %.0f s | first course ready: mean %.0f s | dishes per cook-hour: %.1f\n",
+            SCHEDULE_NAMES[policy], batch_window > 0 ? "batched" : "alone  ", wait_sum / count, waits[(int)(count * 0.95)], ready_sum / count,
+            readies[(int)(count * 0.95)], first_sum / tables, count / (busy / 3600));
+    free(paced_until);
+    free(free_at);
+    free(waits);
+    free(readies);
+}
+
+int checkInTable(Link *link, int id)
+{
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE];
+    int result = 0, choice = 1, code = 0;
+
+    // A far away date per worker and run, so every worker gets a free table
+    srand(time(NULL) * 31 + id);
+    sprintf(buffer, "Bench%d 2 %02d-%02d-%d %02d:00", id, 1 + rand() % 28, 1 + rand() % 12, 2100 + rand() % 7000, rand() % 24);
+    if (linkSendRequest(link, MSG_FIND, buffer, strlen(buffer)) == 0 || linkRecvReply(link) <= 0 || linkRecvInt(link, &result) <= 0)
+        return -1;
+    for (int k = 0; k < (result > 0 ? result : 1); k++)
+        linkRecvText(link, text, MAX_BUFFER_SIZE);
+    if (result <= 0)
+        return 0;
+
+    if (linkSendRequest(link, MSG_BOOK, &choice, sizeof(choice)) == 0 || linkRecvReply(link) <= 0 ||
+        linkRecvInt(link, &result) <= 0 || linkRecvText(link, text, MAX_BUFFER_SIZE) <= 0 || result <= 0)
+        return 0;
+    sscanf(text, "%d", &code);
+
+    sprintf(buffer, "Bench%d %d", id, code);
+    if (linkSendRequest(link, MSG_CHECK, buffer, strlen(buffer)) == 0 || linkRecvReply(link) <= 0 ||
+        linkRecvInt(link, &result) <= 0 || linkRecvText(link, text, MAX_BUFFER_SIZE) <= 0)
+        return -1;
+    return result;
+}
+
+int connectToServer(Link *link, bool framed)
+{
+    struct sockaddr_in addr;
+    int client_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (client_socket < 0)
+        return -1;
+
+    // Same address convention as the devices
+    memset(&addr, '\0', sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = SERVER_PORT;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(client_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(client_socket);
+        return -1;
+    }
+
+    // Requests are small, do not let Nagle delay them
+    int nodelay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    linkInit(link, client_socket);
+    if (framed && linkNegotiate(link) == PROTOCOL_LEGACY)
+        fprintf(stderr, "[-] Server did not accept the framed protocol, using legacy\n");
+    return client_socket;
+}
+
+double nowMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void printUsage(const char *program)
+{
+    fprintf(stdout, "Usage: %s <mode> <clients> <count> [legacy|framed] [batch]\n", program);
+    fprintf(stdout, "conn  ---> each client opens <count> connections (bill + esc) -> connections/sec\n");
+    fprintf(stdout, "cmd   ---> each client sends <count> find commands on one connection -> command latency\n");
+    fprintf(stdout, "pipe  ---> like cmd, but with %d finds in flight per connection -> pipelined throughput\n", PIPELINE_DEPTH);
+    fprintf(stdout, "order ---> each client books and checks in a table, then sends <count> orders -> orders/sec\n");
+    fprintf(stdout, "kitchen -> each client takes and readies <count> orders, [batch] per take -> kitchen round latency\n");
+    fprintf(stdout, "schedule -> %s schedule <devices> <tables>, simulates an evening under every kitchen schedule -> wait per policy\n", program);
+}
@@ -0,0 +1,97 @@
+# ************************************************************************************
+# Compares the connection models of the server with the bench tool.
+# Usage: ./bench.sh [clients] [count]
+# Threads mode is measured with 1 to 16 workers to show scaling over cores.
+# Orders/sec is measured with several group commit windows of the write-ahead log,
+# followed by the kitchen latency on the orders that were placed, taking one and
+# then 8 orders per round trip.
+# A simulated week shows how compaction keeps orders.bin small: every day takes
+# clients * count orders and the kitchen serves as many, leaving 10% of every day for
+# the next one. Segments are sealed after a second, so the day's served orders are
+# archived before the next day starts.
+# Last, an evening of 300 tables is simulated under every kitchen schedule, with and without
+# cook batches of the same dish, without a server.
+# The server is started on port 4242 in every mode; its console output is discarded.
+# ************************************************************************************
+
+CLIENTS=${1:-50}
+COUNT=${2:-200}
+
+make server bench
+
+runMode()
+{
+    echo "==================== $* ===================="
+    ./server 4242 "$@" > /dev/null < /dev/null &
+    SERVER_PID=$!
+    sleep 1
+
+    ./bench conn $CLIENTS $COUNT
+    ./bench cmd $CLIENTS $COUNT legacy
+    ./bench cmd $CLIENTS $COUNT framed
+    ./bench pipe $CLIENTS $COUNT framed
+
+    kill $SERVER_PID
+    wait $SERVER_PID 2>/dev/null
+}
+
+runOrders()
+{
+    echo "==================== $* ===================="
+    ./server 4242 "$@" > /dev/null < /dev/null &
+    SERVER_PID=$!
+    sleep 1
+
+    ./bench order $CLIENTS $COUNT framed
+    ./bench kitchen 1 $COUNT framed
+    ./bench kitchen 1 $COUNT framed 8
+
+    kill $SERVER_PID
+    wait $SERVER_PID 2>/dev/null
+}
+
+runMode --mode fork
+runMode --mode epoll
+runMode --mode epoll --io uring
+
+# Scaling of the sharded mode, one worker per core
+for workers in 1 2 4 8 16
+do
+    runMode --mode threads --workers $workers
+done
+
+# Orders/sec against the latency bound of a group commit
+for window in 0 0.5 2 5
+do
+    runOrders --mode epoll --commit-window $window
+done
+
+runWeek()
+{
+    echo "==================== simulated week ===================="
+    # Fresh data files in a scratch directory, the server reads menu.txt from there
+    WEEK_DIR=$(mktemp -d)
+    cp server menu.txt preptime.txt "$WEEK_DIR"
+    (cd "$WEEK_DIR" && exec ./server 4242 --mode epoll --rotate 1 > /dev/null < /dev/null) &
+    SERVER_PID=$!
+    sleep 1
+
+    DAILY=$((CLIENTS * COUNT))
+    for day in 1 2 3 4 5 6 7
+    do
+        ./bench order $CLIENTS $COUNT framed > /dev/null
+        ./bench kitchen 1 $((day == 1 ? DAILY * 9 / 10 : DAILY)) framed > /dev/null
+        sleep 2
+        echo "Day $day: $((day * DAILY)) orders placed ($((day * DAILY * 48 / 1024)) KB without compaction)," \
+             "orders.bin $(du -k "$WEEK_DIR/orders.bin" | cut -f1) KB on disk, orders.archive $(du -k "$WEEK_DIR/orders.archive" | cut -f1) KB"
+    done
+
+    kill $SERVER_PID
+    wait $SERVER_PID 2>/dev/null
+    rm -rf "$WEEK_DIR"
+}
+
+runWeek
+
+echo "==================== kitchen schedules ===================="
+./bench schedule 40 300
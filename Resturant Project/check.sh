@@ -0,0 +1,63 @@
+# ************************************************************************************
+# Checks the protocol, the replay of the write-ahead log, the compaction of served orders
+# and cook batches with the checks tool. Run by 'make check'; exits with the number of
+# failed checks.
+# Every server runs on port 4242 in a scratch directory, so the data files of this
+# directory are never touched; the console output of a server goes to server.log there.
+# ************************************************************************************
+
+SOURCE=$(pwd)
+SCRATCH=$(mktemp -d)
+FAILED=0
+cp menu.txt preptime.txt "$SCRATCH"
+cd "$SCRATCH"
+
+startServer()
+{
+    "$SOURCE/server" 4242 "$@" >> server.log 2>&1 < /dev/null &
+    SERVER_PID=$!
+    sleep 1
+}
+
+stopServer()
+{
+    kill $SERVER_PID
+    wait $SERVER_PID 2>/dev/null
+}
+
+check()
+{
+    "$SOURCE/checks" "$@" || FAILED=$((FAILED + 1))
+}
+
+check protocol
+
+# The server replays the log a crashed server left before it loads the data files
+check log
+startServer
+check replayed
+stopServer
+
+# Segments are sealed after a second, so the served orders are archived while the server runs
+rm -f *.bin restaurant.wal orders.archive
+startServer --rotate 1
+check compaction
+stopServer
+startServer
+check restarted
+stopServer
+
+# Cook batches have to find their orders behind hundreds of waiting orders of the same dish
+rm -f *.bin restaurant.wal orders.archive
+startServer --batch-window 1
+check batch
+stopServer
+
+cd "$SOURCE"
+if [ $FAILED -ne 0 ]
+then
+    echo "[-] $FAILED checks failed, server output kept in $SCRATCH/server.log"
+    exit $FAILED
+fi
+rm -rf "$SCRATCH"
+echo "[+] All checks passed"
@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "protocol.h"
+#include "records.h"
+
+#define CHECK_SURNAME "Check"         // Surname of the reservation written to the log by the log mode
+#define CHECK_CODE 4242               // Code of the reservation written to the log by the log mode
+#define CHECK_DISH_PRICE 5            // Price of A1 in menu.txt, the dish of every order of the checks
+#define COMPACTION_SURNAME "Compact"  // Surname of the reservation booked by the compaction mode
+#define COMPACTION_ORDERS 6           // Orders placed by the compaction mode
+#define COMPACTION_SERVED 4           // Orders of them marked ready, the rest stays open
+#define COMPACTION_TIMEOUT_SECONDS 10 // Time the compaction mode waits for the served orders to be archived
+#define BATCH_SURNAME "Batch"         // Surname of the reservation booked by the batch mode
+#define BATCH_CROWD 300               // Orders of the same dish in front of a cook batch, more than the server scans
+#define BATCH_ORDERS 4                // Orders of the same dish and course a cook batch has to find behind the crowd
+#define BATCH_WINDOW_SECONDS 1        // Batch window the server of the batch mode runs with
+
+// Methods running one check, each returns the number of failures
+int checkProtocol();
+int writeCheckLog();
+int checkReplayedLog();
+int checkCompaction();
+int checkRestartedCompaction();
+int checkCrowdedBatch();
+
+// Methods used by the checks
+bool expect(bool condition, const char *what);
+void appendLogRecord(FILE *log, int file, uint32_t index, const void *data, uint16_t size);
+Order makeCheckOrder(const char *course, int quantity, uint32_t reservation, int status);
+int checkInTable(Link *link, const char *surname, int code);
+int checkInNewTable(Link *link, const char *surname);
+int readBill(Link *link);
+int takeOrders(Link *link, int type, const char *body, char codes[][MAX_BUFFER_SIZE]);
+int countArchivedOrders(int code);
+int findReservationCode(const char *surname);
+int connectToServer(Link *link);
+void printUsage(const char *program);
+
+int main(int argc, const char *argv[])
+{
+    int failures;
+    if (argc == 2 && strcmp(argv[1], "protocol") == 0)
+        failures = checkProtocol();
+    else if (argc == 2 && strcmp(argv[1], "log") == 0)
+        failures = writeCheckLog();
+    else if (argc == 2 && strcmp(argv[1], "replayed") == 0)
+        failures = checkReplayedLog();
+    else if (argc == 2 && strcmp(argv[1], "compaction") == 0)
+        failures = checkCompaction();
+    else if (argc == 2 && strcmp(argv[1], "restarted") == 0)
+        failures = checkRestartedCompaction();
+    else if (argc == 2 && strcmp(argv[1], "batch") == 0)
+        failures = checkCrowdedBatch();
+    else
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    fprintf(stdout, "[CHECK] %s: %s\n", argv[1], failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
+
+int checkProtocol()
+{
+    int failures = 0;
+
+    // Every command name leads back to its type
+    for (int type = 1; type <= MSG_GRID; type++)
+    {
+        const char *name = protocolCommandName(type);
+        if (name[0] != '\0')
+            failures += !expect(protocolCommandType(name) == type, "command name round trip");
+    }
+    failures += !expect(protocolCommandType("nothing") == 0, "unknown command has no type");
+
+    char hello[PROTOCOL_HELLO_SIZE];
+    protocolMakeHello(hello, PROTOCOL_VERSION);
+    failures += !expect(protocolHelloVersion(hello) == PROTOCOL_VERSION, "hello round trip");
+    failures += !expect(protocolHelloVersion("find\0\0") < 0, "legacy command is no hello");
+
+    char header[FRAME_HEADER_SIZE];
+    uint32_t body_len, request_id;
+    uint16_t type;
+    protocolPutHeader(header, 70000, MSG_COOK_BATCH | MSG_REPLY, 0xDEADBEEF);
+    protocolGetHeader(header, &body_len, &type, &request_id);
+    failures += !expect(body_len == 70000 && type == (MSG_COOK_BATCH | MSG_REPLY) && request_id == 0xDEADBEEF, "header round trip");
+
+    // A request goes through a socket pair as the server reads it, then a reply
+    // built as the server builds it comes back field by field
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0)
+        return failures + !expect(false, "socket pair");
+    Link link;
+    linkInit(&link, sockets[0]);
+    link.version = PROTOCOL_VERSION;
+    const char *order = "Course: A Order: A1-2 F1-1";
+    uint32_t sent_id = linkSendRequest(&link, MSG_ORDER, order, strlen(order));
+    char frame[FRAME_HEADER_SIZE + MAX_REQUEST_BODY];
+    ssize_t received = recv(sockets[1], frame, sizeof(frame), MSG_DONTWAIT);
+    protocolGetHeader(frame, &body_len, &type, &request_id);
+    failures += !expect(received == (ssize_t)(FRAME_HEADER_SIZE + strlen(order)) && body_len == strlen(order) && type == MSG_ORDER &&
+                            request_id == sent_id && memcmp(frame + FRAME_HEADER_SIZE, order, body_len) == 0,
+                        "framed request round trip");
+
+    int choice = 3;
+    linkSendRequest(&link, MSG_BOOK, &choice, sizeof(choice));
+    received = recv(sockets[1], frame, sizeof(frame), MSG_DONTWAIT);
+    uint32_t net_choice;
+    memcpy(&net_choice, frame + FRAME_HEADER_SIZE, sizeof(net_choice));
+    failures += !expect(received == FRAME_HEADER_SIZE + 4 && ntohl(net_choice) == 3, "table choice is a big endian u32");
+
+    const char *text = "Order was successfully saved!";
+    uint32_t net_value = htonl((uint32_t)-7);
+    uint16_t net_len = htons(strlen(text));
+    char body[64];
+    size_t len = 0;
+    body[len++] = FIELD_INT;
+    memcpy(body + len, &net_value, sizeof(net_value));
+    len += sizeof(net_value);
+    body[len++] = FIELD_TEXT;
+    memcpy(body + len, &net_len, sizeof(net_len));
+    len += sizeof(net_len);
+    memcpy(body + len, text, strlen(text));
+    len += strlen(text);
+    protocolPutHeader(frame, len, MSG_ORDER | MSG_REPLY, sent_id);
+    memcpy(frame + FRAME_HEADER_SIZE, body, len);
+    send(sockets[1], frame, FRAME_HEADER_SIZE + len, 0);
+
+    int value = 0;
+    char reply_text[MAX_BUFFER_SIZE], small[8];
+    failures += !expect(linkRecvReply(&link) == 1 && link.reply_id == sent_id && link.reply_type == (MSG_ORDER | MSG_REPLY), "framed reply header");
+    failures += !expect(linkRecvInt(&link, &value) == 1 && value == -7, "int field round trip");
+    failures += !expect(linkRecvText(&link, reply_text, sizeof(reply_text)) == 1 && strcmp(reply_text, text) == 0, "text field round trip");
+    failures += !expect(linkRecvInt(&link, &value) < 0, "no field past the end of the reply");
+
+    // A text longer than the buffer is cut, never written past it
+    link.reply_pos = 1 + sizeof(net_value);
+    failures += !expect(linkRecvText(&link, small, sizeof(small)) == 1 && strcmp(small, "Order w") == 0, "text field is cut to the buffer");
+
+    // The legacy protocol pads the command and the parameters to their fixed size
+    link.version = PROTOCOL_LEGACY;
+    linkSendRequest(&link, MSG_CHECK, "Rossi 1234", 10);
+    char legacy[MAX_COMMAND_SIZE + MAX_BUFFER_SIZE];
+    received = recv(sockets[1], legacy, sizeof(legacy), MSG_DONTWAIT);
+    failures += !expect(received == (ssize_t)sizeof(legacy) && strcmp(legacy, "check") == 0 && strcmp(legacy + MAX_COMMAND_SIZE, "Rossi 1234") == 0,
+                        "legacy request layout");
+    linkClose(&link);
+    close(sockets[1]);
+    return failures;
+}
+
+int writeCheckLog()
+{
+    // The log a crashed server leaves: a reservation, two orders with their bills, status
+    // changes logged out of order, a return of an expired lease and a torn last record
+    FILE *log = fopen(WAL_FILE, "wb");
+    if (log == NULL)
+        return !expect(false, "open " WAL_FILE);
+
+    Reservation reservation;
+    memset(&reservation, 0, sizeof(reservation));
+    reservation.code = CHECK_CODE;
+    reservation.start = parseReservationDay("12-10-2030") * MINUTES_PER_DAY + parseReservationMinute("20:00");
+    reservation.nr_people = 2;
+    memcpy(reservation.surname, CHECK_SURNAME, strlen(CHECK_SURNAME));
+    appendLogRecord(log, WAL_RESERVATIONS, 0, &reservation, sizeof(reservation));
+
+    OrderBill first = {makeCheckOrder("A", 1, 0, ORDER_WAITING), CHECK_DISH_PRICE};
+    OrderBill second = {makeCheckOrder("B", 2, 0, ORDER_WAITING), 3 * CHECK_DISH_PRICE};
+    appendLogRecord(log, WAL_ORDER_BILL, 0, &first, sizeof(first));
+    appendLogRecord(log, WAL_ORDER_BILL, 1, &second, sizeof(second));
+
+    Order taken = makeCheckOrder("A", 1, 0, ORDER_PREPARING), returned = makeCheckOrder("A", 1, 0, ORDER_WAITING);
+    Order served = makeCheckOrder("B", 2, 0, ORDER_SERVED), stale = makeCheckOrder("B", 2, 0, ORDER_PREPARING);
+    appendLogRecord(log, WAL_ORDERS, 0, &taken, sizeof(taken));
+    appendLogRecord(log, WAL_ORDERS, 1, &served, sizeof(served));
+    appendLogRecord(log, WAL_ORDER_RETURN, 0, &returned, sizeof(returned));
+    appendLogRecord(log, WAL_ORDERS, 1, &stale, sizeof(stale));
+
+    WalRecord torn = {WAL_RECORD_MAGIC, 0, WAL_ORDERS, sizeof(Order), 2};
+    fwrite(&torn, sizeof(torn) / 2, 1, log);
+    return fclose(log) == 0 ? 0 : !expect(false, "write " WAL_FILE);
+}
+
+int checkReplayedLog()
+{
+    Link link, kitchen;
+    char codes[MAX_TAKE_BATCH][MAX_BUFFER_SIZE];
+    if (connectToServer(&link) < 0 || connectToServer(&kitchen) < 0)
+        return !expect(false, "connect to the server");
+
+    // The returned order waits again, the served one stays served even though a stale copy came later
+    int failures = 0;
+    failures += !expect(checkInTable(&link, CHECK_SURNAME, CHECK_CODE) == 1, "logged reservation is found");
+    failures += !expect(readBill(&link) == 3 * CHECK_DISH_PRICE, "bill of both logged orders");
+    int taken = takeOrders(&kitchen, MSG_TAKE, "16", codes);
+    failures += !expect(taken == 1 && strstr(codes[0], " A ") != NULL, "only the returned order waits");
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+    linkClose(&kitchen);
+    return failures;
+}
+
+int checkCompaction()
+{
+    Link link, kitchen;
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE], codes[MAX_TAKE_BATCH][MAX_BUFFER_SIZE];
+    if (connectToServer(&link) < 0 || connectToServer(&kitchen) < 0)
+        return !expect(false, "connect to the server");
+    int code = checkInNewTable(&link, COMPACTION_SURNAME);
+    if (code <= 0)
+        return !expect(false, "check in a new table");
+
+    int failures = 0;
+    for (int i = 0; i < COMPACTION_ORDERS; i++)
+    {
+        sprintf(buffer, "Course: C%d Order: A1-1", i);
+        if (linkSendRequest(&link, MSG_ORDER, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0 || linkRecvText(&link, text, MAX_BUFFER_SIZE) <= 0)
+            return !expect(false, "place an order");
+    }
+
+    // The served orders go to the archive once their segment is sealed, the open ones move on
+    sprintf(buffer, "%d", COMPACTION_SERVED);
+    int taken = takeOrders(&kitchen, MSG_TAKE, buffer, codes);
+    int length = 0;
+    for (int i = 0; i < taken; i++)
+    {
+        int order_code = 0;
+        char table[MAX_BUFFER_SIZE], course[MAX_COURSE_LENGTH];
+        sscanf(codes[i], "%d %s %4s", &order_code, table, course);
+        length += snprintf(buffer + length, sizeof(buffer) - length, "%s%d %s", i > 0 ? " " : "", order_code, course);
+    }
+    failures += !expect(taken == COMPACTION_SERVED, "orders taken");
+    if (linkSendRequest(&kitchen, MSG_READY, buffer, strlen(buffer)) == 0 || linkRecvReply(&kitchen) <= 0)
+        return failures + !expect(false, "mark the orders ready");
+    for (int i = 0; i < taken; i++)
+        linkRecvText(&kitchen, text, MAX_BUFFER_SIZE);
+
+    int archived = 0;
+    for (int waited = 0; waited < COMPACTION_TIMEOUT_SECONDS * 10 && archived < COMPACTION_SERVED; waited++)
+    {
+        usleep(100000);
+        archived = countArchivedOrders(code);
+    }
+    failures += !expect(archived == COMPACTION_SERVED, "served orders are archived");
+    failures += !expect(takeOrders(&kitchen, MSG_TAKE, "16", codes) == COMPACTION_ORDERS - COMPACTION_SERVED, "open orders are still waiting");
+    failures += !expect(readBill(&link) == COMPACTION_ORDERS * CHECK_DISH_PRICE, "bill keeps the archived orders");
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+    linkClose(&kitchen);
+    return failures;
+}
+
+int checkRestartedCompaction()
+{
+    Link link;
+    int code = findReservationCode(COMPACTION_SURNAME);
+    if (code <= 0 || connectToServer(&link) < 0)
+        return !expect(false, "find the reservation and connect to the server");
+
+    // The archive is read back into the bills, but never archived again
+    int failures = 0;
+    failures += !expect(checkInTable(&link, COMPACTION_SURNAME, code) == 1, "reservation of the compaction mode is found");
+    failures += !expect(readBill(&link) == COMPACTION_ORDERS * CHECK_DISH_PRICE, "bill after the restart");
+    failures += !expect(countArchivedOrders(code) == COMPACTION_SERVED, "served orders are archived once");
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+    return failures;
+}
+
+int checkCrowdedBatch()
+{
+    Link link, station, kitchen;
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE], codes[MAX_TAKE_BATCH][MAX_BUFFER_SIZE];
+    if (connectToServer(&link) < 0 || connectToServer(&station) < 0 || connectToServer(&kitchen) < 0)
+        return !expect(false, "connect to the server");
+    int code = checkInNewTable(&link, BATCH_SURNAME);
+    int result = 0;
+    if (code <= 0 || linkSendRequest(&station, MSG_SERVE, "A", 1) == 0 || linkRecvReply(&station) <= 0 ||
+        linkRecvInt(&station, &result) <= 0 || linkRecvText(&station, text, MAX_BUFFER_SIZE) <= 0 || result != 1)
+        return !expect(false, "check in a new table and open a station");
+
+    // The dish of the batches is waiting in another queue, and in the same queue out of the window
+    const char *courses[] = {"B", "C", "A", "E"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (i == 2)
+            sleep(2 * BATCH_WINDOW_SECONDS + 1);
+        for (int k = 0; k < (i < 2 ? BATCH_CROWD : BATCH_ORDERS); k++)
+        {
+            sprintf(buffer, "Course: %s Order: A1-1", courses[i]);
+            if (linkSendRequest(&link, MSG_ORDER, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0 || linkRecvText(&link, text, MAX_BUFFER_SIZE) <= 0)
+                return !expect(false, "place an order");
+        }
+    }
+
+    int failures = 0;
+    sprintf(buffer, "%d", MAX_TAKE_BATCH);
+    int taken = takeOrders(&station, MSG_COOK_BATCH, buffer, codes);
+    for (int i = 0; i < taken; i++)
+        failures += !expect(strstr(codes[i], " A ") != NULL, "station batch holds its own course");
+    failures += !expect(taken == BATCH_ORDERS, "station batch behind a crowd of another queue");
+    sprintf(buffer, "%d E", MAX_TAKE_BATCH);
+    taken = takeOrders(&kitchen, MSG_COOK_BATCH, buffer, codes);
+    for (int i = 0; i < taken; i++)
+        failures += !expect(strstr(codes[i], " E ") != NULL, "course batch holds its course");
+    failures += !expect(taken == BATCH_ORDERS, "course batch behind a crowd out of the window");
+
+    linkSendRequest(&link, MSG_ESC, NULL, 0);
+    linkClose(&link);
+    linkClose(&station);
+    linkClose(&kitchen);
+    return failures;
+}
+
+bool expect(bool condition, const char *what)
+{
+    if (!condition)
+        fprintf(stderr, "[-] Check failed: %s\n", what);
+    return condition;
+}
+
+void appendLogRecord(FILE *log, int file, uint32_t index, const void *data, uint16_t size)
+{
+    // Same layout and checksum as the server writes
+    WalRecord record = {WAL_RECORD_MAGIC, 0, file, size, index};
+    record.checksum = recordChecksum(recordChecksum(0, &record.file, sizeof(record) - offsetof(WalRecord, file)), data, size);
+    fwrite(&record, sizeof(record), 1, log);
+    fwrite(data, size, 1, log);
+}
+
+Order makeCheckOrder(const char *course, int quantity, uint32_t reservation, int status)
+{
+    Order order;
+    memset(&order, 0, sizeof(order));
+    order.rsrv_code = CHECK_CODE;
+    order.reservation = reservation;
+    order.time = 1900000000;
+    order.value = quantity * CHECK_DISH_PRICE;
+    order.status = status;
+    memcpy(order.course, course, strlen(course));
+    order.item_count = 1;
+    memcpy(order.items[0].dish, "A1", DISH_CODE_SIZE);
+    order.items[0].quantity = quantity;
+    return order;
+}
+
+int checkInTable(Link *link, const char *surname, int code)
+{
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE];
+    int result = 0;
+    sprintf(buffer, "%s %d", surname, code);
+    if (linkSendRequest(link, MSG_CHECK, buffer, strlen(buffer)) == 0 || linkRecvReply(link) <= 0 ||
+        linkRecvInt(link, &result) <= 0 || linkRecvText(link, text, MAX_BUFFER_SIZE) <= 0)
+        return -1;
+    return result;
+}
+
+int checkInNewTable(Link *link, const char *surname)
+{
+    char buffer[MAX_BUFFER_SIZE], text[MAX_BUFFER_SIZE];
+    int result = 0, choice = 1, code = 0;
+
+    // A far away date per run, so a table is free
+    srand(time(NULL));
+    sprintf(buffer, "%s 2 %02d-%02d-%d 20:00", surname, 1 + rand() % 28, 1 + rand() % 12, 2100 + rand() % 7000);
+    if (linkSendRequest(link, MSG_FIND, buffer, strlen(buffer)) == 0 || linkRecvReply(link) <= 0 || linkRecvInt(link, &result) <= 0)
+        return -1;
+    for (int k = 0; k < (result > 0 ? result : 1); k++)
+        linkRecvText(link, text, MAX_BUFFER_SIZE);
+    if (result <= 0)
+        return 0;
+
+    if (linkSendRequest(link, MSG_BOOK, &choice, sizeof(choice)) == 0 || linkRecvReply(link) <= 0 ||
+        linkRecvInt(link, &result) <= 0 || linkRecvText(link, text, MAX_BUFFER_SIZE) <= 0 || result <= 0)
+        return 0;
+    sscanf(text, "%d", &code);
+    return checkInTable(link, surname, code) == 1 ? code : 0;
+}
+
+int readBill(Link *link)
+{
+    int bill = -1;
+    if (linkSendRequest(link, MSG_BILL, NULL, 0) == 0 || linkRecvReply(link) <= 0 || linkRecvInt(link, &bill) <= 0)
+        return -1;
+    return bill;
+}
+
+int takeOrders(Link *link, int type, const char *body, char codes[][MAX_BUFFER_SIZE])
+{
+    // A cook batch is replied like a take
+    char text[MAX_BUFFER_SIZE];
+    int found = 0;
+    if (linkSendRequest(link, type, body, strlen(body)) == 0 || linkRecvReply(link) <= 0 || linkRecvInt(link, &found) <= 0)
+        return -1;
+    for (int k = 0; k < (found > 0 ? found : 1); k++)
+    {
+        linkRecvText(link, text, MAX_BUFFER_SIZE);
+        if (k < found)
+            snprintf(codes[k], MAX_BUFFER_SIZE, "%s", text);
+    }
+    return found;
+}
+
+int countArchivedOrders(int code)
+{
+    FILE *archive = fopen(ORDERS_ARCHIVE_FILE, "rb");
+    if (archive == NULL)
+        return 0;
+
+    // Blocks of served orders follow the header, a rebase block holds none
+    FileHeader header;
+    ArchiveBlock block;
+    Order order;
+    int count = 0;
+    if (fread(&header, sizeof(header), 1, archive) == 1 && recordHeaderMatches(&header, ORDERS_ARCHIVE_MAGIC, sizeof(Order)))
+    {
+        while (fread(&block, sizeof(block), 1, archive) == 1)
+        {
+            for (uint32_t i = 0; i < block.count && fread(&order, sizeof(order), 1, archive) == 1; i++)
+                count += order.rsrv_code == code && order.status == ORDER_SERVED;
+        }
+    }
+    fclose(archive);
+    return count;
+}
+
+int findReservationCode(const char *surname)
+{
+    FILE *file = fopen(RESERVATIONS_FILE, "rb");
+    if (file == NULL)
+        return 0;
+
+    FileHeader header;
+    Reservation reservation;
+    int code = 0;
+    if (fread(&header, sizeof(header), 1, file) == 1 && recordHeaderMatches(&header, RESERVATIONS_MAGIC, sizeof(Reservation)))
+    {
+        while (code == 0 && fread(&reservation, sizeof(reservation), 1, file) == 1)
+        {
+            if (strncmp(reservation.surname, surname, sizeof(reservation.surname)) == 0)
+                code = reservation.code;
+        }
+    }
+    fclose(file);
+    return code;
+}
+
+int connectToServer(Link *link)
+{
+    struct sockaddr_in addr;
+    int client_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (client_socket < 0)
+        return -1;
+
+    // Same address convention as the devices
+    memset(&addr, '\0', sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = SERVER_PORT;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(client_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(client_socket);
+        return -1;
+    }
+    linkInit(link, client_socket);
+    if (linkNegotiate(link) == PROTOCOL_LEGACY)
+    {
+        linkClose(link);
+        return -1;
+    }
+    return client_socket;
+}
+
+void printUsage(const char *program)
+{
+    fprintf(stdout, "Usage: %s <mode>, run by ./check.sh\n", program);
+    fprintf(stdout, "protocol ---> names, hellos, frame headers and reply fields survive a round trip, without a server\n");
+    fprintf(stdout, "log      ---> writes the %s a crashed server leaves, for the next server to replay\n", WAL_FILE);
+    fprintf(stdout, "replayed ---> the server replayed the log of the log mode -> bill and waiting orders\n");
+    fprintf(stdout, "compaction -> places and serves orders, waits for them to be archived -> archive, open orders and bill\n");
+    fprintf(stdout, "restarted -> the server restarted after the compaction mode -> bill and archive\n");
+    fprintf(stdout, "batch    ---> cook batches find their orders behind %d waiting orders of the same dish -> batch sizes\n", 2 * BATCH_CROWD);
+}
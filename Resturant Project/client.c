@@ -4,10 +4,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
-
-#define MAX_BUFFER_SIZE 1024
-#define MAX_COMMAND_SIZE 6
-#define SERVER_PORT 4242
+#include "protocol.h"
 
 void prepareClientConnection(char *ip, int *client_socket, struct sockaddr_in *addr);
 void createClientSocket(int *client_socket);
@@ -25,18 +22,22 @@ typedef struct ReservationParameters
     char hour[20];
 } ReservationParameters;
 
-int main(int argc, const char *argv[])
+int main()
 {
     fprintf(stdout, "--------------------------------CLIENT-------------------------------\n");
     char *ip = "127.0.0.1";
-    int port = atoi(argv[1]);
 
-    int client_socket, ret, n;
+    int client_socket;
 
     struct sockaddr_in addr;
-    socklen_t addr_size;
 
     prepareClientConnection(ip, &client_socket, &addr);
+
+    // Use the framed protocol when the server supports it
+    Link link;
+    linkInit(&link, client_socket);
+    if (linkNegotiate(&link) > PROTOCOL_LEGACY)
+        fprintf(stdout, "[+]Using framed protocol v%d.\n", link.version);
     displayMenuAction();
 
     while (1)
@@ -46,90 +47,152 @@ int main(int argc, const char *argv[])
 
         // Get command from user
         bzero(command, MAX_COMMAND_SIZE);
-        scanf("%s", &command);
-        if (startsWith("find", command) || startsWith("book", command) || startsWith("esc", command))
+        scanf("%5s", command);
+        if (startsWith("find", command) || startsWith("book", command) || startsWith("slots", command) || startsWith("grid", command) || startsWith("esc", command))
         {
             fprintf(stdout, "[SEND COMMAND] %s\n", command);
-            if (send(client_socket, command, MAX_COMMAND_SIZE, 0) < 0)
-                fprintf(stdout, "[SENDING ERROR]\n");
-            else
+            if (startsWith("find", command) == true)
             {
-                if (startsWith("find", command) == true)
+                // Get reseravtion parameteres from user
+                ReservationParameters res_param;
+                scanf("%29s %d %19s %19s", res_param.surname, &res_param.people, res_param.date, res_param.hour);
+
+                // Write parameters to buffer
+                bzero(buffer, MAX_BUFFER_SIZE);
+                sprintf(buffer, "%s %d %s %s", res_param.surname, res_param.people, res_param.date, res_param.hour);
+                fprintf(stdout, "[SEND BUFFER] %s\n", buffer);
+
+                // Send parameters to server
+                if (linkSendRequest(&link, MSG_FIND, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0)
+                    fprintf(stdout, "[ERROR] Cannot send to server socket\n");
+                else
                 {
-                    // Get reseravtion parameteres from user
-                    ReservationParameters res_param;
-                    scanf("%s %d %s %s", &res_param.surname, &res_param.people, &res_param.date, &res_param.hour);
-
-                    // Write parameters to buffer
-                    bzero(buffer, MAX_BUFFER_SIZE);
-                    sprintf(buffer, "%s %d %s %s", res_param.surname, res_param.people, res_param.date, res_param.hour);
-                    fprintf(stdout, "[SEND BUFFER] %s\n", buffer);
-
-                    // Send parameters to server
-                    if (send(client_socket, buffer, MAX_BUFFER_SIZE, 0) < 0)
-                        fprintf(stdout, "[ERROR] Cannot send to server socket\n");
+                    // Recive searching for available tables result
+                    int result = 0;
+                    linkRecvInt(&link, &result);
+                    if (result <= 0)
+                    {
+                        linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                        fprintf(stdout, "%s\n", buffer);
+                    }
                     else
                     {
-                        // Recive searching for available tables result
-                        int result;
-                        recv(client_socket, &result, sizeof(int), 0);
-                        if (result <= 0)
-                        {
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                            fprintf(stdout, "%s\n", buffer);
-                        }
-                        else
+                        fprintf(stdout, "We have available %d tables:\n", result);
+                        for (int i = 0; i < result; i++)
                         {
-                            fprintf(stdout, "We have available %d tables:\n", result);
-                            for (int i = 0; i < result; i++)
-                            {
-                                bzero(buffer, MAX_BUFFER_SIZE);
-                                recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                                fprintf(stdout, "%d) %s\n", i + 1, buffer);
-                            }
-                            fprintf(stdout, "Please choose one option and enter: book {nr_of_choosen_table}.\n");
+                            linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                            fprintf(stdout, "%d) %s\n", i + 1, buffer);
                         }
+                        fprintf(stdout, "Please choose one option and enter: book {nr_of_choosen_table}.\n");
                     }
                 }
-                else if (startsWith("book", command) == true)
+            }
+            else if (startsWith("book", command) == true)
+            {
+                // Get table choice from client
+                int choice = 0;
+                scanf("%d", &choice);
+
+                // Send client choice to the server
+                if (linkSendRequest(&link, MSG_BOOK, &choice, sizeof(int)) == 0 || linkRecvReply(&link) <= 0)
+                    fprintf(stdout, "[ERROR] Cannot send to server socket\n");
+                else
                 {
-                    // Get table choice from client
-                    int choice = 0;
-                    scanf("%d", &choice);
+                    fprintf(stdout, "[SEND BUFFER] %d\n", choice);
 
-                    // Send client choice to the server
-                    if (send(client_socket, &choice, sizeof(int), 0) < 0)
-                        fprintf(stdout, "[ERROR] Cannot send to server socket\n");
+                    int result = -1;
+                    linkRecvInt(&link, &result);
+                    linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                    if (result < 0)
+                    {
+                        fprintf(stdout, "%s\n", buffer);
+                    }
                     else
                     {
-                        fprintf(stdout, "[SEND BUFFER] %d\n", choice);
+                        fprintf(stdout, "BOOKIN MADE: %s\n", buffer);
+                    }
+                }
+            }
+            else if (startsWith("slots", command) == true)
+            {
+                // Get party size and day from user
+                int people = 0;
+                char date[20];
+                scanf("%d %19s", &people, date);
+                bzero(buffer, MAX_BUFFER_SIZE);
+                sprintf(buffer, "%d %s", people, date);
+                fprintf(stdout, "[SEND BUFFER] %s\n", buffer);
 
-                        int result;
-                        recv(client_socket, &result, sizeof(int), 0);
-                        bzero(buffer, MAX_BUFFER_SIZE);
-                        recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                        if (result < 0)
-                        {
-                            fprintf(stdout, "%s\n", buffer);
-                        }
-                        else
+                if (linkSendRequest(&link, MSG_SLOTS, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0)
+                    fprintf(stdout, "[ERROR] Cannot send to server socket\n");
+                else
+                {
+                    // Recive hours with free tables
+                    int result = 0;
+                    linkRecvInt(&link, &result);
+                    if (result <= 0)
+                    {
+                        linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                        fprintf(stdout, "%s\n", buffer);
+                    }
+                    else
+                    {
+                        fprintf(stdout, "Free tables on %s for %d people:\n", date, people);
+                        for (int i = 0; i < result; i++)
                         {
-                            fprintf(stdout, "BOOKIN MADE: %s\n", buffer);
+                            char hour[6];
+                            int tables = 0;
+                            linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                            sscanf(buffer, "%5s %d", hour, &tables);
+                            fprintf(stdout, "%s ---> %d table(s)\n", hour, tables);
                         }
                     }
                 }
-                else if (startsWith("esc", command) == true)
+            }
+            else if (startsWith("grid", command) == true)
+            {
+                // Get party size, dates and hours from user
+                int people = 0;
+                char first_date[20], last_date[20], first_hour[20], last_hour[20];
+                scanf("%d %19s %19s %19s %19s", &people, first_date, last_date, first_hour, last_hour);
+                bzero(buffer, MAX_BUFFER_SIZE);
+                sprintf(buffer, "%d %s %s %s %s", people, first_date, last_date, first_hour, last_hour);
+                fprintf(stdout, "[SEND BUFFER] %s\n", buffer);
+
+                if (linkSendRequest(&link, MSG_GRID, buffer, strlen(buffer)) == 0 || linkRecvReply(&link) <= 0)
+                    fprintf(stdout, "[ERROR] Cannot send to server socket\n");
+                else
                 {
-                    // send esc command to server and disconect from server
-                    bzero(buffer, MAX_BUFFER_SIZE);
-                    strcpy(buffer, command);
-                    send(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                    close(client_socket);
-                    fprintf(stdout, "[+]Disconnected from the server.\n");
-                    return 0;
+                    // Recive the hours, then the free tables of every hour for one date after another
+                    int result = 0;
+                    linkRecvInt(&link, &result);
+                    linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                    if (result <= 0)
+                        fprintf(stdout, "%s\n", buffer);
+                    else
+                    {
+                        fprintf(stdout, "Free tables for %d people:\n", people);
+                        fprintf(stdout, "%-10s %s\n", "", buffer);
+                        for (int i = 0; i < result; i++)
+                        {
+                            char *field = NULL;
+                            linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                            fprintf(stdout, "%-10s", strtok_r(buffer, " ", &field));
+                            for (char *tables = strtok_r(NULL, " ", &field); tables != NULL; tables = strtok_r(NULL, " ", &field))
+                                fprintf(stdout, " %5s", tables);
+                            fprintf(stdout, "\n");
+                        }
+                    }
                 }
             }
+            else if (startsWith("esc", command) == true)
+            {
+                // send esc command to server and disconect from server
+                linkSendRequest(&link, MSG_ESC, NULL, 0);
+                linkClose(&link);
+                fprintf(stdout, "[+]Disconnected from the server.\n");
+                return 0;
+            }
         }
         else
             fprintf(stdout, "Wrong command, please try again.\n");
@@ -146,7 +209,7 @@ void prepareClientConnection(char *ip, int *client_socket, struct sockaddr_in *a
 void createClientSocket(int *client_socket)
 {
     *client_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (client_socket < 0)
+    if (*client_socket < 0)
     {
         perror("[-]Socket error.\n");
         exit(1);
@@ -179,7 +242,9 @@ void displayMenuAction()
     fprintf(stdout, "Type a command:\n");
     fprintf(stdout, "1)   find  ---> search availabilty for a reservation\n");
     fprintf(stdout, "2)   book  ---> seand a reservation\n");
-    fprintf(stdout, "3)   esc   ---> terminate the client\n");
+    fprintf(stdout, "3)   slots ---> list free hours of a day: slots {people} {date}\n");
+    fprintf(stdout, "4)   grid  ---> free tables over days and hours: grid {people} {from date} {to date} {from hour} {to hour}\n");
+    fprintf(stdout, "5)   esc   ---> terminate the client\n");
 }
 
 bool startsWith(const char *pre, const char *str)
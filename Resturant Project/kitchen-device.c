@@ -3,11 +3,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include "protocol.h"
 
-#define MAX_BUFFER_SIZE 1024
-#define MAX_COMMAND_SIZE 6
-#define SERVER_PORT 4242
+#define MAX_ORDER_SIZE 57 // Size of the dishes of an order: 8 dishes like A1-255, terminator included
 
 // Struct for orders handling
 typedef struct Order
@@ -15,7 +16,8 @@ typedef struct Order
     int rsrv_code;
     char table_id[5];
     char course[5];
-    char order[30];
+    char order[MAX_ORDER_SIZE];
+    int batch; // Number of the cook batch the order was taken in, every taken order alone has its own
 } Order;
 
 void prepareClientConnection(char *ip, int *client_socket, struct sockaddr_in *addr);
@@ -24,19 +26,36 @@ void initializeServerAddress(char *ip, struct sockaddr_in *addr);
 void connectToServer(int *client_socket, struct sockaddr_in *addr);
 void displayMenuAction();
 bool startsWith(const char *pre, const char *str);
-void cleanOrder(Order *order);
+void readyAndTakeNext(Link *link, Order taken[], int *taken_count);
+void receiveTakenOrders(Link *link, Order taken[], int *taken_count, bool cook_batch);
+int selectTakenOrders(const char *args, const Order taken[], int taken_count, bool selected[]);
+void buildReadyRequest(const Order taken[], int taken_count, const bool selected[], char *buffer);
+void removeTakenOrders(Order taken[], int *taken_count, const bool selected[]);
+void printTakenOrders(const Order taken[], int taken_count);
+int recvReply(Link *link);
+bool waitForCommand(Link *link, int *taken_count);
+bool sendHeartbeat(Link *link, int *taken_count);
+void printKitchenEvent(Link *link);
 
-int main(int argc, const char *argv[])
+int main()
 {
     fprintf(stdout, "--------------------------------KITCHEN DEVICE--------------------------------\n");
-    Order order = {0, "", "", ""};
+    Order taken[MAX_TAKE_BATCH]; // Orders taken by this device and not marked ready yet
+    int taken_count = 0;
     char *ip = "127.0.0.1";
-    int port = atoi(argv[1]);
-    int client_socket, ret, n;
+    int client_socket;
     struct sockaddr_in addr;
-    socklen_t addr_size;
+    bool subscribed = false;
 
+    // Commands are read straight from the descriptor, so poll() sees every typed command
+    setvbuf(stdin, NULL, _IONBF, 0);
     prepareClientConnection(ip, &client_socket, &addr);
+
+    // Use the framed protocol when the server supports it
+    Link link;
+    linkInit(&link, client_socket);
+    if (linkNegotiate(&link) > PROTOCOL_LEGACY)
+        fprintf(stdout, "[+]Using framed protocol v%d.\n", link.version);
     displayMenuAction();
 
     while (1)
@@ -44,107 +63,163 @@ int main(int argc, const char *argv[])
         char command[MAX_COMMAND_SIZE];
         char buffer[MAX_BUFFER_SIZE];
         bzero(command, MAX_COMMAND_SIZE);
-        scanf("%s", &command);
-        if (strcmp("take", command) == 0 || strcmp("ready", command) == 0 || strcmp("show", command) == 0 || strcmp("esc", command) == 0)
+        // A device holding orders sends heartbeats while it waits, or the server gives them to another device
+        bool heartbeat = taken_count > 0 && link.version != PROTOCOL_LEGACY;
+        if ((subscribed || heartbeat) && !waitForCommand(&link, &taken_count))
+        {
+            fprintf(stdout, "[-]Disconnected from the server.\n");
+            linkClose(&link);
+            return 0;
+        }
+        scanf("%5s", command);
+        if (strcmp("take", command) == 0 || strcmp("ready", command) == 0 || strcmp("show", command) == 0 || strcmp("next", command) == 0 || strcmp("feed", command) == 0 || strcmp("serve", command) == 0 || strcmp("batch", command) == 0 || strcmp("esc", command) == 0)
         {
+            // Arguments of the command are the rest of its line
+            char args[MAX_BUFFER_SIZE];
+            if (strcmp("esc", command) != 0 && fgets(args, sizeof(args), stdin) == NULL)
+                args[0] = '\0';
+
             if (strcmp("take", command) == 0)
             {
-                if (order.rsrv_code == 0)
+                if (taken_count < MAX_TAKE_BATCH)
                 {
-                    if (send(client_socket, command, MAX_COMMAND_SIZE, 0) < 0)
-                        printf("[SENDING ERROR]\n");
-                    else
+                    // "take", "take N", "take N course" or "take course" for all of one course
+                    int count = 0;
+                    char course[5] = "";
+                    if (sscanf(args, "%d %4s", &count, course) < 1)
                     {
-                        // Recive information about taken order
-                        int result;
-                        recv(client_socket, &result, sizeof(int), 0);
-                        bzero(buffer, MAX_BUFFER_SIZE);
-                        recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                        if (result > 0)
-                        {
-                            sscanf(buffer, "%d %s %s %[^/n]", &order.rsrv_code, order.table_id, order.course, order.order);
-                            fprintf(stdout, "[SERVER] Rsrv code %d Order for table %s course: %s order: %s\n", order.rsrv_code, order.table_id, order.course, order.order);
-                        }
-                        else
-                        {
-                            fprintf(stdout, "[SERVER]%s\n", buffer);
-                        }
+                        sscanf(args, "%4s", course);
+                        count = course[0] != '\0' ? MAX_TAKE_BATCH : 1;
                     }
+                    count = count < 1 ? 1 : count > MAX_TAKE_BATCH - taken_count ? MAX_TAKE_BATCH - taken_count : count;
+                    sprintf(buffer, "%d %s", count, course);
+                    if (linkSendRequest(&link, MSG_TAKE, buffer, strlen(buffer)) == 0 || recvReply(&link) <= 0)
+                        printf("[SENDING ERROR]\n");
+                    else
+                        receiveTakenOrders(&link, taken, &taken_count, false);
+                }
+                else
+                {
+                    fprintf(stdout, "Kitchen device already holds %d orders. Please finish orders first!\n", taken_count);
+                }
+            }
+            else if (strcmp("batch", command) == 0)
+            {
+                if (taken_count < MAX_TAKE_BATCH)
+                {
+                    // "batch" or "batch course": the next order with the same dishes ordered by other
+                    // tables around it, as many as the device can still hold
+                    char course[5] = "";
+                    sscanf(args, "%4s", course);
+                    sprintf(buffer, "%d %s", MAX_TAKE_BATCH - taken_count, course);
+                    if (linkSendRequest(&link, MSG_COOK_BATCH, buffer, strlen(buffer)) == 0 || recvReply(&link) <= 0)
+                        printf("[SENDING ERROR]\n");
+                    else
+                        receiveTakenOrders(&link, taken, &taken_count, true);
                 }
                 else
                 {
-                    fprintf(stdout, "Order already taken by kitchen device. Please finish order first!\n");
+                    fprintf(stdout, "Kitchen device already holds %d orders. Please finish orders first!\n", taken_count);
                 }
             }
             else if (strcmp("ready", command) == 0)
             {
-                if (order.rsrv_code != 0)
+                bool selected[MAX_TAKE_BATCH];
+                int pairs = selectTakenOrders(args, taken, taken_count, selected);
+                if (taken_count == 0)
+                    fprintf(stdout, "No order taken by kitchen device. Please take order first!\n");
+                else if (pairs <= 0)
+                    fprintf(stdout, "Give the numbers of taken orders, e.g. ready 1 3, or nothing for all of them.\n");
+                else
                 {
-                    if (send(client_socket, command, MAX_COMMAND_SIZE, 0) < 0)
+                    buildReadyRequest(taken, taken_count, selected, buffer);
+                    if (linkSendRequest(&link, MSG_READY, buffer, strlen(buffer)) == 0 || recvReply(&link) <= 0)
                         printf("[SENDING ERROR]\n");
                     else
                     {
-                        bzero(buffer, MAX_BUFFER_SIZE);
-                        sprintf(buffer, "%d %s", order.rsrv_code, order.course);
-                        send(client_socket, buffer, MAX_BUFFER_SIZE, 0);
                         fprintf(stdout, "[KD] %s\n", buffer);
+                        removeTakenOrders(taken, &taken_count, selected);
 
-                        cleanOrder(&order);
-
-                        bzero(buffer, MAX_BUFFER_SIZE);
-                        recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                        fprintf(stdout, "%s\n", buffer);
+                        // One answer for every order marked ready
+                        for (int i = 0; i < pairs; i++)
+                        {
+                            linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                            fprintf(stdout, "%s\n", buffer);
+                        }
+                        printTakenOrders(taken, taken_count);
                     }
                 }
+            }
+            else if (strcmp("next", command) == 0)
+            {
+                if (taken_count != 0)
+                    readyAndTakeNext(&link, taken, &taken_count);
                 else
-                {
                     fprintf(stdout, "No order taken by kitchen device. Please take order first!\n");
-                }
             }
             else if (strcmp("show", command) == 0)
             {
-                if (send(client_socket, command, MAX_COMMAND_SIZE, 0) < 0)
+                if (linkSendRequest(&link, MSG_SHOW, NULL, 0) == 0 || recvReply(&link) <= 0)
                     printf("[SENDING ERROR]\n");
                 else
                 {
                     int result = 0;
-                    recv(client_socket, &result, sizeof(int), 0);
+                    linkRecvInt(&link, &result);
                     if (result <= 0)
                     {
-                        recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
+                        linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
                         fprintf(stdout, "%s\n", buffer);
                     }
                     else
                     {
                         int orders_nr = 0;
                         fprintf(stdout, "Orders in reparation:\n");
-                        recv(client_socket, &orders_nr, sizeof(int), 0);
+                        linkRecvInt(&link, &orders_nr);
                         for (int i = 0; i < orders_nr; i++)
                         {
                             Order order;
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                            sscanf(buffer, "%s %s %[^/n]", &order.table_id, &order.course, &order.order);
+                            linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                            sscanf(buffer, "%4s %4s %56[^\n]", order.table_id, order.course, order.order);
                             fprintf(stdout, "%d)Table %s course %s order details: %s\n", i + 1, order.table_id, order.course, order.order);
                         }
                     }
                 }
             }
-            else if (strcmp("esc", command) == 0)
+            else if (strcmp("feed", command) == 0)
             {
-                if (send(client_socket, command, MAX_COMMAND_SIZE, 0) < 0)
+                if (linkSendRequest(&link, MSG_FEED, NULL, 0) == 0 || recvReply(&link) <= 0)
                     printf("[SENDING ERROR]\n");
                 else
                 {
-                    // send esc command to server and disconect from server
-                    char buffer[MAX_BUFFER_SIZE] = {0};
-                    strcpy(buffer, command);
-                    send(client_socket, buffer, strlen(buffer), 0);
-                    close(client_socket);
-                    fprintf(stdout, "[+]Disconnected from the server.\n");
-                    return 0;
+                    // From now on the server pushes new, taken and served orders
+                    int result = 0;
+                    linkRecvInt(&link, &result);
+                    linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                    fprintf(stdout, "[SERVER]%s\n", buffer);
+                    subscribed = result > 0;
                 }
             }
+            else if (strcmp("serve", command) == 0)
+            {
+                // Courses this device cooks as a station, "serve" alone serves every course again
+                if (linkSendRequest(&link, MSG_SERVE, args, strcspn(args, "\n")) == 0 || recvReply(&link) <= 0)
+                    printf("[SENDING ERROR]\n");
+                else
+                {
+                    int result = 0;
+                    linkRecvInt(&link, &result);
+                    linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
+                    fprintf(stdout, "[SERVER]%s\n", buffer);
+                }
+            }
+            else if (strcmp("esc", command) == 0)
+            {
+                // send esc command to server and disconect from server
+                linkSendRequest(&link, MSG_ESC, NULL, 0);
+                linkClose(&link);
+                fprintf(stdout, "[+]Disconnected from the server.\n");
+                return 0;
+            }
         }
         else
             fprintf(stdout, "Wrong command, please try again.\n");
@@ -161,7 +236,7 @@ void prepareClientConnection(char *ip, int *client_socket, struct sockaddr_in *a
 void createClientSocket(int *client_socket)
 {
     *client_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (client_socket < 0)
+    if (*client_socket < 0)
     {
         perror("[-]Socket error.\n");
         exit(1);
@@ -192,9 +267,13 @@ void displayMenuAction()
 {
     fprintf(stdout, "\n------------------WELCOME!-----------------\n");
     fprintf(stdout, "Type a command:\n");
-    fprintf(stdout, "1)   take    ---> accept command\n");
-    fprintf(stdout, "2)   ready   ---> set the status of the command\n");
-    fprintf(stdout, "3)   show    ---> show the accepted commands\n");
+    fprintf(stdout, "1)   take [N] [course] ---> accept up to N commands, or all commands of a course\n");
+    fprintf(stdout, "2)   ready [1 3 ...]   ---> set the status of the taken commands, all of them without numbers\n");
+    fprintf(stdout, "3)   show              ---> show the accepted commands\n");
+    fprintf(stdout, "4)   next              ---> set the taken commands ready and accept as many new ones\n");
+    fprintf(stdout, "5)   feed              ---> follow new, taken and served commands as they happen\n");
+    fprintf(stdout, "6)   serve [courses]   ---> take the commands of these courses first, as a station\n");
+    fprintf(stdout, "7)   batch [course]    ---> accept the next command and the same dishes of other tables, cooked as one\n");
 }
 
 bool startsWith(const char *pre, const char *str)
@@ -207,10 +286,227 @@ bool startsWith(const char *pre, const char *str)
         return false;
 }
 
-void cleanOrder(Order *order)
+void readyAndTakeNext(Link *link, Order taken[], int *taken_count)
 {
-    strncpy(order->course, "", sizeof(order->course));
-    strncpy(order->order, "", sizeof(order->order));
-    order->rsrv_code = 0;
-    strncpy(order->table_id, "", sizeof(order->table_id));
-}
\ No newline at end of file
+    char buffer[MAX_BUFFER_SIZE], take[MAX_BUFFER_SIZE];
+    bool selected[MAX_TAKE_BATCH];
+    int pairs = selectTakenOrders("", taken, *taken_count, selected);
+    buildReadyRequest(taken, *taken_count, selected, buffer);
+    sprintf(take, "%d", pairs);
+
+    // Both requests leave together, the server answers them in this order
+    uint32_t ready_id = linkSendRequest(link, MSG_READY, buffer, strlen(buffer));
+    uint32_t take_id = ready_id != 0 ? linkSendRequest(link, MSG_TAKE, take, strlen(take)) : 0;
+    if (take_id == 0)
+    {
+        printf("[SENDING ERROR]\n");
+        return;
+    }
+    fprintf(stdout, "[KD] %s\n", buffer);
+    removeTakenOrders(taken, taken_count, selected);
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (recvReply(link) <= 0)
+        {
+            fprintf(stdout, "[ERROR] Cannot recive from server socket\n");
+            return;
+        }
+        if (link->reply_id == ready_id)
+        {
+            for (int j = 0; j < pairs; j++)
+            {
+                linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+                fprintf(stdout, "%s\n", buffer);
+            }
+        }
+        else if (link->reply_id == take_id)
+            receiveTakenOrders(link, taken, taken_count, false);
+    }
+}
+
+void receiveTakenOrders(Link *link, Order taken[], int *taken_count, bool cook_batch)
+{
+    // Recive information about taken orders: their number, then one text per order;
+    // the orders of a cook batch share its number and are listed and made ready as one
+    static int batches = 0;
+    char buffer[MAX_BUFFER_SIZE];
+    int result = 0, batch = ++batches;
+    linkRecvInt(link, &result);
+    if (result <= 0)
+    {
+        linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+        fprintf(stdout, "[SERVER]%s\n", buffer);
+        return;
+    }
+    for (int i = 0; i < result && *taken_count < MAX_TAKE_BATCH; i++)
+    {
+        Order *order = &taken[*taken_count];
+        linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+        if (sscanf(buffer, "%d %4s %4s %56[^\n]", &order->rsrv_code, order->table_id, order->course, order->order) < 3)
+            continue;
+        fprintf(stdout, "[SERVER] Rsrv code %d Order for table %s course: %s order: %s\n", order->rsrv_code, order->table_id, order->course, order->order);
+        order->batch = batch;
+        if (!cook_batch)
+            batch = ++batches;
+        (*taken_count)++;
+    }
+    printTakenOrders(taken, *taken_count);
+}
+
+int selectTakenOrders(const char *args, const Order taken[], int taken_count, bool selected[])
+{
+    // Numbers of the list printed by printTakenOrders, none selects every order; a number
+    // of a cook batch selects all of its orders, they are next to each other
+    int pairs = 0, number, length, units = 0;
+    int unit[MAX_TAKE_BATCH];
+    for (int i = 0; i < taken_count; i++)
+        unit[i] = i > 0 && taken[i].batch == taken[i - 1].batch ? units : ++units;
+    memset(selected, 0, MAX_TAKE_BATCH * sizeof(bool));
+    while (sscanf(args, "%d%n", &number, &length) == 1)
+    {
+        if (number < 1 || number > units)
+            return -1;
+        for (int i = 0; i < taken_count; i++)
+        {
+            if (unit[i] == number && !selected[i])
+            {
+                selected[i] = true;
+                pairs++;
+            }
+        }
+        args += length;
+    }
+    if (strspn(args, " \t\n") != strlen(args))
+        return -1;
+    if (pairs > 0)
+        return pairs;
+    for (int i = 0; i < taken_count; i++)
+        selected[i] = true;
+    return taken_count;
+}
+
+void buildReadyRequest(const Order taken[], int taken_count, const bool selected[], char *buffer)
+{
+    int length = 0;
+    buffer[0] = '\0';
+    for (int i = 0; i < taken_count; i++)
+    {
+        if (selected[i])
+            length += sprintf(buffer + length, "%s%d %s", length > 0 ? " " : "", taken[i].rsrv_code, taken[i].course);
+    }
+}
+
+void removeTakenOrders(Order taken[], int *taken_count, const bool selected[])
+{
+    int kept = 0;
+    for (int i = 0; i < *taken_count; i++)
+    {
+        if (!selected[i])
+            taken[kept++] = taken[i];
+    }
+    *taken_count = kept;
+}
+
+void printTakenOrders(const Order taken[], int taken_count)
+{
+    if (taken_count == 0)
+        return;
+    fprintf(stdout, "Taken orders:\n");
+    int units = 0;
+    for (int i = 0; i < taken_count; i++)
+    {
+        // A cook batch is listed as one, with its orders below it
+        int size = 1;
+        while (i + size < taken_count && taken[i + size].batch == taken[i].batch)
+            size++;
+        if (size == 1)
+        {
+            fprintf(stdout, "%d)Table %s course %s order details: %s\n", ++units, taken[i].table_id, taken[i].course, taken[i].order);
+            continue;
+        }
+        fprintf(stdout, "%d)Cook batch of %d orders:\n", ++units, size);
+        for (int j = i; j < i + size; j++)
+            fprintf(stdout, "   Table %s course %s order details: %s\n", taken[j].table_id, taken[j].course, taken[j].order);
+        i += size - 1;
+    }
+}
+
+int recvReply(Link *link)
+{
+    // Events pushed before the reply are printed on the way, a reply never has id 0
+    int result;
+    while ((result = linkRecvReply(link)) > 0 && link->version != PROTOCOL_LEGACY && link->reply_id == 0)
+        printKitchenEvent(link);
+    return result;
+}
+
+bool waitForCommand(Link *link, int *taken_count)
+{
+    // Pushed events are printed until the next command is typed, a heartbeat is sent
+    // every KITCHEN_HEARTBEAT_SECONDS while the device holds orders
+    static time_t last_heartbeat = 0;
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {link->sock, POLLIN, 0}};
+    while (1)
+    {
+        int timeout = -1;
+        if (*taken_count > 0 && link->version != PROTOCOL_LEGACY)
+        {
+            time_t now = time(NULL);
+            if (now - last_heartbeat >= KITCHEN_HEARTBEAT_SECONDS)
+            {
+                if (!sendHeartbeat(link, taken_count))
+                    return false;
+                last_heartbeat = now;
+            }
+            timeout = (last_heartbeat + KITCHEN_HEARTBEAT_SECONDS - now) * 1000;
+        }
+        if (poll(fds, 2, timeout) <= 0)
+            continue;
+        if (fds[1].revents != 0)
+        {
+            if (linkRecvReply(link) <= 0)
+                return false;
+            printKitchenEvent(link);
+        }
+        if (fds[0].revents != 0)
+            return true;
+    }
+}
+
+bool sendHeartbeat(Link *link, int *taken_count)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    int held = 0;
+    if (linkSendRequest(link, MSG_RENEW, NULL, 0) == 0 || recvReply(link) <= 0)
+        return false;
+    linkRecvInt(link, &held);
+    linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+
+    // The lease expired and other devices may cook the orders now, this one lets them go
+    if (held < 0)
+    {
+        fprintf(stdout, "[SERVER]%s\n", buffer);
+        *taken_count = 0;
+    }
+    return true;
+}
+
+void printKitchenEvent(Link *link)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    int event = 0, sequence = 0;
+    Order order = {0};
+    linkRecvInt(link, &event);
+    linkRecvInt(link, &sequence);
+    linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+    if (event == FEED_MISSED)
+    {
+        fprintf(stdout, "[FEED] %s, use show\n", buffer);
+        return;
+    }
+
+    const char *what = event == FEED_NEW_ORDER ? "New order" : event == FEED_CLAIMED ? "Taken" : event == FEED_RETURNED ? "Back in queue" : "Served";
+    sscanf(buffer, "%d %4s %4s %56[^\n]", &order.rsrv_code, order.table_id, order.course, order.order);
+    fprintf(stdout, "[FEED] #%d %s: Rsrv code %d table %s course: %s order: %s\n", sequence, what, order.rsrv_code, order.table_id, order.course, order.order);
+}
@@ -0,0 +1,668 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+#include "records.h"
+
+#define LEGACY_PAGE_SIZE 4096 // Address randomization moves ALL_TABLES by whole pages
+#define WRITE_CHUNK_SIZE 4096 // Zero chunks of a converted file are skipped, so freed segments stay holes
+#define NO_RESERVATION UINT32_MAX // Reservation of an order that matches no reservation, it is billed to none
+
+// Struct for a reservation as the first server dumped it (x86-64 layout)
+typedef struct LegacyReservation
+{
+    int code;         // Unique reservation code
+    char surname[30]; // Surname of the person who made the reservation
+    int nr_people;    // Number of people to be seated
+    char date[20];    // Date of the reservation
+    char hour[20];    // Time of the reservation
+    uint64_t table;   // Address of the reserved table in the server that wrote the record
+} LegacyReservation;
+
+// Struct for an order as the first server dumped it (x86-64 layout)
+typedef struct LegacyOrder
+{
+    int rsrv_code;    // Reservation code associated with the order
+    char table_id[5]; // Identifier of the table the order is placed from
+    char course[5];   // Course code for the ordered item
+    char order[30];   // Description of the ordered item
+    char status[20];  // Current status of the order
+    int value;        // Price of the ordered item
+    int64_t time;     // Time when the order was placed
+} LegacyOrder;
+
+// Struct for an order of record format v1, which kept the dishes as text
+typedef struct __attribute__((packed)) OrderV1
+{
+    int32_t rsrv_code;  // Reservation code associated with the order
+    uint32_t time;      // Seconds since 01-01-1970 when the order was placed
+    int32_t value;      // Price of the ordered items
+    uint8_t table;      // Index in ALL_TABLES of the table the order is placed from
+    uint8_t status;     // Current status of the order (ORDER_*)
+    char course[5];     // Course code for the ordered item
+    char order[30];     // Dishes of the order, e.g. "A1-2 D2-1"
+} OrderV1;
+
+// Struct for an order of record format v2, which did not keep the position of its reservation
+typedef struct __attribute__((packed)) OrderV2
+{
+    int32_t rsrv_code;                // Reservation code associated with the order
+    uint32_t time;                    // Seconds since 01-01-1970 when the order was placed
+    int32_t value;                    // Price of the ordered items
+    uint8_t table;                    // Index in ALL_TABLES of the table the order is placed from
+    uint8_t status;                   // Current status of the order (ORDER_*)
+    char course[MAX_COURSE_LENGTH];   // Course code for the ordered item
+    uint8_t item_count;               // Number of dishes in items
+    OrderItem items[MAX_ORDER_ITEMS]; // Ordered dishes, every code at most once
+} OrderV2;
+
+// Struct for the data of a WAL_ORDER_BILL record of format v2
+typedef struct __attribute__((packed)) OrderBillV2
+{
+    OrderV2 order;        // New order, placed at the index of the log record
+    uint32_t reservation; // Position in RESERVATIONS_FILE of the reservation the order is billed to
+    int32_t bill;         // Bill of the reservation with this order
+} OrderBillV2;
+
+_Static_assert(sizeof(LegacyReservation) == 88, "layout of the first server");
+_Static_assert(sizeof(LegacyOrder) == 80, "layout of the first server");
+_Static_assert(sizeof(OrderV1) == 49, "layout of record format v1");
+_Static_assert(sizeof(OrderV2) == 44, "layout of record format v2");
+
+Reservation *reservations = NULL; // Converted reservations, older orders are matched to them
+uint32_t *positions_by_code = NULL; // Positions in reservations, sorted by reservation code
+long reservations_count = 0;        // Number of converted reservations
+
+// Methods handling conversion
+int recordFileVersion(const char *path, const char *magic);
+int replayOldLog();
+int migrateReservations();
+int migrateOrders();
+int migrateOrdersV1();
+int migrateOrdersV2();
+int migrateOrderArchive();
+int migrateBills();
+int updateHeaderVersion(const char *path, const char *magic, uint16_t record_size);
+void convertOrderV1(const OrderV1 *v1, Order *order, long position);
+void convertOrderV2(const OrderV2 *v2, Order *order, long position);
+void convertOrderDishes(Order *order, const char *text, size_t len, long position);
+int loadReservations();
+int compareReservationCodes(const void *first, const void *second);
+uint32_t findOrderReservation(const Order *order, long position);
+int findTablesPageOffset(const LegacyReservation *reservations, long count);
+int resolveLegacyTable(const LegacyReservation *reservation, int page_offset);
+void *readLegacyRecords(const char *path, size_t record_size, long *count);
+int writeRecords(const char *path, const char *magic, const void *records, size_t record_size, long count, int from_version);
+int writeDataFile(const char *path, const FileHeader *header, const void *body, size_t len, int from_version);
+
+// Supporting methods
+int roundToEven(int num);
+
+int main(int argc, const char *argv[])
+{
+    fprintf(stdout, "------------------------------------------MIGRATE-------------------------------------------\n");
+    if (argc > 1 && chdir(argv[1]) < 0)
+    {
+        fprintf(stdout, "Usage: %s [directory with %s and %s]\n", argv[0], RESERVATIONS_FILE, ORDERS_FILE);
+        return 1;
+    }
+
+    // Changes still in the log belong to the old files, so they go in before converting
+    if (replayOldLog() < 0 || migrateReservations() < 0 || loadReservations() < 0 || migrateBills() < 0 ||
+        migrateOrders() < 0 || migrateOrderArchive() < 0)
+        return 1;
+    free(reservations);
+    free(positions_by_code);
+    return 0;
+}
+
+// Returns the record format of a data file, 0 for a raw dump of the first server, -1 when it is missing or empty
+int recordFileVersion(const char *path, const char *magic)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+
+    FileHeader header;
+    bool has_header = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, magic, sizeof(header.magic)) == 0;
+    fseek(file, 0, SEEK_END);
+    bool empty = ftell(file) == 0;
+    fclose(file);
+    if (empty)
+        return -1;
+    return has_header ? header.version : 0;
+}
+
+int replayOldLog()
+{
+    int reservations_version = recordFileVersion(RESERVATIONS_FILE, RESERVATIONS_MAGIC);
+    int orders_version = recordFileVersion(ORDERS_FILE, ORDERS_MAGIC);
+    FILE *log = fopen(WAL_FILE, "rb");
+    if (log == NULL)
+        return 0;
+    bool old_reservations = reservations_version >= 0 && reservations_version < RECORD_FORMAT_VERSION;
+    bool old_orders = orders_version >= 0 && orders_version < RECORD_FORMAT_VERSION;
+    if (!old_reservations && !old_orders)
+    {
+        // A log of converted files is replayed by the server itself
+        fclose(log);
+        return 0;
+    }
+
+    // Raw dumps start with their first record, later formats with a header; only v2 logs bills with the orders
+    int log_version = orders_version >= 0 ? orders_version : reservations_version;
+    size_t order_size = log_version == 0 ? sizeof(LegacyOrder) : log_version == 1 ? sizeof(OrderV1) : sizeof(OrderV2);
+    const char *files[] = {NULL, RESERVATIONS_FILE, ORDERS_FILE, ORDERS_FILE, ORDERS_FILE};
+    const size_t sizes[] = {0, reservations_version == 0 ? sizeof(LegacyReservation) : sizeof(Reservation), order_size, 0, sizeof(OrderBillV2)};
+    const off_t bases[] = {0, reservations_version == 0 ? 0 : sizeof(FileHeader), orders_version == 0 ? 0 : sizeof(FileHeader),
+                           sizeof(FileHeader), sizeof(FileHeader)};
+    int last_file = log_version == 2 ? WAL_ORDER_BILL : WAL_ORDER_SEGMENT;
+    char data[sizeof(LegacyReservation)];
+    WalRecord record;
+    long replayed = 0;
+    while (fread(&record, sizeof(record), 1, log) == 1)
+    {
+        if (record.magic != WAL_RECORD_MAGIC || record.file < WAL_RESERVATIONS || record.file > last_file ||
+            record.size != sizes[record.file] || (record.size > 0 && fread(data, record.size, 1, log) != 1))
+            break;
+        uint32_t checksum = recordChecksum(0, &record.file, sizeof(record) - offsetof(WalRecord, file));
+        if (recordChecksum(checksum, data, record.size) != record.checksum)
+            break;
+
+        // A freed segment reads as zero records, like after the hole punch of the server
+        bool written = true;
+        int fd = open(files[record.file], O_WRONLY | O_CREAT, 0644);
+        off_t segment_start = bases[record.file] + (off_t)record.index * ORDER_SEGMENT_SIZE * order_size;
+        if (record.file == WAL_ORDER_SEGMENT &&
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, segment_start, ORDER_SEGMENT_SIZE * order_size) < 0)
+        {
+            static const char zeros[sizeof(OrderV1) * 64];
+            for (int i = 0; i < ORDER_SEGMENT_SIZE / 64 && written; i++)
+                written = pwrite(fd, zeros, order_size * 64, segment_start + (off_t)i * order_size * 64) == (ssize_t)(order_size * 64);
+        }
+        else if (record.file == WAL_ORDER_BILL)
+        {
+            // The order goes to its record and the bill to the reservation; bills only grow
+            OrderBillV2 *billed = (OrderBillV2 *)data;
+            int32_t current_bill = 0;
+            int bills_fd = open(BILLS_FILE, O_RDWR | O_CREAT, 0644);
+            off_t bill_offset = sizeof(FileHeader) + (off_t)billed->reservation * sizeof(int32_t);
+            if (pread(bills_fd, &current_bill, sizeof(current_bill), bill_offset) == sizeof(current_bill) && current_bill > billed->bill)
+                billed->bill = current_bill;
+            written = bills_fd >= 0 && pwrite(bills_fd, &billed->bill, sizeof(billed->bill), bill_offset) == sizeof(billed->bill) && fsync(bills_fd) == 0;
+            written = written && pwrite(fd, &billed->order, sizeof(billed->order), bases[record.file] + (off_t)record.index * sizeof(OrderV2)) == sizeof(OrderV2);
+            if (bills_fd >= 0)
+                close(bills_fd);
+        }
+        else if (record.file != WAL_ORDER_SEGMENT)
+            written = pwrite(fd, data, record.size, bases[record.file] + (off_t)record.index * record.size) == record.size;
+        if (fd < 0 || !written)
+        {
+            fprintf(stdout, "[-] Cannot replay %s into %s\n", WAL_FILE, files[record.file]);
+            fclose(log);
+            return -1;
+        }
+        fsync(fd);
+        close(fd);
+        replayed++;
+    }
+    fclose(log);
+
+    truncate(WAL_FILE, 0);
+    fprintf(stdout, "[+] Replayed %ld records of %s into the old files.\n", replayed, WAL_FILE);
+    return 0;
+}
+
+int migrateReservations()
+{
+    int version = recordFileVersion(RESERVATIONS_FILE, RESERVATIONS_MAGIC);
+    if (version > 0 && version < RECORD_FORMAT_VERSION)
+    {
+        // Reservations did not change after v1, only the version of the header
+        return updateHeaderVersion(RESERVATIONS_FILE, RESERVATIONS_MAGIC, sizeof(Reservation));
+    }
+    if (version != 0)
+    {
+        fprintf(stdout, "[+] %s needs no conversion.\n", RESERVATIONS_FILE);
+        return 0;
+    }
+
+    long count;
+    LegacyReservation *legacy = readLegacyRecords(RESERVATIONS_FILE, sizeof(LegacyReservation), &count);
+    if (legacy == NULL)
+        return -1;
+
+    Reservation *converted = calloc(count > 0 ? count : 1, sizeof(Reservation));
+    int page_offset = findTablesPageOffset(legacy, count);
+    long kept = 0, dropped = 0;
+    for (long i = 0; i < count; i++)
+    {
+        // Dates the server cannot place in its availability grid are dropped
+        int day = parseReservationDay(legacy[i].date);
+        int minute = parseReservationMinute(legacy[i].hour);
+        int table = resolveLegacyTable(&legacy[i], page_offset);
+        if (day < 0 || minute < 0 || table < 0 || legacy[i].nr_people < 1 || legacy[i].nr_people > 255)
+        {
+            fprintf(stdout, "[-] Dropped reservation %d (%.29s %.19s %.19s)\n", legacy[i].code, legacy[i].surname, legacy[i].date, legacy[i].hour);
+            dropped++;
+            continue;
+        }
+
+        Reservation *reservation = &converted[kept++];
+        reservation->code = legacy[i].code;
+        reservation->start = (uint32_t)day * MINUTES_PER_DAY + minute;
+        reservation->nr_people = legacy[i].nr_people;
+        reservation->table = table;
+        memcpy(reservation->surname, legacy[i].surname, strnlen(legacy[i].surname, sizeof(reservation->surname) - 1));
+    }
+
+    int result = writeRecords(RESERVATIONS_FILE, RESERVATIONS_MAGIC, converted, sizeof(Reservation), kept, 0);
+    if (result == 0)
+        fprintf(stdout, "[+] %s: %ld reservations converted, %ld dropped, %ld -> %zu bytes.\n", RESERVATIONS_FILE, kept, dropped,
+                count * (long)sizeof(LegacyReservation), sizeof(FileHeader) + kept * sizeof(Reservation));
+    free(converted);
+    free(legacy);
+    return result;
+}
+
+int migrateOrders()
+{
+    int version = recordFileVersion(ORDERS_FILE, ORDERS_MAGIC);
+    if (version == 1)
+        return migrateOrdersV1();
+    if (version == 2)
+        return migrateOrdersV2();
+    if (version != 0)
+    {
+        fprintf(stdout, "[+] %s needs no conversion.\n", ORDERS_FILE);
+        return 0;
+    }
+
+    long count;
+    LegacyOrder *legacy = readLegacyRecords(ORDERS_FILE, sizeof(LegacyOrder), &count);
+    if (legacy == NULL)
+        return -1;
+
+    // Records keep their position, the order index of the server refers to it
+    Order *converted = calloc(count > 0 ? count : 1, sizeof(Order));
+    for (long i = 0; i < count; i++)
+    {
+        Order *order = &converted[i];
+        legacy[i].table_id[sizeof(legacy[i].table_id) - 1] = '\0';
+        legacy[i].status[sizeof(legacy[i].status) - 1] = '\0';
+        int table = tableNumber(legacy[i].table_id);
+        int status = orderStatusNumber(legacy[i].status);
+        if (table < 0 || status < 0)
+            fprintf(stdout, "[-] Order %ld of reservation %d has table %s and status %s, stored as %s %s\n", i, legacy[i].rsrv_code,
+                    legacy[i].table_id, legacy[i].status, ALL_TABLES[table < 0 ? 0 : table].id, ORDER_STATUS_NAMES[status < 0 ? ORDER_SERVED : status]);
+
+        order->rsrv_code = legacy[i].rsrv_code;
+        order->time = legacy[i].time;
+        order->value = legacy[i].value;
+        order->table = table < 0 ? 0 : table;
+        order->status = status < 0 ? ORDER_SERVED : status;
+        strncpy(order->course, legacy[i].course, sizeof(order->course) - 1);
+        convertOrderDishes(order, legacy[i].order, sizeof(legacy[i].order), i);
+        order->reservation = findOrderReservation(order, i);
+    }
+
+    int result = writeRecords(ORDERS_FILE, ORDERS_MAGIC, converted, sizeof(Order), count, 0);
+    if (result == 0)
+        fprintf(stdout, "[+] %s: %ld orders converted, %ld -> %zu bytes.\n", ORDERS_FILE, count,
+                count * (long)sizeof(LegacyOrder), sizeof(FileHeader) + count * sizeof(Order));
+    free(converted);
+    free(legacy);
+    return result;
+}
+
+int migrateOrdersV1()
+{
+    // The header is read as a record of its own and skipped
+    long count;
+    OrderV1 *records = readLegacyRecords(ORDERS_FILE, 1, &count);
+    if (records == NULL)
+        return -1;
+    count = (count - (long)sizeof(FileHeader)) / (long)sizeof(OrderV1);
+    OrderV1 *v1 = (OrderV1 *)((char *)records + sizeof(FileHeader));
+
+    // Records keep their position, freed ones stay all zeros
+    Order *converted = calloc(count > 0 ? count : 1, sizeof(Order));
+    for (long i = 0; i < count; i++)
+    {
+        if (v1[i].rsrv_code != 0)
+            convertOrderV1(&v1[i], &converted[i], i);
+    }
+
+    int result = writeRecords(ORDERS_FILE, ORDERS_MAGIC, converted, sizeof(Order), count, 1);
+    if (result == 0)
+        fprintf(stdout, "[+] %s: %ld orders converted from format v1.\n", ORDERS_FILE, count);
+    free(converted);
+    free(records);
+    return result;
+}
+
+int migrateOrdersV2()
+{
+    long count;
+    OrderV2 *records = readLegacyRecords(ORDERS_FILE, 1, &count);
+    if (records == NULL)
+        return -1;
+    count = (count - (long)sizeof(FileHeader)) / (long)sizeof(OrderV2);
+    OrderV2 *v2 = (OrderV2 *)((char *)records + sizeof(FileHeader));
+
+    // Records keep their position, freed ones stay all zeros
+    Order *converted = calloc(count > 0 ? count : 1, sizeof(Order));
+    for (long i = 0; i < count; i++)
+    {
+        if (v2[i].rsrv_code != 0)
+            convertOrderV2(&v2[i], &converted[i], i);
+    }
+
+    int result = writeRecords(ORDERS_FILE, ORDERS_MAGIC, converted, sizeof(Order), count, 2);
+    if (result == 0)
+        fprintf(stdout, "[+] %s: %ld orders converted from format v2.\n", ORDERS_FILE, count);
+    free(converted);
+    free(records);
+    return result;
+}
+
+int migrateOrderArchive()
+{
+    int version = recordFileVersion(ORDERS_ARCHIVE_FILE, ORDERS_ARCHIVE_MAGIC);
+    if (version != 1 && version != 2)
+    {
+        fprintf(stdout, "[+] %s needs no conversion.\n", ORDERS_ARCHIVE_FILE);
+        return 0;
+    }
+
+    long size;
+    char *archive = readLegacyRecords(ORDERS_ARCHIVE_FILE, 1, &size);
+    if (archive == NULL)
+        return -1;
+
+    // Blocks keep their segment numbers; a torn block at the end is dropped like the server does
+    size_t record_size = version == 1 ? sizeof(OrderV1) : sizeof(OrderV2);
+    char *converted = malloc(size / record_size * sizeof(Order) + size + 1);
+    size_t offset = sizeof(FileHeader), length = 0;
+    long orders_count = 0;
+    ArchiveBlock block;
+    while (offset + sizeof(block) <= (size_t)size)
+    {
+        memcpy(&block, archive + offset, sizeof(block));
+        if (offset + sizeof(block) + (size_t)block.count * record_size > (size_t)size)
+            break;
+        memcpy(converted + length, &block, sizeof(block));
+        offset += sizeof(block);
+        length += sizeof(block);
+
+        for (uint32_t i = 0; i < block.count; i++, offset += record_size, length += sizeof(Order))
+        {
+            OrderV1 v1;
+            OrderV2 v2;
+            Order order;
+            bzero(&order, sizeof(order));
+            if (version == 1)
+            {
+                memcpy(&v1, archive + offset, sizeof(v1));
+                convertOrderV1(&v1, &order, orders_count++);
+            }
+            else
+            {
+                memcpy(&v2, archive + offset, sizeof(v2));
+                convertOrderV2(&v2, &order, orders_count++);
+            }
+            memcpy(converted + length, &order, sizeof(order));
+        }
+    }
+
+    FileHeader header;
+    recordMakeHeader(&header, ORDERS_ARCHIVE_MAGIC, sizeof(Order));
+    int result = writeDataFile(ORDERS_ARCHIVE_FILE, &header, converted, length, version);
+    if (result == 0)
+        fprintf(stdout, "[+] %s: %ld archived orders converted from format v%d.\n", ORDERS_ARCHIVE_FILE, orders_count, version);
+    free(converted);
+    free(archive);
+    return result;
+}
+
+int migrateBills()
+{
+    // Bills did not change since they came with v2, only the version of the header
+    int version = recordFileVersion(BILLS_FILE, BILLS_MAGIC);
+    if (version > 0 && version < RECORD_FORMAT_VERSION)
+        return updateHeaderVersion(BILLS_FILE, BILLS_MAGIC, sizeof(int32_t));
+    fprintf(stdout, "[+] %s needs no conversion.\n", BILLS_FILE);
+    return 0;
+}
+
+int updateHeaderVersion(const char *path, const char *magic, uint16_t record_size)
+{
+    FileHeader header;
+    recordMakeHeader(&header, magic, record_size);
+    int fd = open(path, O_WRONLY);
+    if (fd < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || fsync(fd) < 0)
+    {
+        fprintf(stdout, "[-] Cannot write %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    fprintf(stdout, "[+] %s: header updated to format v%d.\n", path, RECORD_FORMAT_VERSION);
+    return 0;
+}
+
+void convertOrderV1(const OrderV1 *v1, Order *order, long position)
+{
+    order->rsrv_code = v1->rsrv_code;
+    order->time = v1->time;
+    order->value = v1->value;
+    order->table = v1->table;
+    order->status = v1->status;
+    memcpy(order->course, v1->course, sizeof(order->course));
+    convertOrderDishes(order, v1->order, sizeof(v1->order), position);
+    order->reservation = findOrderReservation(order, position);
+}
+
+void convertOrderV2(const OrderV2 *v2, Order *order, long position)
+{
+    order->rsrv_code = v2->rsrv_code;
+    order->time = v2->time;
+    order->value = v2->value;
+    order->table = v2->table;
+    order->status = v2->status;
+    memcpy(order->course, v2->course, sizeof(order->course));
+    order->item_count = v2->item_count;
+    memcpy(order->items, v2->items, sizeof(order->items));
+    order->reservation = findOrderReservation(order, position);
+}
+
+void convertOrderDishes(Order *order, const char *text, size_t len, long position)
+{
+    // The price was computed when the order came in, so a bill stays right without the dishes
+    if (parseOrderItems(text, len, order) < 0)
+    {
+        fprintf(stdout, "[-] Order %ld of reservation %d has dishes \"%.*s\" that cannot be parsed, stored without dishes\n",
+                position, order->rsrv_code, (int)strnlen(text, len), text);
+        order->item_count = 0;
+    }
+}
+
+int loadReservations()
+{
+    // The header is read as a record of its own and skipped
+    long size = 0;
+    if (recordFileVersion(RESERVATIONS_FILE, RESERVATIONS_MAGIC) < 0)
+        return 0;
+    char *records = readLegacyRecords(RESERVATIONS_FILE, 1, &size);
+    if (records == NULL)
+        return -1;
+    reservations_count = (size - (long)sizeof(FileHeader)) / (long)sizeof(Reservation);
+    reservations = malloc(reservations_count > 0 ? reservations_count * sizeof(Reservation) : 1);
+    memcpy(reservations, records + sizeof(FileHeader), reservations_count * sizeof(Reservation));
+    free(records);
+
+    positions_by_code = malloc(reservations_count > 0 ? reservations_count * sizeof(uint32_t) : 1);
+    for (long i = 0; i < reservations_count; i++)
+        positions_by_code[i] = i;
+    qsort(positions_by_code, reservations_count, sizeof(uint32_t), compareReservationCodes);
+    return 0;
+}
+
+int compareReservationCodes(const void *first, const void *second)
+{
+    int32_t first_code = reservations[*(const uint32_t *)first].code;
+    int32_t second_code = reservations[*(const uint32_t *)second].code;
+    return first_code < second_code ? -1 : first_code > second_code;
+}
+
+uint32_t findOrderReservation(const Order *order, long position)
+{
+    // Older orders only kept the reservation code, which other reservations may share:
+    // a reservation of the order's table wins, then the one starting closest to the order
+    long low = 0, high = reservations_count;
+    while (low < high)
+    {
+        long middle = (low + high) / 2;
+        if (reservations[positions_by_code[middle]].code < order->rsrv_code)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    uint32_t found = NO_RESERVATION;
+    bool found_table = false;
+    int64_t found_distance = 0;
+    for (long i = low; i < reservations_count && reservations[positions_by_code[i]].code == order->rsrv_code; i++)
+    {
+        const Reservation *reservation = &reservations[positions_by_code[i]];
+        bool same_table = reservation->table == order->table;
+        int64_t distance = llabs((int64_t)reservation->start * 60 - (int64_t)order->time);
+        if (found == NO_RESERVATION || (same_table && !found_table) || (same_table == found_table && distance < found_distance))
+        {
+            found = positions_by_code[i];
+            found_table = same_table;
+            found_distance = distance;
+        }
+    }
+    if (found == NO_RESERVATION)
+        fprintf(stdout, "[-] Order %ld of reservation %d matches no reservation, it is billed to none\n", position, order->rsrv_code);
+    return found;
+}
+
+int findTablesPageOffset(const LegacyReservation *reservations, long count)
+{
+    // Every record votes for the page offset ALL_TABLES would have for each table of
+    // its size; records written by the same build agree on one offset
+    int *votes = calloc(LEGACY_PAGE_SIZE, sizeof(int));
+    int best = -1;
+    for (long i = 0; i < count; i++)
+    {
+        for (int table = 0; table < MAX_TABLES; table++)
+        {
+            if (ALL_TABLES[table].nr_seats != roundToEven(reservations[i].nr_people))
+                continue;
+            int offset = (reservations[i].table - table * sizeof(Table)) & (LEGACY_PAGE_SIZE - 1);
+            votes[offset]++;
+            if (best < 0 || votes[offset] > votes[best])
+                best = offset;
+        }
+    }
+    free(votes);
+    return best;
+}
+
+int resolveLegacyTable(const LegacyReservation *reservation, int page_offset)
+{
+    int fallback = -1;
+    for (int table = 0; table < MAX_TABLES; table++)
+    {
+        if (ALL_TABLES[table].nr_seats != roundToEven(reservation->nr_people))
+            continue;
+        if (((reservation->table - table * sizeof(Table)) & (LEGACY_PAGE_SIZE - 1)) == (uint64_t)page_offset)
+            return table;
+        if (fallback < 0)
+            fallback = table;
+    }
+
+    // Written by another build: any table of the right size keeps the booking
+    if (fallback >= 0)
+        fprintf(stdout, "[-] Reservation %d was written by another server build, assigned to %s\n", reservation->code, ALL_TABLES[fallback].id);
+    return fallback;
+}
+
+void *readLegacyRecords(const char *path, size_t record_size, long *count)
+{
+    struct stat file_stat;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL || fstat(fileno(file), &file_stat) < 0)
+    {
+        fprintf(stdout, "[-] Cannot read %s\n", path);
+        if (file != NULL)
+            fclose(file);
+        return NULL;
+    }
+
+    // A partly written record at the end is dropped
+    *count = file_stat.st_size / record_size;
+    void *records = malloc(*count > 0 ? *count * record_size : 1);
+    if (fread(records, record_size, *count, file) != (size_t)*count)
+    {
+        fprintf(stdout, "[-] Cannot read %s\n", path);
+        free(records);
+        records = NULL;
+    }
+    fclose(file);
+    return records;
+}
+
+int writeRecords(const char *path, const char *magic, const void *records, size_t record_size, long count, int from_version)
+{
+    FileHeader header;
+    recordMakeHeader(&header, magic, record_size);
+    return writeDataFile(path, &header, records, record_size * count, from_version);
+}
+
+int writeDataFile(const char *path, const FileHeader *header, const void *body, size_t len, int from_version)
+{
+    char temp_path[64], backup_path[64];
+    snprintf(temp_path, sizeof(temp_path), "%s.new", path);
+    snprintf(backup_path, sizeof(backup_path), "%s.v%d", path, from_version);
+
+    // The new file is complete on disk before it replaces the old one, which is kept
+    static const char zeros[WRITE_CHUNK_SIZE];
+    const char *bytes = body;
+    FILE *file = fopen(temp_path, "wb");
+    bool written = file != NULL && fwrite(header, sizeof(*header), 1, file) == 1;
+    for (size_t offset = 0; written && offset < len; offset += WRITE_CHUNK_SIZE)
+    {
+        size_t chunk = len - offset < WRITE_CHUNK_SIZE ? len - offset : WRITE_CHUNK_SIZE;
+        if (memcmp(bytes + offset, zeros, chunk) == 0)
+            written = fseek(file, chunk, SEEK_CUR) == 0;
+        else
+            written = fwrite(bytes + offset, chunk, 1, file) == 1;
+    }
+    written = file != NULL && fflush(file) == 0 && ftruncate(fileno(file), sizeof(*header) + len) == 0 && fsync(fileno(file)) == 0 && written;
+    if (file != NULL)
+        fclose(file);
+
+    if (!written || link(path, backup_path) < 0 || rename(temp_path, path) < 0)
+    {
+        fprintf(stdout, "[-] Cannot write %s (is %s left from an earlier run?)\n", path, backup_path);
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int roundToEven(int num)
+{
+    if (num % 2 == 0)
+        return num;
+    return num + 1;
+}
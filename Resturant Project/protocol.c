@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+// Legacy command names indexed by message type
+static const char *COMMAND_NAMES[] = {"", "find", "book", "check", "order", "bill", "take", "ready", "show", "esc", "slots", "feed", "", "serve", "batch", "renew", "watch", "grid"};
+#define COMMAND_COUNT (sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]))
+
+static int sendAllBytes(Link *link, const void *data, size_t len);
+static int recvAllBytes(Link *link, void *data, size_t len);
+
+int protocolCommandType(const char *command)
+{
+    // Types without a name are never sent by a device
+    for (size_t type = 1; type < COMMAND_COUNT; type++)
+    {
+        if (COMMAND_NAMES[type][0] != '\0' && strncmp(command, COMMAND_NAMES[type], strlen(COMMAND_NAMES[type])) == 0)
+            return (int)type;
+    }
+    return 0;
+}
+
+const char *protocolCommandName(int type)
+{
+    if (type <= 0 || (size_t)type >= COMMAND_COUNT)
+        return "unknown";
+    return COMMAND_NAMES[type];
+}
+
+int protocolLegacyPayloadSize(int type)
+{
+    switch (type)
+    {
+    case MSG_BOOK:
+        return sizeof(int);
+    case MSG_FIND:
+    case MSG_CHECK:
+    case MSG_ORDER:
+    case MSG_READY:
+    case MSG_SLOTS:
+    case MSG_GRID:
+    case MSG_SERVE:
+        return MAX_BUFFER_SIZE;
+    default:
+        return 0;
+    }
+}
+
+void protocolMakeHello(char *hello, int version)
+{
+    hello[0] = (char)0xFF;
+    hello[1] = 'R';
+    hello[2] = 'S';
+    hello[3] = 'P';
+    hello[4] = (char)version;
+    hello[5] = 0;
+}
+
+int protocolHelloVersion(const char *hello)
+{
+    if ((unsigned char)hello[0] != 0xFF || hello[1] != 'R' || hello[2] != 'S' || hello[3] != 'P')
+        return -1;
+    return (unsigned char)hello[4];
+}
+
+void protocolPutHeader(char *header, uint32_t body_len, uint16_t type, uint32_t request_id)
+{
+    uint32_t len = htonl(body_len);
+    uint16_t net_type = htons(type);
+    uint16_t flags = 0;
+    uint32_t net_id = htonl(request_id);
+    memcpy(header, &len, 4);
+    memcpy(header + 4, &net_type, 2);
+    memcpy(header + 6, &flags, 2);
+    memcpy(header + 8, &net_id, 4);
+}
+
+void protocolGetHeader(const char *header, uint32_t *body_len, uint16_t *type, uint32_t *request_id)
+{
+    uint32_t len, net_id;
+    uint16_t net_type;
+    memcpy(&len, header, 4);
+    memcpy(&net_type, header + 4, 2);
+    memcpy(&net_id, header + 8, 4);
+    *body_len = ntohl(len);
+    *type = ntohs(net_type);
+    *request_id = ntohl(net_id);
+}
+
+void linkInit(Link *link, int sock)
+{
+    memset(link, 0, sizeof(*link));
+    link->sock = sock;
+    link->version = PROTOCOL_LEGACY;
+}
+
+int linkNegotiate(Link *link)
+{
+    char hello[PROTOCOL_HELLO_SIZE];
+    protocolMakeHello(hello, PROTOCOL_VERSION);
+    if (sendAllBytes(link, hello, PROTOCOL_HELLO_SIZE) < 0)
+        return -1;
+
+    // An old server ignores the hello, so stay with the legacy protocol after a timeout
+    struct timeval timeout = {PROTOCOL_HELLO_TIMEOUT_MS / 1000, (PROTOCOL_HELLO_TIMEOUT_MS % 1000) * 1000};
+    struct timeval no_timeout = {0, 0};
+    setsockopt(link->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int result = recvAllBytes(link, hello, PROTOCOL_HELLO_SIZE);
+    setsockopt(link->sock, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout));
+
+    int version = result > 0 ? protocolHelloVersion(hello) : -1;
+    link->version = version > 0 ? version : PROTOCOL_LEGACY;
+    return link->version;
+}
+
+uint32_t linkSendRequest(Link *link, int type, const void *payload, size_t len)
+{
+    // Id 0 reports an error, so it is skipped when the counter wraps
+    uint32_t request_id = ++link->next_id;
+    if (request_id == 0)
+        request_id = link->next_id = 1;
+
+    if (link->version == PROTOCOL_LEGACY)
+    {
+        // Command padded to MAX_COMMAND_SIZE, then the parameters padded to their fixed size
+        char buffer[MAX_COMMAND_SIZE + MAX_BUFFER_SIZE];
+        const char *name = protocolCommandName(type);
+        size_t payload_size = protocolLegacyPayloadSize(type);
+        memset(buffer, 0, sizeof(buffer));
+        memcpy(buffer, name, strnlen(name, MAX_COMMAND_SIZE - 1));
+        if (payload != NULL)
+            memcpy(buffer + MAX_COMMAND_SIZE, payload, len < payload_size ? len : payload_size);
+        return sendAllBytes(link, buffer, MAX_COMMAND_SIZE + payload_size) > 0 ? request_id : 0;
+    }
+
+    char frame[FRAME_HEADER_SIZE + MAX_REQUEST_BODY];
+    if (len > MAX_REQUEST_BODY)
+        return 0;
+    if (type == MSG_BOOK)
+    {
+        // Table choice travels as a big endian u32
+        uint32_t choice = htonl(*(const int *)payload);
+        memcpy(frame + FRAME_HEADER_SIZE, &choice, sizeof(choice));
+        len = sizeof(choice);
+    }
+    else if (len > 0)
+        memcpy(frame + FRAME_HEADER_SIZE, payload, len);
+    protocolPutHeader(frame, len, type, request_id);
+    return sendAllBytes(link, frame, FRAME_HEADER_SIZE + len) > 0 ? request_id : 0;
+}
+
+int linkRecvReply(Link *link)
+{
+    // Legacy replies have no id, but they come in request order
+    if (link->version == PROTOCOL_LEGACY)
+    {
+        link->reply_id = ++link->replies;
+        return 1;
+    }
+
+    char header[FRAME_HEADER_SIZE];
+    uint32_t body_len;
+    int result = recvAllBytes(link, header, FRAME_HEADER_SIZE);
+    if (result <= 0)
+        return result;
+    protocolGetHeader(header, &body_len, &link->reply_type, &link->reply_id);
+    link->replies++;
+
+    if (body_len > link->reply_cap)
+    {
+        char *grown = realloc(link->reply, body_len);
+        if (grown == NULL)
+            return -1;
+        link->reply = grown;
+        link->reply_cap = body_len;
+    }
+    if (body_len > 0 && (result = recvAllBytes(link, link->reply, body_len)) <= 0)
+        return result;
+    link->reply_len = body_len;
+    link->reply_pos = 0;
+    return 1;
+}
+
+int linkRecvInt(Link *link, int *value)
+{
+    if (link->version == PROTOCOL_LEGACY)
+        return recvAllBytes(link, value, sizeof(int));
+
+    uint32_t net_value;
+    if (link->reply_pos + 1 + sizeof(net_value) > link->reply_len || link->reply[link->reply_pos] != FIELD_INT)
+        return -1;
+    memcpy(&net_value, link->reply + link->reply_pos + 1, sizeof(net_value));
+    link->reply_pos += 1 + sizeof(net_value);
+    *value = (int)ntohl(net_value);
+    return 1;
+}
+
+int linkRecvText(Link *link, char *text, size_t size)
+{
+    if (link->version == PROTOCOL_LEGACY)
+    {
+        char buffer[MAX_BUFFER_SIZE + 1];
+        int result = recvAllBytes(link, buffer, MAX_BUFFER_SIZE);
+        buffer[MAX_BUFFER_SIZE] = '\0';
+        snprintf(text, size, "%s", buffer);
+        return result;
+    }
+
+    uint16_t net_len;
+    if (link->reply_pos + 1 + sizeof(net_len) > link->reply_len || link->reply[link->reply_pos] != FIELD_TEXT)
+        return -1;
+    memcpy(&net_len, link->reply + link->reply_pos + 1, sizeof(net_len));
+    size_t len = ntohs(net_len);
+    size_t start = link->reply_pos + 1 + sizeof(net_len);
+    if (start + len > link->reply_len)
+        return -1;
+
+    size_t copy = len < size - 1 ? len : size - 1;
+    memcpy(text, link->reply + start, copy);
+    text[copy] = '\0';
+    link->reply_pos = start + len;
+    return 1;
+}
+
+void linkClose(Link *link)
+{
+    close(link->sock);
+    free(link->reply);
+    link->reply = NULL;
+    link->reply_cap = 0;
+}
+
+static int sendAllBytes(Link *link, const void *data, size_t len)
+{
+    size_t sent = 0;
+    while (sent < len)
+    {
+        ssize_t n = send(link->sock, (const char *)data + sent, len - sent, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += n;
+    }
+    link->bytes_sent += len;
+    return 1;
+}
+
+static int recvAllBytes(Link *link, void *data, size_t len)
+{
+    size_t received = 0;
+    while (received < len)
+    {
+        ssize_t n = recv(link->sock, (char *)data + received, len - received, 0);
+        if (n == 0)
+            return 0;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        received += n;
+    }
+    link->bytes_received += len;
+    return 1;
+}
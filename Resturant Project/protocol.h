@@ -0,0 +1,99 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_BUFFER_SIZE 1024 // Size of a text in the legacy protocol
+#define MAX_COMMAND_SIZE 6   // Size of a command in the legacy protocol
+#define SERVER_PORT 4242
+#define MAX_ORDERS_PER_TABLE 5 // Maximum number of orders allowed
+#define MAX_TAKE_BATCH 16      // Most orders taken or marked ready by one request, also held by one kitchen device
+#define KITCHEN_HEARTBEAT_SECONDS 10 // Time between the heartbeats of a kitchen device holding orders
+
+// A device opens the framed protocol by sending this hello in place of a legacy
+// command: 0xFF 'R' 'S' 'P' <version> 0. It has the size of a legacy command, so an
+// old server reports a wrong command and stays in sync with the stream.
+#define PROTOCOL_HELLO_SIZE MAX_COMMAND_SIZE
+#define PROTOCOL_VERSION 2          // Newest framed protocol version
+#define PROTOCOL_MIN_VERSION 2      // Oldest framed version accepted (v1 frames had no request id)
+#define PROTOCOL_LEGACY 0           // Fixed size commands and MAX_BUFFER_SIZE texts
+#define PROTOCOL_HELLO_TIMEOUT_MS 1000 // Time a device waits for the server to accept the hello
+
+// Frame: u32 body length, u16 message type, u16 flags, u32 request id (all big endian),
+// then the body. A reply carries the id of its request, so a device may send many
+// requests before reading any reply. Replies of one connection come in request order.
+#define FRAME_HEADER_SIZE 12
+#define MAX_REQUEST_BODY MAX_BUFFER_SIZE // Largest request body accepted by the server
+
+// Message types of requests, a reply has the type of its request with MSG_REPLY set
+#define MSG_FIND 1  // body: "surname people date hour"
+#define MSG_BOOK 2  // body: u32 number of the chosen table
+#define MSG_CHECK 3 // body: "surname code"
+#define MSG_ORDER 4 // body: "Course: <course> Order: <order>"
+#define MSG_BILL 5  // no body
+#define MSG_TAKE 6  // body (framed protocol only): "[count [course]]", without one order is taken
+#define MSG_READY 7 // body: "rsrv_code course", or up to MAX_TAKE_BATCH such pairs
+#define MSG_SHOW 8  // no body
+#define MSG_ESC 9   // no body
+#define MSG_SLOTS 10 // body: "people date"
+#define MSG_FEED 11  // no body, subscribes the connection to the kitchen feed (framed protocol only)
+#define MSG_FEED_EVENT 12 // never sent by a device, pushed by the server to subscribers with request id 0
+#define MSG_SERVE 13 // body: up to 4 course codes the kitchen device serves as a station, none for every course
+#define MSG_COOK_BATCH 14 // body (framed protocol only): "room [course]", one cook batch: the first waiting order and
+                          // waiting orders of the same dishes placed around it, at most room orders; replied like MSG_TAKE
+#define MSG_RENEW 15 // no body, heartbeat of a kitchen device holding orders; reply: orders held (-1 when its lease expired) and a text
+#define MSG_WATCH 16 // no body, the checked-in table device follows the status changes of its orders (framed protocol only),
+                     // they are pushed like kitchen events: FEED_CLAIMED, FEED_SERVED or FEED_RETURNED
+#define MSG_GRID 17  // body: "people first_date last_date first_hour last_hour", free tables of every date and slot in the range
+#define MSG_REPLY 0x8000
+
+// Kitchen events, the first field of a MSG_FEED_EVENT; the second is the event number
+// and the third the order as "rsrv_code table course dishes"
+#define FEED_NEW_ORDER 0 // An order was placed
+#define FEED_CLAIMED 1   // A kitchen device took an order
+#define FEED_SERVED 2    // An order was marked ready
+#define FEED_MISSED 3    // Device fell too far behind, the text tells how many events it missed
+#define FEED_RETURNED 4  // The device holding an order missed its heartbeats, the order waits again
+
+// A reply body is a sequence of fields, in the order the legacy protocol sent them
+#define FIELD_INT 1  // u32 value
+#define FIELD_TEXT 2 // u16 length, then the text without terminator
+
+// Struct for the connection of a device to the server
+typedef struct Link
+{
+    int sock;              // Socket connected to the server
+    int version;           // Negotiated protocol version (PROTOCOL_LEGACY if none)
+    char *reply;           // Body of the last received reply
+    size_t reply_len;      // Size of the reply body
+    size_t reply_pos;      // Read position in the reply body
+    size_t reply_cap;      // Allocated size of reply
+    uint32_t reply_id;     // Request id answered by the last received reply, 0 for a pushed event
+    uint16_t reply_type;   // Message type of the last received reply, MSG_REPLY included
+    uint32_t next_id;      // Id given to the next request
+    uint32_t replies;      // Number of replies received
+    size_t bytes_sent;     // Bytes sent to the server
+    size_t bytes_received; // Bytes received from the server
+} Link;
+
+// Methods shared by server and devices
+int protocolCommandType(const char *command);
+const char *protocolCommandName(int type);
+int protocolLegacyPayloadSize(int type);
+void protocolMakeHello(char *hello, int version);
+int protocolHelloVersion(const char *hello);
+void protocolPutHeader(char *header, uint32_t body_len, uint16_t type, uint32_t request_id);
+void protocolGetHeader(const char *header, uint32_t *body_len, uint16_t *type, uint32_t *request_id);
+
+// Methods used by devices
+void linkInit(Link *link, int sock);
+int linkNegotiate(Link *link);
+uint32_t linkSendRequest(Link *link, int type, const void *payload, size_t len);
+int linkRecvReply(Link *link);
+int linkRecvInt(Link *link, int *value);
+int linkRecvText(Link *link, char *text, size_t size);
+void linkClose(Link *link);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "records.h"
+
+// List of all available tables in restaurant, stored records refer to them by index
+Table ALL_TABLES[MAX_TABLES] = {{"T12", "ROOM1", 2, "WINDOW"},
+                                {"T22", "ROOM2", 2, "ENTRANCE"},
+                                {"T14", "ROOM1", 4, "FIREPLACE"},
+                                {"T24", "ROOM2", 4, "ENTRANCE"},
+                                {"T16", "ROOM1", 6, "WINDOW"},
+                                {"T26", "ROOM2", 6, "FIREPLACE"}};
+
+const char *ORDER_STATUS_NAMES[ORDER_STATUSES] = {"waiting", "preparing", "served"};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void buildCrcTable()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        crc_table[i] = crc;
+    }
+}
+
+void recordMakeHeader(FileHeader *header, const char *magic, uint16_t record_size)
+{
+    memcpy(header->magic, magic, sizeof(header->magic));
+    header->version = RECORD_FORMAT_VERSION;
+    header->record_size = record_size;
+}
+
+bool recordHeaderMatches(const FileHeader *header, const char *magic, uint16_t record_size)
+{
+    return memcmp(header->magic, magic, sizeof(header->magic)) == 0 &&
+           header->version == RECORD_FORMAT_VERSION && header->record_size == record_size;
+}
+
+int parseReservationDay(const char *date)
+{
+    // Dates are given as DD-MM-YYYY
+    int day, month, year, length = 0;
+    if (sscanf(date, "%2d-%2d-%4d%n", &day, &month, &year, &length) != 3 || date[length] != '\0')
+        return -1;
+    if (month < 1 || month > 12 || year < 1970)
+        return -1;
+    int days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap_year = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (day < 1 || day > days_in_month[month - 1] + (month == 2 && leap_year))
+        return -1;
+
+    // Days since 01-01-1970 of the proleptic Gregorian calendar
+    int y = month <= 2 ? year - 1 : year;
+    int era = y / 400;
+    int year_of_era = y - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+int parseReservationMinute(const char *time)
+{
+    // Hours are given as HH or HH:MM
+    int hour, minute = 0, length = 0;
+    if (sscanf(time, "%2d%n:%2d%n", &hour, &length, &minute, &length) < 1)
+        return -1;
+    if (time[length] != '\0' || hour < 0 || hour > 23 || minute < 0 || minute > 59)
+        return -1;
+    return hour * 60 + minute;
+}
+
+void formatReservationStart(uint32_t start, char date[11], char hour[6])
+{
+    // Inverse of parseReservationDay, from days since 01-01-1970 to the civil date
+    int days = start / MINUTES_PER_DAY + 719468;
+    int era = days / 146097;
+    int day_of_era = days - era * 146097;
+    int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int month_index = (5 * day_of_year + 2) / 153;
+    int day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    int month = month_index < 10 ? month_index + 3 : month_index - 9;
+    int year = year_of_era + era * 400 + (month <= 2);
+
+    snprintf(date, 11, "%02u-%02u-%04u", (unsigned)day % 32, (unsigned)month % 13, (unsigned)year % 10000);
+    snprintf(hour, 6, "%02u:%02u", start % MINUTES_PER_DAY / 60, start % 60);
+}
+
+int tableNumber(const char *table_id)
+{
+    for (int i = 0; i < MAX_TABLES; i++)
+    {
+        if (strcmp(ALL_TABLES[i].id, table_id) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int orderStatusNumber(const char *name)
+{
+    for (int i = 0; i < ORDER_STATUSES; i++)
+    {
+        if (strcmp(ORDER_STATUS_NAMES[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int parseOrderItems(const char *text, size_t len, Order *order)
+{
+    // Dishes are given as CODE-QUANTITY separated by spaces, e.g. "A1-2 D2-1"; the text
+    // is read once, byte by byte, and a dish given twice adds up
+    size_t i = 0;
+    order->item_count = 0;
+    while (i < len && text[i] != '\0' && text[i] != '\n')
+    {
+        if (text[i] == ' ')
+        {
+            i++;
+            continue;
+        }
+
+        char dish[DISH_CODE_SIZE];
+        int code_length = 0, quantity = 0;
+        for (; i < len && text[i] != '\0' && text[i] != '\n' && text[i] != ' ' && text[i] != '-'; i++)
+        {
+            if (code_length == DISH_CODE_SIZE)
+                return -1;
+            dish[code_length++] = text[i];
+        }
+        if (code_length != DISH_CODE_SIZE || i == len || text[i] != '-')
+            return -1;
+        for (i++; i < len && text[i] >= '0' && text[i] <= '9'; i++)
+        {
+            quantity = quantity * 10 + text[i] - '0';
+            if (quantity > MAX_DISH_QUANTITY)
+                return -1;
+        }
+        if (quantity == 0 || (i < len && text[i] != '\0' && text[i] != '\n' && text[i] != ' '))
+            return -1;
+
+        int item = 0;
+        while (item < order->item_count && memcmp(order->items[item].dish, dish, DISH_CODE_SIZE) != 0)
+            item++;
+        if (item == MAX_ORDER_ITEMS || (item < order->item_count && order->items[item].quantity + quantity > MAX_DISH_QUANTITY))
+            return -1;
+        if (item == order->item_count)
+        {
+            memcpy(order->items[item].dish, dish, DISH_CODE_SIZE);
+            order->items[item].quantity = 0;
+            order->item_count++;
+        }
+        order->items[item].quantity += quantity;
+    }
+    return order->item_count;
+}
+
+void formatOrderItems(const Order *order, char text[ORDER_TEXT_SIZE])
+{
+    int length = 0;
+    text[0] = '\0';
+    for (int i = 0; i < order->item_count && i < MAX_ORDER_ITEMS; i++)
+        length += snprintf(text + length, ORDER_TEXT_SIZE - length, "%s%.*s-%u", i > 0 ? " " : "", DISH_CODE_SIZE,
+                           order->items[i].dish, order->items[i].quantity);
+}
+
+uint32_t recordChecksum(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    pthread_once(&crc_table_once, buildCrcTable);
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
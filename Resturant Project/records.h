@@ -0,0 +1,140 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RESERVATIONS_FILE "reservations.bin" // File used to store reservation data
+#define ORDERS_FILE "orders.bin"             // File used to store order data
+#define WAL_FILE "restaurant.wal"            // Write-ahead log of reservations and orders
+#define ORDERS_ARCHIVE_FILE "orders.archive" // Served orders moved out of ORDERS_FILE by compaction
+#define BILLS_FILE "bills.bin"               // Running bill of every reservation, in the order of RESERVATIONS_FILE
+
+// Every data file starts with a FileHeader, followed by packed records of one size.
+// Files without the header are raw struct dumps of the first server; they and files
+// of an older version have to be converted with ./migrate before the server accepts them.
+#define RESERVATIONS_MAGIC "RSVN"
+#define ORDERS_MAGIC "ORDR"
+#define ORDERS_ARCHIVE_MAGIC "ORDA"
+#define BILLS_MAGIC "BILL"
+#define RECORD_FORMAT_VERSION 3 // Version 1 stored the dishes of an order as text, version 2 no reservation position in an order
+
+#define MAX_TABLES 6          // Maximum number of tables in the restaurant
+#define MAX_SURNAME_LENGTH 20 // Size of a stored surname, terminator included
+#define MAX_COURSE_LENGTH 5   // Size of a stored course code, terminator included
+#define MAX_ORDER_ITEMS 8     // Maximum number of different dishes in an order, as many as the menu has
+#define DISH_CODE_SIZE 2      // Characters of a dish code, e.g. A1
+#define MAX_DISH_QUANTITY 255 // Maximum number of portions of one dish in an order
+#define ORDER_TEXT_SIZE (MAX_ORDER_ITEMS * (DISH_CODE_SIZE + 5) + 1) // Size of the longest order as text ("A1-255 ..."), terminator included
+
+#define MINUTES_PER_DAY (24 * 60)
+
+// ORDERS_FILE is split into segments of ORDER_SEGMENT_SIZE records. New orders go to
+// the active segment; sealed segments are compacted into ORDERS_ARCHIVE_FILE and their
+// blocks freed, so a free record reads as all zeros (reservation codes are never 0).
+#define ORDER_SEGMENT_SIZE 4096           // Records in a segment (48 pages of records)
+#define ARCHIVE_REBASE 0xFFFFFFFFu        // ArchiveBlock segment marking a renumbering of the segments
+
+#define ORDER_WAITING 0   // Order waits for a kitchen device
+#define ORDER_PREPARING 1 // Order was taken by a kitchen device
+#define ORDER_SERVED 2    // Order was brought to the table
+#define ORDER_STATUSES 3  // Number of order statuses
+
+#define WAL_RECORD_MAGIC 0x314c4157u // "WAL1", start of every log record
+#define WAL_RESERVATIONS 1           // Log record holds a Reservation of RESERVATIONS_FILE
+#define WAL_ORDERS 2                 // Log record holds an Order of ORDERS_FILE
+#define WAL_ORDER_SEGMENT 3          // Log record without data, frees the segment of ORDERS_FILE given as index
+#define WAL_ORDER_BILL 4             // Log record holds an OrderBill: a new Order of ORDERS_FILE and its bill in BILLS_FILE
+#define WAL_ORDER_RETURN 5           // Log record holds an Order of ORDERS_FILE put back to waiting, the one status change that goes back
+
+// Struct for detailed table information
+typedef struct Table
+{
+    char id[5];          // Unique identifier for each table
+    char room[6];        // Room in which the table is placed
+    int nr_seats;        // Maximum number of people that can be seated at this table
+    char place_desc[30]; // Short description of where the table is placed
+} Table;
+
+// Struct for the first bytes of every data file
+typedef struct __attribute__((packed)) FileHeader
+{
+    char magic[4];        // RESERVATIONS_MAGIC or ORDERS_MAGIC
+    uint16_t version;     // RECORD_FORMAT_VERSION
+    uint16_t record_size; // Size of every record that follows
+} FileHeader;
+
+// Struct for reservation information
+typedef struct __attribute__((packed)) Reservation
+{
+    int32_t code;                       // Unique reservation code
+    uint32_t start;                     // Minutes since 01-01-1970 00:00 of the reserved date and hour
+    uint8_t nr_people;                  // Number of people to be seated
+    uint8_t table;                      // Index of the reserved table in ALL_TABLES
+    char surname[MAX_SURNAME_LENGTH];   // Surname of the person who made the reservation
+} Reservation;
+
+// Struct for one dish of an order
+typedef struct __attribute__((packed)) OrderItem
+{
+    char dish[DISH_CODE_SIZE]; // Code of the dish in the menu, not terminated
+    uint8_t quantity;          // Number of portions, 1 to MAX_DISH_QUANTITY
+} OrderItem;
+
+// Struct for order handling
+typedef struct __attribute__((packed)) Order
+{
+    int32_t rsrv_code;                // Reservation code associated with the order
+    uint32_t reservation;             // Position in RESERVATIONS_FILE of the reservation, also its entry in BILLS_FILE
+    uint32_t time;                    // Seconds since 01-01-1970 when the order was placed
+    int32_t value;                    // Price of the ordered items
+    uint8_t table;                    // Index in ALL_TABLES of the table the order is placed from
+    uint8_t status;                   // Current status of the order (ORDER_*)
+    char course[MAX_COURSE_LENGTH];   // Course code for the ordered item
+    uint8_t item_count;               // Number of dishes in items
+    OrderItem items[MAX_ORDER_ITEMS]; // Ordered dishes, every code at most once
+} Order;
+
+// Struct for the start of every compacted segment in ORDERS_ARCHIVE_FILE, followed by count served orders
+typedef struct __attribute__((packed)) ArchiveBlock
+{
+    uint32_t segment; // Segment of ORDERS_FILE the orders come from, or ARCHIVE_REBASE
+    uint32_t count;   // Number of orders that follow
+} ArchiveBlock;
+
+// Struct for the data of a WAL_ORDER_BILL record, so an order and its bill are logged as one
+typedef struct __attribute__((packed)) OrderBill
+{
+    Order order;  // New order, placed at the index of the log record
+    int32_t bill; // Bill of the reservation, this order included
+} OrderBill;
+
+// Struct for the header of a record in WAL_FILE, followed by size bytes of data
+typedef struct WalRecord
+{
+    uint32_t magic;    // WAL_RECORD_MAGIC
+    uint32_t checksum; // CRC-32 of the fields below and the data
+    uint16_t file;     // Data file the record belongs to (WAL_RESERVATIONS, WAL_ORDERS, WAL_ORDER_SEGMENT, WAL_ORDER_BILL or WAL_ORDER_RETURN)
+    uint16_t size;     // Size of the data, equal to the record size of the data file (0 for WAL_ORDER_SEGMENT)
+    uint32_t index;    // Position of the record in its data file
+} WalRecord;
+
+extern Table ALL_TABLES[MAX_TABLES];
+extern const char *ORDER_STATUS_NAMES[ORDER_STATUSES];
+
+// Methods handling file headers
+void recordMakeHeader(FileHeader *header, const char *magic, uint16_t record_size);
+bool recordHeaderMatches(const FileHeader *header, const char *magic, uint16_t record_size);
+
+// Methods handling record fields
+int parseReservationDay(const char *date);
+int parseReservationMinute(const char *time);
+void formatReservationStart(uint32_t start, char date[11], char hour[6]);
+int tableNumber(const char *table_id);
+int orderStatusNumber(const char *name);
+int parseOrderItems(const char *text, size_t len, Order *order);
+void formatOrderItems(const Order *order, char text[ORDER_TEXT_SIZE]);
+uint32_t recordChecksum(uint32_t crc, const void *data, size_t len);
+
+#endif
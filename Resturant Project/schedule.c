@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include "schedule.h"
+
+const char *SCHEDULE_NAMES[SCHEDULE_POLICIES] = {"fifo", "sjf", "pacing"};
+
+static int findPrepDish(const PrepTimes *times, const char *dish);
+
+int schedulePolicyNumber(const char *name)
+{
+    for (int i = 0; i < SCHEDULE_POLICIES; i++)
+    {
+        if (strcmp(SCHEDULE_NAMES[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool loadPrepTimes(const char *path, PrepTimes *times)
+{
+    memset(times, 0, sizeof(*times));
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    // The file is a table like the menu, "| A1 | 240 |" per dish; other lines are borders
+    char line[100];
+    while (fgets(line, sizeof(line), file) != NULL && times->count < MAX_PREP_DISHES)
+    {
+        char dish[DISH_CODE_SIZE + 1];
+        unsigned seconds;
+        if (line[0] != '|' || sscanf(line, "| %2s | %u", dish, &seconds) != 2 || strlen(dish) != DISH_CODE_SIZE || seconds == 0)
+            continue;
+        int index = findPrepDish(times, dish);
+        if (index < 0)
+        {
+            index = times->count++;
+            memcpy(times->dishes[index], dish, DISH_CODE_SIZE);
+        }
+        times->seconds[index] = seconds < PREP_MAX_SECONDS ? seconds : PREP_MAX_SECONDS;
+    }
+    fclose(file);
+    return times->count > 0;
+}
+
+uint32_t estimatePrepTime(const PrepTimes *times, const Order *order)
+{
+    // The dishes of an order are cooked side by side, so the slowest one decides
+    uint32_t longest = 0;
+    for (int i = 0; i < order->item_count && i < MAX_ORDER_ITEMS; i++)
+    {
+        int index = findPrepDish(times, order->items[i].dish);
+        uint32_t seconds = index < 0 ? PREP_DEFAULT_SECONDS : times->seconds[index];
+        if (seconds > longest)
+            longest = seconds;
+    }
+    return longest > 0 ? longest : PREP_DEFAULT_SECONDS;
+}
+
+void learnPrepTime(PrepTimes *times, const Order *order, uint32_t seconds)
+{
+    // The duration of an order is that of its slowest dish, so only that dish learns from it
+    int slowest = -1;
+    uint32_t longest = 0;
+    for (int i = 0; i < order->item_count && i < MAX_ORDER_ITEMS; i++)
+    {
+        int index = findPrepDish(times, order->items[i].dish);
+        uint32_t estimate = index < 0 ? PREP_DEFAULT_SECONDS : times->seconds[index];
+        if (slowest < 0 || estimate > longest)
+        {
+            slowest = i;
+            longest = estimate;
+        }
+    }
+    if (slowest < 0)
+        return;
+
+    int index = findPrepDish(times, order->items[slowest].dish);
+    if (index < 0)
+    {
+        if (times->count == MAX_PREP_DISHES)
+            return;
+        index = times->count++;
+        memcpy(times->dishes[index], order->items[slowest].dish, DISH_CODE_SIZE);
+        times->seconds[index] = PREP_DEFAULT_SECONDS;
+    }
+
+    // A moving average follows a kitchen that gets faster or slower during service
+    if (seconds > PREP_MAX_SECONDS)
+        seconds = PREP_MAX_SECONDS;
+    int64_t estimate = times->seconds[index];
+    estimate += ((int64_t)seconds - estimate) / PREP_LEARN_WEIGHT;
+    times->seconds[index] = estimate > 0 ? estimate : 1;
+    times->samples[index]++;
+}
+
+uint32_t scheduleKey(int policy, uint32_t placed, uint32_t prep, uint32_t *paced_until)
+{
+    // Waiting orders are taken in the order of their keys
+    if (policy == SCHEDULE_SJF)
+    {
+        // Shortest prep time first, aged by one second per second of waiting: an order is
+        // passed only by orders placed less than its extra prep time after it, so none starves
+        return placed + prep;
+    }
+    if (policy == SCHEDULE_PACING && paced_until != NULL)
+    {
+        // A course of a reservation starts when its previous course should be done, so
+        // other tables' first courses go in between instead of waiting for a whole order
+        uint32_t start = placed > *paced_until ? placed : *paced_until;
+        *paced_until = start + prep;
+        return start;
+    }
+    return placed;
+}
+
+static int findPrepDish(const PrepTimes *times, const char *dish)
+{
+    for (int i = 0; i < times->count; i++)
+    {
+        if (memcmp(times->dishes[i], dish, DISH_CODE_SIZE) == 0)
+            return i;
+    }
+    return -1;
+}
@@ -0,0 +1,37 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "records.h"
+
+#define PREP_TIMES_FILE "preptime.txt" // Prep time of every dish, next to the menu
+#define MAX_PREP_DISHES 32             // Dishes with a prep time of their own
+#define PREP_DEFAULT_SECONDS 600       // Prep time of a dish missing from PREP_TIMES_FILE
+#define PREP_MAX_SECONDS 7200          // Longest take to ready duration learned from, longer ones are capped
+#define PREP_LEARN_WEIGHT 8            // A measured duration moves the estimate by 1/PREP_LEARN_WEIGHT of the difference
+
+// Policies deciding which waiting order a kitchen device takes first
+#define SCHEDULE_FIFO 0     // The order placed first
+#define SCHEDULE_SJF 1      // The order finishing first, aged by the time it was placed
+#define SCHEDULE_PACING 2   // The courses of a reservation one after another, spaced by their prep time
+#define SCHEDULE_POLICIES 3 // Number of policies
+
+// Struct for the prep time estimates of the kitchen
+typedef struct PrepTimes
+{
+    int count;                                    // Number of dishes with an estimate
+    char dishes[MAX_PREP_DISHES][DISH_CODE_SIZE]; // Dish codes, not terminated
+    uint32_t seconds[MAX_PREP_DISHES];            // Estimated prep time of every dish
+    uint32_t samples[MAX_PREP_DISHES];            // Measured durations the estimate learned from
+} PrepTimes;
+
+extern const char *SCHEDULE_NAMES[SCHEDULE_POLICIES];
+
+int schedulePolicyNumber(const char *name);
+bool loadPrepTimes(const char *path, PrepTimes *times);
+uint32_t estimatePrepTime(const PrepTimes *times, const Order *order);
+void learnPrepTime(PrepTimes *times, const Order *order, uint32_t seconds);
+uint32_t scheduleKey(int policy, uint32_t placed, uint32_t prep, uint32_t *paced_until);
+
+#endif
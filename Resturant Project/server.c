@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -10,24 +11,102 @@
 #include <netinet/in.h>
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+#include <sys/inotify.h>
+#include <linux/futex.h>
+#include <limits.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef __NR_io_uring_setup
+#define HAVE_IO_URING
+#endif
+#endif
+#include "protocol.h"
+#include "records.h"
+#include "schedule.h"
 
-#define RESERVATIONS_FILE "reservations.bin" // File used to store reservation data
-#define ORDERS_FILE "orders.bin"             // File used to store order data
 #define MENU_FILE "menu.txt"                 // File used to store menu data
-#define STATUS_WAITING "waiting"
-#define STATUS_PREPARING "preparing"
-#define STATUS_SERVED "served"
-#define MAX_COMMAND_SIZE 6         // Maximum size of a command
-#define MAX_SERVER_COMMAND_SIZE 20 // Maximum size of a command for server
-#define MAX_BUFFER_SIZE 1024       // Maximum size of a buffer
-#define MAX_ORDER_SIZE 30          // Maximum size of an order
+#define MAX_SERVER_COMMAND_SIZE 32 // Maximum size of a command for server
 #define MAX_RESERVATIONS 30        // Maximum number of reservations allowed
-#define MAX_ORDERS_PER_TABLE 5     // Maximum number of orders allowed
-#define MAX_TABLES 6               // Maximum number of tables in the restaurant
 #define MAX_KITCHEN_DEVICES 10     // Maximum number of kitchen devices
 #define MAX_MENU_ITEMS 8           // Maximum number of menu items
 #define MAX_CODE_LENGTH 3          // Maximum length of a dish code
 #define MAX_NAME_LENGTH 30         // Maximum length of a dish name
+#define MENU_HASH_SIZE 32          // Slots of the perfect hash of dish codes (power of two, 4 per menu item)
+#define MENU_MAX_SEEDS 65536       // Seeds tried before a menu is rejected as not hashable
+#define MENU_VERSIONS 2            // Menus in the cache: the one orders are priced with and the next one
+#define MENU_WATCH_INTERVAL_MS 200 // Longest wait of the menu watch thread before it looks at menu_watch_stopping
+#define MAX_EPOLL_EVENTS 256       // Maximum number of events handled per epoll_wait call
+#define IN_BUFFER_SIZE (4 * MAX_BUFFER_SIZE) // Size of the per-connection receive buffer
+#define RESERVATION_INDEX_CAPACITY (1 << 22) // Reservations kept in memory (pages are only used once written)
+#define RESERVATION_INDEX_BUCKETS (1 << 22)  // Buckets of each reservation hash index (power of two)
+#define SLOT_MINUTES 30                      // Length of a reservation slot
+#define SLOTS_PER_DAY (24 * 60 / SLOT_MINUTES) // Number of reservation slots in a day
+#define AVAILABILITY_DAYS (1 << 18)          // Dates kept in the availability grid (power of two)
+#define MAX_TABLE_SEATS 6                    // Seats of the largest table
+#define GRID_MAX_DAYS 31                     // Dates one availability grid query may span
+#define FNV_OFFSET 2166136261u               // FNV-1a hash start value
+#define FNV_PRIME 16777619u                  // FNV-1a hash multiplier
+#define ORDER_STORE_CAPACITY (1 << 22)       // Orders the mapping of ORDERS_FILE can hold (address space only)
+#define ORDER_INDEX_SPARE_SEGMENTS 64        // Segments of new orders the index has room for past the orders loaded at startup
+#define ORDER_INDEX_BUCKETS (1 << 20)        // Buckets of the (reservation code, course) order index (power of two)
+#define ORDER_DEFAULT_ROTATE_SECONDS 3600    // Age after which the active order segment is sealed
+#define ORDER_COMPACTION_INTERVAL_US 200000  // Pause of the compaction thread between looks for sealed segments
+#define ORDER_COMPACTION_BATCH 256           // Records of a sealed segment handled per hold of orders_lock
+#define WAL_BUFFER_SIZE (1 << 20)            // Log bytes waiting for the next group commit
+#define WAL_CHECKPOINT_SIZE (16 << 20)       // Log size after which the data files are synced and the log emptied
+#define WAL_DEFAULT_WINDOW_US 2000           // Longest time a group commit waits for more records
+#define MAX_WAL_LISTENERS 64                 // Event loops woken after every group commit
+#define KITCHEN_STATIONS 8                   // Stations kitchen devices can register as
+#define KITCHEN_QUEUES (KITCHEN_STATIONS + 1) // Waiting queue of every station, queue 0 holds courses no station serves
+#define STATION_COURSES 4                    // Courses one station serves
+#define PACING_BUCKETS (1 << 16)             // Reservations whose courses are paced, open addressing (power of two)
+#define PACING_PROBES 8                      // Buckets looked at for a reservation before its courses go unpaced
+#define COURSE_HEAP_BUCKETS (1 << 12)        // Buckets of the waiting heaps of the courses by course code (power of two)
+#define DISH_BATCH_BUCKETS (1 << 12)         // Buckets of the waiting orders by their set of dishes (power of two)
+#define DISH_BATCH_DEFAULT_WINDOW 60         // Seconds apart orders of the same dishes may be placed to be cooked as one batch
+#define DISH_BATCH_MAX_SCAN 256              // Waiting orders inside the batch window looked at for one cook batch
+#define MAX_KITCHEN_LEASES 1024              // Kitchen devices holding taken orders at the same time
+#define LEASE_WHEEL_SIZE 256                 // Seconds of the lease timer wheel (power of two), longer than any lease
+#define LEASE_DEFAULT_SECONDS 60             // Time a kitchen device holds its taken orders without a heartbeat
+#define LEASE_TICK_US 250000                 // Pause of the lease timer thread between looks at the wheel
+#define KITCHEN_FEED_SIZE 4096               // Recent kitchen events kept for subscribed devices (power of two)
+#define KITCHEN_FEED_MAX_QUEUED (64 << 10)   // Reply bytes queued to a subscriber before its events wait in the feed
+#define TABLE_WATCH_BUCKETS (1 << 12)        // Buckets of the reservations whose table devices follow their orders (power of two)
+#define TABLE_WATCH_MAX_EVENTS 64            // Status changes of a reservation pushed at once, older unsent ones are dropped
+
+#define SERVER_MODE_FORK 0    // One child process per accepted connection
+#define SERVER_MODE_EPOLL 1   // All connections served by one epoll event loop
+#define SERVER_MODE_THREADS 2 // One event loop per worker thread, each with its own SO_REUSEPORT listener
+
+#define SERVER_IO_EPOLL 0 // Event loops wait for readiness with epoll and call recv/send
+#define SERVER_IO_URING 1 // Event loops submit accept/recv/send to io_uring
+
+#define URING_ENTRIES 4096         // Size of the io_uring submission queue
+#define URING_MAX_CONNECTIONS 1024 // Connections (and registered receive buffers) per io_uring loop
+#define URING_OP_ACCEPT 1          // Completion of the pending accept
+#define URING_OP_RECV 2            // Completion of a receive on a connection
+#define URING_OP_SEND 3            // Completion of a send on a connection
+#define URING_OP_STOP 4            // Server is stopping
+#define URING_OP_COMMIT 5          // Group commit made more replies sendable
+#define URING_OP_MASK 7            // Low bits of user_data holding URING_OP_*
+
+#define CONNECTION_AWAIT_COMMAND 0 // Connection waits for a MAX_COMMAND_SIZE command (or the protocol hello)
+#define CONNECTION_AWAIT_PAYLOAD 1 // Connection waits for the payload of the received command
+#define CONNECTION_AWAIT_FRAME 2   // Connection negotiated the framed protocol and waits for a frame
 
 // Struct for making a reservation request
 typedef struct FindRequest
@@ -36,46 +115,15 @@ typedef struct FindRequest
     int people;       // Number of people to be seated
     char date[20];    // Date of the reservation
     char hour[20];    // Time of the reservation
+    int64_t start;    // Minutes since 01-01-1970 of date and hour, -1 when they do not parse
 } FindRequest;
 
-// Struct for detailed table information
-typedef struct Table
-{
-    char id[5];          // Unique identifier for each table
-    char room[6];        // Room in which the table is placed
-    int nr_seats;        // Maximum number of people that can be seated at this table
-    char place_desc[30]; // Short description of where the table is placed
-} Table;
-
 // Struct for creating a list of matching tables
 typedef struct MatchingTable
 {
     Table *table; // Pointer to a table that matches a search criterion
 } MatchingTable;
 
-// Struct for reservation information
-typedef struct Reservation
-{
-    int code;         // Unique reservation code
-    char surname[30]; // Surname of the person who made the reservation
-    int nr_people;    // Number of people to be seated
-    char date[20];    // Date of the reservation
-    char hour[20];    // Time of the reservation
-    Table *table;     // Pointer to the reserved table
-} Reservation;
-
-// Struct for order handling
-typedef struct Order
-{
-    int rsrv_code;    // Reservation code associated with the order
-    char table_id[5]; // Identifier of the table the order is placed from
-    char course[5];   // Course code for the ordered item
-    char order[30];   // Description of the ordered item
-    char status[20];  // Current status of the order
-    int value;        // Price of the ordered item
-    time_t time;      // Time when the order was placed
-} Order;
-
 typedef struct
 {
     char code[MAX_CODE_LENGTH + 1]; // Code representing a menu item
@@ -83,24 +131,404 @@ typedef struct
     int price;                      // Price of the menu item
 } MenuItem;
 
+// Struct for a parsed menu with a perfect hash of its dish codes
+typedef struct Menu
+{
+    uint32_t seed;                  // Seed of hashDishCode that gives every dish a slot of its own
+    int count;                      // Number of dishes in items
+    MenuItem items[MAX_MENU_ITEMS]; // Dishes in the order of MENU_FILE
+    int8_t slots[MENU_HASH_SIZE];   // Index + 1 in items of the dish hashed to every slot, 0 when it is empty
+} Menu;
+
+// Struct for the menus shared by every process, swapped as a whole when MENU_FILE changes
+typedef struct MenuCache
+{
+    uint32_t current;                // Version orders are priced with
+    uint32_t readers[MENU_VERSIONS]; // Devices pricing an order with every version
+    Menu versions[MENU_VERSIONS];    // Menus, only the one that is not current is ever written
+} MenuCache;
+
 struct ThreadArgs
 {
     int port;
     int server_sock;
+    int mode;
+    int workers;
 };
 
-// List of all available tables in restaurant
-Table ALL_TABLES[MAX_TABLES] = {{"T12", "ROOM1", 2, "WINDOW"},
-                                {"T22", "ROOM2", 2, "ENTRANCE"},
-                                {"T14", "ROOM1", 4, "FIREPLACE"},
-                                {"T24", "ROOM2", 4, "ENTRANCE"},
-                                {"T16", "ROOM1", 6, "WINDOW"},
-                                {"T26", "ROOM2", 6, "FIREPLACE"}};
+// Struct for one acceptor shard of the threads mode
+typedef struct WorkerArgs
+{
+    pthread_t thread; // Thread running the shard
+    int id;           // Number of the shard, also the core it is pinned to
+    int port;         // Port the shard listens on
+} WorkerArgs;
+
+// Struct for options given to the server on the command line
+typedef struct ServerOptions
+{
+    int port;    // Port the server listens on
+    int mode;    // Connection handling model (SERVER_MODE_*)
+    int workers; // Number of worker threads in threads mode
+    int io;      // Transport backend of the event loops (SERVER_IO_*)
+    int commit_window_us; // Longest time a group commit waits for more records
+    int rotate_seconds;   // Age after which the active order segment is sealed, 0 seals it only when full
+    int schedule;         // Policy of the kitchen queue (SCHEDULE_*)
+    int batch_window;     // Seconds apart orders of the same dishes may be placed to be cooked as one batch
+    int lease_seconds;    // Time a kitchen device holds its taken orders without a heartbeat
+} ServerOptions;
+
+// Struct for state shared by every process and thread serving devices
+typedef struct SharedState
+{
+    pthread_rwlock_t reservations_lock; // Guards RESERVATIONS_FILE and the reservation index
+    pthread_rwlock_t orders_lock;       // Taken shared by order, take and ready; exclusively to seal, compact or checkpoint
+    pthread_mutex_t kitchen_lock;       // Guards the heap of waiting orders, taken while orders_lock is held
+} SharedState;
+
+// Struct for one change of an order pushed to subscribed kitchen devices
+typedef struct KitchenEvent
+{
+    uint64_t lsn;        // Log position the change is durable at, it is pushed only then
+    int event;           // FEED_NEW_ORDER, FEED_CLAIMED, FEED_SERVED or FEED_RETURNED
+    Order order;         // Order after the change
+    uint32_t table_prev; // Previous status change of a reservation in the same bucket, 0 ends the chain
+} KitchenEvent;
+
+// Struct for the ring of recent kitchen events shared by every process
+typedef struct KitchenFeed
+{
+    pthread_mutex_t lock;                   // Guards events and the moves of published
+    uint32_t published;                     // Number of the last event, forked subscribers sleep on it with a futex
+    uint32_t sleepers;                      // Forked subscribers sleeping on published
+    KitchenEvent events[KITCHEN_FEED_SIZE]; // Event number n is kept at n % KITCHEN_FEED_SIZE
+    uint32_t table_last[TABLE_WATCH_BUCKETS]; // Last status change of the reservations of every bucket, forked table devices sleep on it
+    uint32_t table_sleepers;                // Forked table devices sleeping on table_last
+} KitchenFeed;
+
+// Struct for a group of kitchen devices that serve some courses, e.g. the dessert station
+typedef struct KitchenStation
+{
+    uint32_t devices;                                 // Kitchen devices registered as the station, 0 when it is free
+    uint64_t stolen;                                  // Orders of the station's queue taken by other stations
+    char courses[STATION_COURSES][MAX_COURSE_LENGTH]; // Courses routed to the station's queue, unused ones empty
+} KitchenStation;
+
+// Struct for the time the next course of a reservation may start under SCHEDULE_PACING
+typedef struct PacedReservation
+{
+    int32_t rsrv_code; // Reservation code, 0 when the bucket was never used
+    uint32_t until;    // Time the last scheduled course of the reservation should be done
+} PacedReservation;
+
+// Struct for the scheduling policy of the kitchen queue, guarded by kitchen_lock
+typedef struct KitchenSchedule
+{
+    int policy;                               // SCHEDULE_* deciding the keys of waiting orders
+    PrepTimes prep;                           // Prep time of every dish, from PREP_TIMES_FILE and learned from take to ready
+    PacedReservation paced[PACING_BUCKETS];   // Pacing of the reservations with courses in the kitchen
+    uint32_t batch_window;                    // Seconds apart orders of a cook batch may be placed, 0 cooks every order alone
+} KitchenSchedule;
+
+// Struct for the claim of a kitchen device on the orders it took, kept alive by its heartbeats
+typedef struct KitchenLease
+{
+    uint32_t generation;  // Changes every time the lease is freed, so a session notices its lease expired
+    uint32_t expires;     // Time the orders go back to the waiting queue without a renewal, 0 when the lease is free
+    uint32_t next_due;    // Next lease + 1 due in the same second of the wheel, 0 ends the list
+    uint32_t prev_due;    // Previous lease + 1 due in the same second of the wheel, 0 starts the list
+    uint32_t first_order; // First record + 1 held under the lease, 0 when it holds none
+    uint32_t orders;      // Number of records held under the lease
+} KitchenLease;
+
+// Struct for the (reservation code, course) index over the mapped ORDERS_FILE
+typedef struct OrderIndex
+{
+    uint32_t capacity;                               // Records the arrays below have room for, a whole number of segments
+    uint32_t count;                                  // Records of ORDERS_FILE up to the last one of the active segment
+    uint32_t first_live_segment;                     // Segments before this one are compacted and freed
+    uint32_t active_segment;                         // Segment new orders are appended to
+    uint32_t active_since;                           // Time the first order entered the active segment, 0 while it is empty
+    uint32_t rotate_seconds;                         // Age after which the active segment is sealed, 0 seals it only when full
+    bool freeing_segment;                            // A freed segment is logged but its blocks are not released yet
+    uint64_t archived;                               // Orders moved to ORDERS_ARCHIVE_FILE since the server started
+    uint64_t moved;                                  // Open orders moved out of sealed segments since the server started
+    uint32_t waiting_count;                          // Number of records in all waiting heaps
+    uint32_t queue_count[KITCHEN_QUEUES];            // Number of records in the waiting heap of every queue
+    KitchenStation stations[KITCHEN_STATIONS];       // Station of queue s + 1, guarded by kitchen_lock
+    uint32_t status_count[ORDER_STATUSES];           // Number of records in every status, read without the lock
+    uint32_t by_course[ORDER_INDEX_BUCKETS];         // First record + 1 of every (code, course) bucket, 0 ends the chain
+    uint32_t *next_by_course;                        // Next record + 1 in the same bucket, 0 ends the chain
+    uint32_t *waiting[KITCHEN_QUEUES];               // Min-heap of waiting records per queue, the smallest key first
+    uint32_t *wait_key;                              // Key of every waiting record given by the kitchen schedule
+    uint32_t *taken_at;                              // Time every preparing record was taken, 0 when it is unknown
+    uint32_t by_dishes[DISH_BATCH_BUCKETS];          // First waiting record + 1 of every bucket of dish sets and queues, 0 when it is empty
+    uint32_t last_by_dishes[DISH_BATCH_BUCKETS];     // Last waiting record + 1 of every bucket of dish sets and queues
+    uint32_t *next_by_dishes;                        // Next waiting record + 1 in the same bucket, 0 ends the list
+    uint32_t *prev_by_dishes;                        // Previous waiting record + 1 in the same bucket, 0 starts the list
+    uint32_t *heap_position;                         // Position + 1 of every record in its heap, 0 when it is not waiting
+    uint32_t course_heaps[COURSE_HEAP_BUCKETS];      // Root record + 1 of the first course heap in every bucket of course codes, 0 when it is empty
+    uint32_t *next_course_heap;                      // Root record + 1 of the next course heap in the bucket of a root, 0 ends the chain
+    uint32_t *course_child;                          // First child + 1 of every waiting record in the pairing heap of its course
+    uint32_t *course_sibling;                        // Next sibling + 1 of every waiting record in its course heap, 0 ends the list
+    uint32_t *course_prev;                           // Previous sibling + 1, or parent + 1 of a first child, 0 for a root
+    uint8_t *queue_of;                               // Queue whose heap holds every waiting record
+    uint64_t *status_bits[ORDER_STATUSES];           // Bit of every record in each status, set and cleared atomically
+    KitchenLease leases[MAX_KITCHEN_LEASES];         // Leases of the kitchen devices, guarded by kitchen_lock
+    uint32_t lease_wheel[LEASE_WHEEL_SIZE];          // First lease + 1 due in every second of the timer wheel
+    uint32_t lease_tick;                             // Last second whose due leases were expired
+    uint32_t lease_seconds;                          // Time a lease lasts without a renewal
+    uint32_t free_leases;                            // First free lease + 1, free leases are chained by next_due
+    uint64_t returned;                               // Orders of expired leases put back in the queue since the server started
+    uint16_t *lease_of;                              // Lease + 1 every preparing record is held under, 0 when none
+    uint32_t *next_in_lease;                         // Next record + 1 held under the same lease, 0 ends the list
+    uint32_t *prev_in_lease;                         // Previous record + 1 held under the same lease, 0 starts the list
+} OrderIndex;
+
+// Struct for the group commit state shared by every process
+typedef struct WriteAheadLog
+{
+    pthread_mutex_t lock;          // Guards everything below except durable_lsn
+    pthread_cond_t appended;       // Signalled when the commit thread has work
+    pthread_cond_t committed;      // Broadcast when durable_lsn moves or buffer space is freed
+    uint64_t appended_lsn;         // Log bytes ever appended
+    uint64_t durable_lsn;          // Log bytes ever made durable, readable without the lock
+    uint64_t records;              // Records appended
+    uint64_t commits;              // Group commits (write + fdatasync) done
+    int window_us;                 // Longest time a group commit waits for more records
+    bool stopping;                 // Commit thread flushes what is pending and exits
+    size_t pending_len;            // Number of bytes in pending
+    char pending[WAL_BUFFER_SIZE]; // Records not written to WAL_FILE yet
+} WriteAheadLog;
+
+// Struct for one reservation kept in memory
+typedef struct IndexedReservation
+{
+    Reservation reservation; // Copy of the record written to RESERVATIONS_FILE
+    uint32_t position;       // Position of the record in RESERVATIONS_FILE, also its entry in BILLS_FILE
+    uint32_t next_by_code;   // Next record in the same (code, surname) bucket, 0 ends the chain
+} IndexedReservation;
+
+// Struct for the in-memory copy of RESERVATIONS_FILE with its hash indexes
+typedef struct ReservationIndex
+{
+    uint32_t count;                                             // Number of records, record numbers start at 1
+    uint32_t skipped;                                           // Records of the file with an unknown table or date
+    uint32_t file_records;                                      // Records in the file, skipped ones included
+    uint32_t by_code[RESERVATION_INDEX_BUCKETS];                // First record of every (code, surname) bucket
+    IndexedReservation records[RESERVATION_INDEX_CAPACITY + 1]; // Records, number 0 is unused
+} ReservationIndex;
+
+typedef uint64_t TableSet; // One bit for every table of ALL_TABLES
+_Static_assert(MAX_TABLES <= 64, "TableSet has one bit per table");
+
+// Struct for the reserved tables of one date
+typedef struct DayAvailability
+{
+    int32_t key;                       // Days since 01-01-1970 plus one, 0 marks an unused entry
+    TableSet reserved[SLOTS_PER_DAY];  // Tables reserved in every slot of the date
+} DayAvailability;
+
+// Struct for the availability of all tables, per date and slot
+typedef struct AvailabilityGrid
+{
+    uint32_t used;                             // Number of used dates
+    TableSet by_seats[MAX_TABLE_SEATS + 1];    // Tables grouped by their number of seats
+    DayAvailability days[AVAILABILITY_DAYS];   // Dates in an open addressing table
+} AvailabilityGrid;
+
+// Struct for the state a device keeps with the server between commands
+typedef struct Session
+{
+    struct sockaddr_in addr;                // Address of the connected device
+    int version;                            // Protocol version (PROTOCOL_LEGACY until a hello is received)
+    uint32_t bill_record;                   // Entry in BILLS_FILE of the reservation, valid once checked in
+    int found_tables;                       // Number of tables offered by the last find
+    FindRequest reserv_params;              // Parameters of the last find request
+    MatchingTable matching_tab[MAX_TABLES]; // Tables offered by the last find request
+    Reservation reservation;                // Reservation the table device checked in with
+    uint64_t commit_lsn;                    // Log position the queued replies report on
+    bool subscribed;                        // Device follows the kitchen feed
+    uint32_t feed_sequence;                 // Last kitchen event queued to the device
+    int station;                            // Queue of the station the kitchen device serves, 0 when it serves none
+    int lease;                              // Lease + 1 of the orders the kitchen device took, 0 when it holds none
+    uint32_t lease_generation;              // Generation of the lease when the device got it
+    bool watching;                          // Table device follows the status changes of its orders
+    uint32_t table_sequence;                // Last status change of its orders queued to the table device
+} Session;
+
+// Struct for the thread pushing kitchen events to a device served by a forked child
+typedef struct KitchenFeedArgs
+{
+    int sock;         // Socket of the subscribed device
+    Session *session; // Session of the connection, its feed_sequence is only moved by the thread
+} KitchenFeedArgs;
+
+// Struct for reply bytes waiting to be sent to a device
+typedef struct Reply
+{
+    char *data;         // Reply bytes in wire format
+    size_t len;         // Number of bytes in data
+    size_t cap;         // Allocated size of data
+    int version;        // Protocol version the reply is encoded for
+    size_t frame_start; // Offset of the header of the frame being built
+    uint16_t frame_type; // Message type of the frame being built
+    uint32_t frame_id;   // Request id the frame being built answers
+} Reply;
+
+// Struct for a connection served by the event loop
+typedef struct Connection
+{
+    int sock;                           // Socket descriptor of the connection
+    int state;                          // Parsing state (CONNECTION_*)
+    int type;                           // Type of the request whose payload is being received
+    char in[IN_BUFFER_SIZE];            // Received bytes that were not handled yet
+    size_t in_len;                      // Number of bytes in in
+    Reply out;                          // Reply bytes waiting to be sent
+    size_t out_sent;                    // Bytes of out (sending for io_uring) already sent
+    Session session;                    // Command state of the connection
+    uint32_t events;                    // Events the socket is registered for (epoll loop only)
+    bool awaiting_commit;               // Queued reply waits for a group commit
+    struct Connection *commit_prev;     // Neighbours in the commit waiters of the loop
+    struct Connection *commit_next;
+    bool feed_listed;                   // Connection is in the feed subscribers of the loop
+    struct Connection *feed_prev;       // Neighbours in the feed subscribers of the loop
+    struct Connection *feed_next;
+    bool table_listed;                  // Connection is in the table watchers of the loop
+    struct Connection *table_prev;      // Neighbours in the table watchers of the same reservation bucket
+    struct Connection *table_next;
+    // Used by the io_uring loop only
+    Reply sending;                      // Reply bytes handed to the kernel
+    int slot;                           // Index in the connection pool and registered buffer table
+    bool recv_pending;                  // A receive is in flight
+    bool send_pending;                  // A send is in flight
+    bool closing;                       // Connection is released once nothing is in flight
+} Connection;
+
+#ifdef HAVE_IO_URING
+// Struct for an io_uring instance and its mapped queues
+typedef struct Uring
+{
+    int fd;                     // Descriptor returned by io_uring_setup
+    unsigned *sq_head;          // Submission queue head (advanced by the kernel)
+    unsigned *sq_tail;          // Submission queue tail (advanced by the server)
+    unsigned *sq_mask;          // Mask for submission queue indexes
+    unsigned *sq_array;         // Indexes of submitted entries
+    unsigned sq_entries;        // Size of the submission queue
+    unsigned sq_local_tail;     // Tail including entries not yet published to the kernel
+    struct io_uring_sqe *sqes;  // Submission entries
+    unsigned *cq_head;          // Completion queue head (advanced by the server)
+    unsigned *cq_tail;          // Completion queue tail (advanced by the kernel)
+    unsigned *cq_mask;          // Mask for completion queue indexes
+    struct io_uring_cqe *cqes;  // Completion entries
+    bool fixed_buffers;         // Receive buffers are registered with the kernel
+} Uring;
+#endif
+
+volatile sig_atomic_t server_running = 1; // Cleared by the "stop" console command
+int stop_event_fd = -1;                   // Wakes the event loops when the server stops
+SharedState *shared = NULL;               // Locks visible to forked children and worker threads
+ReservationIndex *reservation_index = NULL; // Reservations visible to forked children and worker threads
+AvailabilityGrid *availability = NULL;      // Reserved tables per date and slot, guarded by reservations_lock
+char *orders_map = NULL;                    // ORDERS_FILE mapped from its header on, shared with forked children
+Order *orders = NULL;                       // Records of ORDERS_FILE as an array
+int orders_fd = -1;                         // Descriptor of ORDERS_FILE, used to grow it
+OrderIndex *order_index = NULL;             // Order slots by (code, course), by status and the kitchen queue
+int archive_fd = -1;                        // Descriptor of ORDERS_ARCHIVE_FILE, written by the compaction thread only
+char *bills_map = NULL;                     // BILLS_FILE mapped from its header on, shared with forked children
+int32_t *bills = NULL;                      // Running bill of every reservation by its position in RESERVATIONS_FILE
+int bills_fd = -1;                          // Descriptor of BILLS_FILE, used to grow it
+off_t archive_end = 0;                      // End of the last complete block of ORDERS_ARCHIVE_FILE
+pthread_t compaction_thread;                // Thread compacting sealed order segments
+volatile bool compaction_stopping = false;  // Set when the compaction thread has to finish
+pthread_t lease_thread;                     // Thread putting the orders of expired kitchen leases back in the queue
+volatile bool lease_stopping = false;       // Set when the lease timer thread has to finish
+KitchenSchedule *kitchen_schedule = NULL;   // Policy and prep times of the kitchen queue, shared with forked children
+MenuCache *menu_cache = NULL;               // Parsed MENU_FILE visible to forked children and worker threads
+int menu_watch_fd = -1;                     // inotify descriptor watching the directory of MENU_FILE
+pthread_t menu_watch_thread;                // Thread reloading the menu when MENU_FILE changes
+volatile bool menu_watch_stopping = false;  // Set when the menu watch thread has to finish
+int server_io = SERVER_IO_EPOLL;          // Transport backend of the event loops
+WriteAheadLog *wal = NULL;                // Group commit state visible to forked children and worker threads
+int wal_fd = -1;                          // Descriptor of WAL_FILE, written by the commit thread only
+pthread_t wal_thread;                     // Thread doing the group commits
+int wal_listeners[MAX_WAL_LISTENERS];     // Event descriptors of the loops waiting for commits
+int wal_listener_count = 0;               // Number of descriptors in wal_listeners
+pthread_mutex_t wal_listeners_lock = PTHREAD_MUTEX_INITIALIZER; // Guards wal_listeners
+__thread uint64_t wal_last_lsn = 0;       // Log position of the last record this thread appended
+__thread Connection *commit_waiters = NULL; // Connections of this thread's loop whose reply waits for a commit
+KitchenFeed *kitchen_feed = NULL;         // Recent kitchen events visible to forked children and worker threads
+__thread Connection *feed_subscribers = NULL; // Connections of this thread's loop that follow the kitchen feed
+__thread Connection **table_watchers = NULL;  // Table connections of this thread's loop by bucket of their reservation
+__thread uint32_t table_feed_seen = 0;        // Last kitchen event this thread's loop handed to its table watchers
+pthread_mutex_t feed_send_lock = PTHREAD_MUTEX_INITIALIZER; // Keeps replies and pushed events of a forked child apart
 
 // Methods handling threads
 void *scan_function(void *arg);
 void *socket_communication(void *arg);
 
+// Methods handling connection models
+void parseServerOptions(int argc, const char *argv[], ServerOptions *options);
+void serveForkedConnections(int server_sock);
+void serveConnection(int client_sock, Session *session);
+void runReactor(int server_sock);
+void runEventLoop(int server_sock);
+void runUringLoop(int server_sock);
+void runWorkerShards(int port, int workers);
+void *worker_shard(void *arg);
+int createShardListener(int port);
+void pinThreadToCore(int core);
+void initSharedState();
+#ifdef HAVE_IO_URING
+int uringSetup(Uring *ring, unsigned entries);
+struct io_uring_sqe *uringGetSqe(Uring *ring);
+int uringSubmit(Uring *ring, unsigned wait_nr);
+void uringQueueAccept(Uring *ring, int server_sock, struct sockaddr_in *addr, socklen_t *addr_size);
+void uringQueueRecv(Uring *ring, Connection *conn);
+void uringQueueSend(Uring *ring, Connection *conn);
+void uringQueuePoll(Uring *ring, int fd, int op);
+bool uringProgress(Uring *ring, Connection *conn);
+void uringRelease(Connection *conn, int free_slots[], int *free_count);
+#endif
+void acceptConnections(int epoll_fd, int server_sock);
+bool readFromConnection(Connection *conn);
+bool writeToConnection(Connection *conn);
+bool flushConnection(int epoll_fd, Connection *conn);
+void flushCommittedReplies(int epoll_fd);
+void waitForCommit(Connection *conn);
+void stopWaitingForCommit(Connection *conn);
+bool consumeInput(Connection *conn);
+void closeConnection(int epoll_fd, Connection *conn);
+void stopServer(int server_sock);
+
+// Methods handling commands
+bool negotiateProtocol(Session *session, const char *command, Reply *reply);
+bool dispatchRequest(Session *session, int type, uint32_t request_id, const char *payload, size_t payload_len, Reply *reply);
+bool handleFrame(Session *session, uint16_t type, uint32_t request_id, const char *body, uint32_t body_len, Reply *reply);
+bool handleCommand(Session *session, int type, const char *payload, size_t payload_len, Reply *reply);
+void handleFind(Session *session, const char *payload, Reply *reply);
+void handleBook(Session *session, const char *payload, Reply *reply);
+void handleCheck(Session *session, const char *payload, Reply *reply);
+void handleOrder(Session *session, const char *payload, Reply *reply);
+void handleReady(Session *session, const char *payload, Reply *reply);
+void handleSlots(const char *payload, Reply *reply);
+void handleGrid(const char *payload, Reply *reply);
+void handleFeed(Session *session, Reply *reply);
+void handleServe(Session *session, const char *payload, Reply *reply);
+void handleRenew(Session *session, Reply *reply);
+void handleWatch(Session *session, Reply *reply);
+
+// Methods handling replies
+void replyBegin(Reply *reply, int version, int type, uint32_t request_id);
+void replyEnd(Reply *reply);
+void replyBytes(Reply *reply, const void *data, size_t len);
+void replyInt(Reply *reply, int value);
+void replyText(Reply *reply, const char *text);
+void replyClear(Reply *reply);
+void replyFree(Reply *reply);
+int recvAll(int sock, void *data, size_t len);
+int sendAll(int sock, const void *data, size_t len);
+
 // Methods handling Socket Connections
 void prepareServerForConnections(struct sockaddr_in *server_addr, int *server_sock, const char *ip, int *port, int *n);
 void createSocket(int *server_sock);
@@ -111,20 +539,166 @@ void establishNewConnection(struct sockaddr_in *client_addr, socklen_t *addr_siz
 
 // Methods handling Reservations
 int findAvailableTables(MatchingTable matching_tab[], FindRequest *rsrv_params);
-int isTableReserved(const char *table_id, const char *date, const char *time);
+int isTableReserved(int table, uint32_t start);
 int addReservation(FindRequest *rsrv_params, Table *table, Reservation *reservation);
 int generateReservationCode();
-int findReservation(const char *surname, int code, Reservation *reservation);
+int findReservation(const char *surname, int code, Reservation *reservation, uint32_t *position);
+void loadReservationIndex();
+bool indexReservation(const Reservation *reservation, uint32_t position);
+uint32_t hashReservationCode(int code, const char *surname);
+uint32_t hashBytes(uint32_t hash, const void *data, size_t len);
+
+// Methods handling bills
+void loadBills();
+void rebuildBills(uint32_t first);
+void addOrderToBill(const Order *order, uint32_t first);
+int32_t readBill(const Session *session);
+
+// Methods handling table availability
+bool markReserved(const Reservation *reservation);
+DayAvailability *findDay(int day, bool create);
+int64_t parseReservationStart(const char *date, const char *time);
+int findFreeSlots(int people, const char *date, int free_tables[]);
+int findFreeGrid(int people, int first_day, int days, int first_slot, int slots, int free_tables[][SLOTS_PER_DAY]);
+
+// Methods handling the write-ahead log
+int openRecordFile(const char *path, const char *magic, uint16_t record_size);
+void walInit(int window_us);
+void walReplay();
+uint64_t walAppend(int file, uint32_t index, const void *data, uint16_t size);
+bool walIsDurable(uint64_t lsn);
+void walWaitDurable(uint64_t lsn);
+void *walCommitThread(void *arg);
+void walCheckpoint();
+int walAddListener();
+void walNotifyListeners();
+void walShutdown();
+
+// Methods handling order segments
+void startOrderCompaction(int rotate_seconds);
+void stopOrderCompaction();
+void *orderCompactionThread(void *arg);
+void compactOrderSegment(uint32_t segment);
+void rotateOrderSegment();
+bool orderSegmentIsDue(uint32_t now);
+off_t orderSegmentOffset(uint32_t segment);
+int freeOrderSegment(int fd, uint32_t segment);
+bool orderSegmentHasData(int fd, uint32_t segment);
+uint32_t findFirstLiveSegment(uint32_t count);
+void openOrderArchive(uint32_t first_live_segment);
+uint32_t rebaseOrderStore(uint32_t first_live_segment, uint32_t count);
+
+// Methods handling the kitchen queue
+int claimWaitingOrders(Session *session, Order claimed[], int max, const char *course, bool cook_batch);
+int nextKitchenQueue(int station);
+bool findWaitingCourse(const char *course, uint32_t *slot);
+bool claimOrderSlot(uint32_t slot);
+void pushWaitingOrder(uint32_t slot);
+void removeWaitingOrder(uint32_t slot);
+void siftWaitingUp(int queue, uint32_t position);
+void siftWaitingDown(int queue, uint32_t position);
+bool takenBefore(uint32_t slot, uint32_t other);
+
+// Methods handling the waiting heap of every course
+void pushCourseHeap(uint32_t slot);
+void removeCourseHeap(uint32_t slot);
+uint32_t *findCourseHeap(const char *course);
+void setCourseHeapRoot(uint32_t *link, uint32_t old_root, uint32_t root);
+uint32_t meldCourseHeaps(uint32_t first, uint32_t second);
+uint32_t mergeCoursePairs(uint32_t first);
+
+// Methods handling cook batches
+int claimSameDishes(uint32_t first, const char *course, uint32_t slots[], int max);
+void linkSameDishes(uint32_t slot);
+void unlinkSameDishes(uint32_t slot);
+uint32_t findDishBucket(uint32_t slot);
+uint32_t hashOrderDishes(const Order *order);
+bool haveSameDishes(const Order *order, const Order *other);
+
+// Methods handling the kitchen schedule
+void loadKitchenSchedule(int policy, int batch_window);
+void scheduleWaitingOrder(uint32_t slot);
+uint32_t *findPacing(int rsrv_code, uint32_t now);
+void learnOrderPrepTime(uint32_t slot);
+void printPrepTimes();
+
+// Methods handling kitchen stations
+int findStationQueue(const char *course);
+int joinStation(char courses[][MAX_COURSE_LENGTH], int count);
+void leaveStation(Session *session);
+void rerouteWaitingOrders(int queue);
+
+// Methods handling kitchen leases
+void startLeaseTimer(int lease_seconds);
+void stopLeaseTimer();
+void *leaseTimerThread(void *arg);
+int acquireLease(Session *session);
+int renewLease(Session *session);
+void releaseLease(Session *session);
+void freeLease(int lease);
+void scheduleLease(int lease);
+void unscheduleLease(int lease);
+void leaseOrder(uint32_t slot, int lease);
+void unleaseOrder(uint32_t slot);
+void expireLease(int lease);
+bool returnOrderToQueue(uint32_t slot);
+
+// Methods handling the kitchen feed
+void publishKitchenEvent(int event, const Order *order, uint64_t lsn);
+int collectKitchenEvents(Session *session, Reply *reply, size_t max_len);
+void replyKitchenEvent(Reply *reply, int version, int event, uint32_t sequence, const char *text);
+void subscribeConnection(Connection *conn);
+void unsubscribeConnection(Connection *conn);
+void pushKitchenEvents(int epoll_fd);
+void startKitchenFeedThread(int client_sock, Session *session, void *(*feed)(void *));
+void *kitchenFeedThread(void *arg);
+void waitForKitchenEvent(uint32_t seen);
+
+// Methods handling the status changes pushed to table devices
+int collectTableEvents(Session *session, Reply *reply);
+uint32_t hashTableWatch(int rsrv_code);
+void watchTable(Connection *conn);
+void unwatchTable(Connection *conn);
+int queueTableEvents(Connection *changed[], int max);
+void pushTableEvents(int epoll_fd);
+void *tableFeedThread(void *arg);
+void waitForTableEvent(uint32_t bucket, uint32_t seen);
 
 // Methods handling Orders
-int saveOrder(Order *order);
+void loadOrderStore();
+void mapOrderIndex(uint32_t capacity);
+void *mapIndexArray(uint32_t count, size_t size, size_t *mapped);
+void indexOrder(uint32_t slot);
+int findOrder(int rsrv_code, const char *course);
+void markOrderStatus(uint32_t slot, int status);
+void clearOrderStatus(uint32_t slot, int status);
+int nextOrderInStatus(int status, uint32_t slot);
+void unindexOrder(uint32_t slot);
+int appendOrderRecord(const Order *order, int bill_record);
+uint32_t hashOrderCourse(int rsrv_code, const char *course);
+int saveOrder(Order *order, uint32_t bill_record);
 void printOrderStatusByTable(const char *table_id);
 void printOrderStatusByStatus(const char *status);
-void sendLongestWaitingOrder(int client_sock);
-int changeOrderStatus(int rsrv_code, const char *course, const char *new_status);
-void sendAllOrdersInPreparingStatus(int client_sock);
+void sendWaitingOrders(Session *session, const char *payload, bool cook_batch, Reply *reply);
+int changeOrderStatus(int rsrv_code, const char *course, int new_status);
+bool advanceOrderStatus(uint32_t slot, int new_status);
+void recordStatusChange(uint32_t slot, int old_status, int new_status);
+void sendAllOrdersInPreparingStatus(Reply *reply);
 int allOrdersAreServed();
-int countReceipt(const char *order);
+int countReceipt(const Order *order);
+
+// Methods handling the menu
+void loadMenuCache();
+bool parseMenu(const char *path, Menu *menu);
+bool hashMenu(Menu *menu);
+uint32_t hashDishCode(const char *code, uint32_t seed);
+const MenuItem *findDish(const Menu *menu, const char *code);
+const Menu *acquireMenu(uint32_t *version);
+void releaseMenu(uint32_t version);
+bool reloadMenu();
+void startMenuWatch();
+void stopMenuWatch();
+void *menuWatchThread(void *arg);
 
 // Supporting methods
 bool startsWith(const char *pre, const char *str);
@@ -134,14 +708,31 @@ int main(int argc, const char *argv[])
 {
     fprintf(stdout, "-------------------------------------------SERVER-------------------------------------------\n");
     pthread_t scan_thread, socket_communication_thread;
-    int port = atoi(argv[1]);
+    ServerOptions options;
     int server_sock;
 
+    parseServerOptions(argc, argv, &options);
+    signal(SIGPIPE, SIG_IGN); // A device closing mid-reply must not kill the server
+    signal(SIGCHLD, SIG_IGN); // Forked connection handlers are reaped automatically
+    initSharedState();
+    loadMenuCache();
+    walInit(options.commit_window_us);
+    loadReservationIndex();
+    loadKitchenSchedule(options.schedule, options.batch_window);
+    loadOrderStore();
+    loadBills();
+    startOrderCompaction(options.rotate_seconds);
+    startLeaseTimer(options.lease_seconds);
+    startMenuWatch();
+    stop_event_fd = eventfd(0, EFD_NONBLOCK);
     createSocket(&server_sock);
 
     struct ThreadArgs args;
-    args.port = port;
+    args.port = options.port;
     args.server_sock = server_sock;
+    args.mode = options.mode;
+    args.workers = options.workers;
+    server_io = options.io;
 
     pthread_create(&scan_thread, NULL, scan_function, &server_sock);
     pthread_create(&socket_communication_thread, NULL, socket_communication, &args);
@@ -149,6 +740,10 @@ int main(int argc, const char *argv[])
     // Wait for the scan_thread and socket_communication_thread to complete
     pthread_join(scan_thread, NULL);
     pthread_join(socket_communication_thread, NULL);
+    stopMenuWatch();
+    stopLeaseTimer();
+    stopOrderCompaction();
+    walShutdown();
 
     return 0;
 }
@@ -158,12 +753,15 @@ void *scan_function(void *arg)
     int server_sock = *(int *)arg;
     fprintf(stdout, "\n------------------------------------------WELCOME!------------------------------------------\n");
     fprintf(stdout, "1)  stat {table_nr} or {status} ---> display table status or dishes that are in given status\n");
-    fprintf(stdout, "2)  stop                        ---> stop the server if there are bo other meals to prepare\n\n");
+    fprintf(stdout, "2)  stat prep                   ---> display the prep time of every dish used by the kitchen schedule\n");
+    fprintf(stdout, "3)  stop                        ---> stop the server if there are bo other meals to prepare\n\n");
 
     while (1)
     {
         char command[MAX_SERVER_COMMAND_SIZE];
-        fgets(command, sizeof(command), stdin);
+        // Console was closed (e.g. server started in background), keep serving devices
+        if (fgets(command, sizeof(command), stdin) == NULL)
+            break;
 
         if (startsWith("stop", command))
         {
@@ -171,10 +769,12 @@ void *scan_function(void *arg)
             if (allOrdersAreServed() == 1)
             {
                 fprintf(stdout, "[SERVER STOP] All orders are served. Closing the server...\n");
-                close(server_sock);
+                stopServer(server_sock);
                 break;
             }
         }
+        else if (startsWith("stat prep", command))
+            printPrepTimes();
         else if (startsWith("stat table", command))
         {
             char table_id[5];
@@ -184,12 +784,13 @@ void *scan_function(void *arg)
         }
         else if (startsWith("stat status", command))
         {
-            char status[10];
-            sscanf(command, "stat status %s", status);
+            char status[10] = "";
+            sscanf(command, "stat status %9s", status);
             fprintf(stdout, "[SERVER STAT] Printing orders with status: %s...\n", status);
             printOrderStatusByStatus(status);
         }
     }
+    return NULL;
 }
 
 void *socket_communication(void *arg)
@@ -198,571 +799,4044 @@ void *socket_communication(void *arg)
     int port = args->port;
     int server_sock = args->server_sock;
     // Declare all important variables for establishing a connection
-    char *ip = "127.0.0.1";                      // IP address of the server
-    int n, client_sock, td_sock, kd_sock;        // Socket descriptors for various connections
-    struct sockaddr_in server_addr, client_addr; // Server and client address structures
-    socklen_t addr_size;                         // Size of the address structure
-    pid_t childpid;                              // Process ID for child processes
+    char *ip = "127.0.0.1";      // IP address of the server
+    int n;                       // Result of binding the server socket
+    struct sockaddr_in server_addr; // Server address structure
+
+    // Every shard of the threads mode binds its own listener
+    if (args->mode == SERVER_MODE_THREADS)
+    {
+        runWorkerShards(port, args->workers);
+        return NULL;
+    }
 
     // Prepare server for incoming connections
     prepareServerForConnections(&server_addr, &server_sock, ip, &port, &n);
 
-    while (1)
+    if (args->mode == SERVER_MODE_EPOLL)
+        runReactor(server_sock);
+    else
+        serveForkedConnections(server_sock);
+
+    close(server_sock);
+    return NULL;
+}
+
+void serveForkedConnections(int server_sock)
+{
+    struct sockaddr_in client_addr; // Client address structure
+    socklen_t addr_size;            // Size of the address structure
+    int client_sock;                // Socket descriptor of the accepted connection
+    pid_t childpid;                 // Process ID for child processes
+
+    while (server_running)
     {
-        // Handle new connection
         // Establish new incoming connection
+        addr_size = sizeof(client_addr);
         establishNewConnection(&client_addr, &addr_size, &server_sock, &client_sock);
+        if (client_sock < 0)
+            break;
 
         // Create a new child process
         if ((childpid = fork()) == 0)
         {
-            int total = 0; // total order value for table
-            close(server_sock);
+            // Process-private locks may have been held by a thread of the parent, e.g. its log
+            // committer, when it forked; event loops listening for commits only run in the parent,
+            // forked subscribers are woken by the futex of the kitchen feed
+            pthread_mutex_init(&wal_listeners_lock, NULL);
+            pthread_mutex_init(&feed_send_lock, NULL);
+            wal_listener_count = 0;
 
-            // Handle for sever-child communication
-            while (1)
-            {
-                // Declare variables for communication
-                char command[MAX_COMMAND_SIZE]; // Array for receiving commands
-                char buffer[MAX_BUFFER_SIZE];   // Array for receiving/sending messages
-                // Recive command
-                bzero(command, MAX_COMMAND_SIZE);
-                if (recv(client_sock, command, MAX_COMMAND_SIZE, 0) < 0)
-                    fprintf(stdout, "[ERROR] Cannot recive command\n");
-                else
-                {
-                    // Handle reviced command
-                    fprintf(stdout, "[COMMAND] %s\n", command);
+            Session session;
+            bzero(&session, sizeof(session));
+            session.addr = client_addr;
+            close(server_sock);
 
-                    // Handle client commands
-                    if (startsWith("find", command) || startsWith("book", command))
-                    {
-                        FindRequest reserv_params;
-                        MatchingTable matching_tab[MAX_TABLES];
-
-                        // Find available tables options for recived parameters
-                        if (startsWith("find", command) == true)
-                        {
-                            // Recive detailed reservation request from client
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            recv(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                            fprintf(stdout, "[CLIENT] %s\n", buffer);
-
-                            // Write infromation from buffer to the FindRequest struct
-                            sscanf(buffer, "%s %d %s %s", &reserv_params.surname, &reserv_params.people, &reserv_params.date, &reserv_params.hour);
-
-                            // Find avaible tables
-                            int result = findAvailableTables(matching_tab, &reserv_params);
-
-                            send(client_sock, &result, sizeof(int), 0);
-                            // Error occurred while finding available tables
-                            if (result <= 0)
-                            {
-                                bzero(buffer, MAX_BUFFER_SIZE);
-                                if (result < 0)
-                                {
-                                    char error_msg[] = "[ERROR] Could not open file";
-                                    strcpy(buffer, error_msg);
-                                }
-                                else
-                                {
-                                    char no_found_msg[] = "Sorry! All tables are reserved. Please try different data/hour.";
-                                    strcpy(buffer, no_found_msg);
-                                }
-                                send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                                fprintf(stdout, "[SERVER]%s\n", buffer);
-                            }
-                            // Send found available tables
-                            else
-                            {
-                                for (int k = 0; k < result; k++)
-                                {
-                                    bzero(buffer, MAX_BUFFER_SIZE);
-                                    sprintf(buffer, "%s %s %s", matching_tab[k].table->id, matching_tab[k].table->room, matching_tab[k].table->place_desc);
-                                    send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                                }
-                                fprintf(stdout, "[SERVER] Available tables send to client\n");
-                            }
-                        }
-                        else if (startsWith("book", command) == true)
-                        {
-                            // Recive client reservation choice
-                            int choice;
-                            recv(client_sock, &choice, sizeof(int), 0);
-                            fprintf(stdout, "[CLIENT] %d\n", choice);
-
-                            // Book table for given client choice
-                            Reservation reservation;
-                            int result = addReservation(&reserv_params, matching_tab[choice - 1].table, &reservation);
-
-                            send(client_sock, &result, sizeof(int), 0);
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            // Error occurred while finding available tables
-                            if (result < 0)
-                            {
-                                char error_msg[] = "[ERROR] Could not open file";
-                                strcpy(buffer, error_msg);
-                                fprintf(stdout, "[SERVER]%s\n", error_msg);
-                            }
-                            // Send reservation confirmation to client
-                            else
-                            {
-                                sprintf(buffer, "%d %s %s", reservation.code, reservation.table->room, reservation.table->id);
-                                fprintf(stdout, "[SERVER]Reservation details: %s\n", buffer);
-                            }
-
-                            if (send(client_sock, buffer, MAX_BUFFER_SIZE, 0) < 0)
-                                fprintf(stdout, "[-]Error with sending\n");
-                        }
-                    }
-                    else if (startsWith("check", command) || startsWith("order", command) || startsWith("bill", command))
-                    {
-                        Reservation reservation;
-                        if (startsWith("check", command) == true)
-                        {
-                            char surname[20];
-                            int code;
-
-                            // Recive surname and code from client to login to table
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            recv(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                            sscanf(buffer, "%s %d", surname, &code);
-                            fprintf(stdout, "[TABLE] Surname: %s code:%d\n", surname, code);
-
-                            // Check if there is reservation for given surname and code
-                            Reservation reservation;
-                            int result;
-                            result = findReservation(surname, code, &reservation);
-
-                            send(client_sock, &result, sizeof(int), 0);
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            // Error occurred while finding available tables
-                            if (result < 0)
-                            {
-                                char error_msg[] = "[[ERROR] Could not open file";
-                                strcpy(buffer, error_msg);
-                            }
-                            else if (reservation.code == 0)
-                            {
-                                char wrong_creds[] = "[ERROR] No reservation found.";
-                                strcpy(buffer, wrong_creds);
-                            }
-                            else
-                            {
-                                sprintf(buffer, "%s %s %s", reservation.table->id, reservation.date, reservation.hour);
-                            }
-                            send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                            fprintf(stdout, "[SERVER] %s\n", buffer);
-                        }
-                        else if (startsWith("order", command) == true)
-                        {
-                            Order order;
-                            // Recive order from Table
-                            recv(client_sock, &buffer, MAX_BUFFER_SIZE, 0);
-                            sscanf(buffer, "Course: %s Order: %[^\n]", order.course, order.order);
-                            fprintf(stdout, "[TABLE]Course: %s Order: %s\n", order.course, order.order);
-
-                            // Fill missing Order information
-                            order.rsrv_code = reservation.code;
-                            strcpy(order.table_id, reservation.table->id);
-                            strcpy(order.status, STATUS_WAITING);
-                            order.time = time(NULL);
-
-                            // Count value of the order
-                            order.value = countReceipt(order.order);
-                            total += order.value;
-
-                            // Save order
-                            int result;
-                            result = saveOrder(&order);
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            if (result < 0)
-                            {
-                                char error_msg[] = "[ERROR] Could not open file";
-                                strcpy(buffer, error_msg);
-                            }
-                            else
-                            {
-                                char success_msg[] = "Order was successfully saved!";
-                                strcpy(buffer, success_msg);
-                            }
-                            send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                            fprintf(stdout, "[SERVER] %s\n", buffer);
-                        }
-                        else if (startsWith("bill", command) == true)
-                        {
-                            // Get total value and send it to Table
-                            send(client_sock, &total, sizeof(int), 0);
-                            fprintf(stdout, "[SERVER SEND] Total bill value: %d\n", total);
-                        }
-                    }
-                    else if (startsWith("take", command) || startsWith("ready", command) || startsWith("show", command))
-                    {
-                        if (startsWith("take", command) == true)
-                        {
-                            // Take longest waiting order and change it status
-                            sendLongestWaitingOrder(client_sock);
-                        }
-                        else if (startsWith("ready", command) == true)
-                        {
-                            int rsrv_code;
-                            char course[5];
-
-                            // Get rsrv_code and course
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            recv(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                            sscanf(buffer, "%d %s", &rsrv_code, course);
-                            fprintf(stdout, "[KD] Rsrv Code: %d Course: %s\n", rsrv_code, course);
-
-                            // Change order status
-                            int result = changeOrderStatus(rsrv_code, course, STATUS_SERVED);
-                            bzero(buffer, MAX_BUFFER_SIZE);
-                            if (result < 0)
-                            {
-                                char file_error_msg[] = "[ERROR] Could not open file";
-                                strcpy(buffer, file_error_msg);
-                            }
-                            else if (result == 0)
-                            {
-                                char change_error_msg[] = "[ERROR] Status was not change";
-                                strcpy(buffer, change_error_msg);
-                            }
-                            else
-                            {
-                                char success_msg[] = "Status was succesfully changed to \"served\"";
-                                strcpy(buffer, success_msg);
-                            }
-                            send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-                            fprintf(stdout, "[SERVER] %s\n", buffer);
-                        }
-                        else if (startsWith("show", command) == true)
-                        {
-                            sendAllOrdersInPreparingStatus(client_sock);
-                        }
-                    }
-                    else if (startsWith("esc", command) == true)
-                    {
-                        fprintf(stdout, "[+]Disconnected from: %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-                        break;
-                    }
-                    else
-                        fprintf(stdout, "[-] Wrong command recived!\n");
-                }
-            }
+            serveConnection(client_sock, &session);
+            close(client_sock);
+            exit(0);
         }
+        close(client_sock);
     }
-    fprintf(stdout, "Poza pętlą\n");
-    close(server_sock);
 }
 
-int isTableReserved(const char *table_id, const char *date, const char *time)
+void serveConnection(int client_sock, Session *session)
 {
-    FILE *file = fopen(RESERVATIONS_FILE, "rb");
+    Reply reply = {NULL, 0, 0, PROTOCOL_LEGACY, 0, 0, 0};
+    bool keep_connection = true;
+    bool feed_thread_started = false;
+    bool table_thread_started = false;
 
-    if (file == NULL)
-        return -1;
-    else
+    // Handle for sever-child communication
+    while (keep_connection)
     {
-        Reservation reservation;
-        while (fread(&reservation, sizeof(Reservation), 1, file))
+        // Declare variables for communication
+        char command[MAX_COMMAND_SIZE + 1]; // Array for receiving commands
+        char header[FRAME_HEADER_SIZE];     // Array for receiving frame headers
+        char payload[MAX_BUFFER_SIZE];      // Array for receiving command parameters
+        int result;
+
+        replyClear(&reply);
+        if (session->version == PROTOCOL_LEGACY)
         {
-            if (strcmp(reservation.table->id, table_id) == 0 &&
-                strcmp(reservation.date, date) == 0 &&
-                strcmp(reservation.hour, time) == 0)
-            {
-                fclose(file);
-                return 1;
-            }
+            // Recive command
+            bzero(command, sizeof(command));
+            result = recvAll(client_sock, command, MAX_COMMAND_SIZE);
         }
-        fclose(file);
-    }
-
-    return 0;
-}
+        else
+            result = recvAll(client_sock, header, FRAME_HEADER_SIZE);
 
-int findReservation(const char *surname, int code, Reservation *reservation)
-{
-    FILE *file = fopen(RESERVATIONS_FILE, "rb");
+        if (result < 0)
+        {
+            fprintf(stdout, "[ERROR] Cannot recive command\n");
+            break;
+        }
+        else if (result == 0)
+        {
+            fprintf(stdout, "[+]Disconnected from: %s:%d\n", inet_ntoa(session->addr.sin_addr), ntohs(session->addr.sin_port));
+            break;
+        }
 
-    if (file == NULL)
-        return -1;
-    else
-    {
-        Reservation foundReservation;
-        while (fread(&foundReservation, sizeof(Reservation), 1, file))
+        if (session->version == PROTOCOL_LEGACY && !negotiateProtocol(session, command, &reply))
         {
-            if (foundReservation.code == code && strcmp(foundReservation.surname, surname) == 0)
+            // Recive parameters which follow the command
+            int type = protocolCommandType(command);
+            int payload_len = protocolLegacyPayloadSize(type);
+            if (payload_len > 0 && recvAll(client_sock, payload, payload_len) <= 0)
             {
-                reservation->code = foundReservation.code;
-                strcpy(reservation->date, foundReservation.date);
-                strcpy(reservation->hour, foundReservation.hour);
-                reservation->nr_people = foundReservation.nr_people;
-                strcpy(reservation->surname, foundReservation.surname);
-                reservation->table = foundReservation.table;
-                fclose(file);
-                return 1;
+                fprintf(stdout, "[ERROR] Cannot recive command parameters\n");
+                break;
             }
+            keep_connection = dispatchRequest(session, type, 0, payload, payload_len, &reply);
+        }
+        else if (session->version != PROTOCOL_LEGACY && reply.len == 0)
+        {
+            uint32_t body_len, request_id;
+            uint16_t type;
+            protocolGetHeader(header, &body_len, &type, &request_id);
+            if (body_len > MAX_REQUEST_BODY || (body_len > 0 && recvAll(client_sock, payload, body_len) <= 0))
+            {
+                fprintf(stdout, "[ERROR] Cannot recive frame\n");
+                break;
+            }
+            keep_connection = handleFrame(session, type, request_id, payload, body_len, &reply);
         }
-        fclose(file);
-    }
 
-    return 0;
+        // A reply never reports a change the log could still lose
+        if (reply.len > 0)
+            walWaitDurable(session->commit_lsn);
+        pthread_mutex_lock(&feed_send_lock);
+        if (reply.len > 0 && sendAll(client_sock, reply.data, reply.len) < 0)
+            fprintf(stdout, "[-]Error with sending\n");
+        pthread_mutex_unlock(&feed_send_lock);
+
+        // Kitchen events are pushed by a thread of their own, the child keeps reading requests
+        if (session->subscribed && !feed_thread_started)
+        {
+            startKitchenFeedThread(client_sock, session, kitchenFeedThread);
+            feed_thread_started = true;
+        }
+        if (session->watching && !table_thread_started)
+        {
+            startKitchenFeedThread(client_sock, session, tableFeedThread);
+            table_thread_started = true;
+        }
+    }
+    leaveStation(session);
+    releaseLease(session);
+    replyFree(&reply);
 }
 
-int addReservation(FindRequest *rsrv_params, Table *table, Reservation *reservation)
+void runReactor(int server_sock)
 {
-    FILE *file = fopen(RESERVATIONS_FILE, "ab");
+    if (server_io == SERVER_IO_URING)
+        runUringLoop(server_sock);
+    else
+        runEventLoop(server_sock);
+}
 
-    if (file == NULL)
+#ifdef HAVE_IO_URING
+int uringSetup(Uring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
         return -1;
-    else
-    {
-        reservation->code = generateReservationCode();
-        strncpy(reservation->surname, rsrv_params->surname, sizeof(reservation->surname));
-        reservation->nr_people = rsrv_params->people;
-        strncpy(reservation->date, rsrv_params->date, sizeof(reservation->date));
-        strncpy(reservation->hour, rsrv_params->hour, sizeof(reservation->hour));
-        reservation->table = table;
 
-        fwrite(reservation, sizeof(Reservation), 1, file);
-        fclose(file);
-        return 1;
+    // Map submission queue, completion queue and the submission entries
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    char *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        close(ring->fd);
+        return -1;
     }
+
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    return 0;
 }
 
-int findAvailableTables(MatchingTable matching_tab[], FindRequest *rsrv_params)
+struct io_uring_sqe *uringGetSqe(Uring *ring)
 {
-    int found_tab_nr = 0; // number of found matching tables for reservation request
-    int nr_people = roundToEven(rsrv_params->people);
+    // Submission queue is full, hand the queued entries to the kernel first
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        uringSubmit(ring, 0);
 
-    for (int i = 0; i < sizeof(ALL_TABLES) / sizeof(ALL_TABLES[0]); i++)
-    {
-        if (ALL_TABLES[i].nr_seats == nr_people)
-        {
-            int result = isTableReserved(ALL_TABLES[i].id, rsrv_params->date, rsrv_params->hour);
-            if (result == -1)
-            {
-                return -1; // return error
-            }
-            else if (result == 0)
-            {
-                matching_tab[found_tab_nr].table = &ALL_TABLES[i];
-                found_tab_nr++;
-            }
-        }
-    }
-    return found_tab_nr;
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
 }
 
-int saveOrder(Order *order)
+int uringSubmit(Uring *ring, unsigned wait_nr)
 {
-    FILE *file = fopen(ORDERS_FILE, "ab");
-    if (file == NULL)
-        return -1;
+    // All entries queued since the last call go to the kernel in one io_uring_enter
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
 
-    fwrite(order, sizeof(Order), 1, file);
-    fclose(file);
-    return 1;
+    int result;
+    do
+        result = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags, NULL, 0);
+    while (result < 0 && errno == EINTR && wait_nr == 0);
+    return result;
 }
 
-void printOrderStatusByTable(const char *table_id)
+void uringQueueAccept(Uring *ring, int server_sock, struct sockaddr_in *addr, socklen_t *addr_size)
 {
-    FILE *file = fopen(ORDERS_FILE, "rb");
-    if (file == NULL)
-        fprintf(stdout, "[ERROR] Cannot read the file\n");
+    struct io_uring_sqe *sqe = uringGetSqe(ring);
+    *addr_size = sizeof(*addr);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server_sock;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->addr2 = (uint64_t)(uintptr_t)addr_size;
+    sqe->user_data = URING_OP_ACCEPT;
+}
 
-    Order order;
-    int nr = 1;
-    while (fread(&order, sizeof(Order), 1, file) == 1)
+void uringQueueRecv(Uring *ring, Connection *conn)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(ring);
+    sqe->fd = conn->sock;
+    sqe->addr = (uint64_t)(uintptr_t)(conn->in + conn->in_len);
+    sqe->len = IN_BUFFER_SIZE - conn->in_len;
+    // Receive buffers of the connection pool are registered with the kernel
+    if (ring->fixed_buffers)
     {
-        if (strcmp(order.table_id, table_id) == 0)
-        {
-            fprintf(stdout, "%d) Order: %s, Status: %s\n", nr, order.order, order.status);
-            nr++;
-        }
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = conn->slot;
     }
+    else
+        sqe->opcode = IORING_OP_RECV;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_RECV;
+    conn->recv_pending = true;
+}
 
-    fclose(file);
+void uringQueueSend(Uring *ring, Connection *conn)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->sock;
+    sqe->addr = (uint64_t)(uintptr_t)(conn->sending.data + conn->out_sent);
+    sqe->len = conn->sending.len - conn->out_sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_SEND;
+    conn->send_pending = true;
 }
 
-void printOrderStatusByStatus(const char *status)
+void uringQueuePoll(Uring *ring, int fd, int op)
 {
-    FILE *file = fopen(ORDERS_FILE, "rb");
-    if (file == NULL)
-        fprintf(stdout, "[ERROR] Cannot read the file\n");
+    struct io_uring_sqe *sqe = uringGetSqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = op;
+}
 
-    Order order;
-    int nr = 1;
-    while (fread(&order, sizeof(Order), 1, file) == 1)
+bool uringProgress(Uring *ring, Connection *conn)
+{
+    // New replies are swapped in only when no send is in flight, so the kernel
+    // never reads from a buffer that consumeInput() may still grow
+    if (!conn->send_pending && conn->out_sent == conn->sending.len && conn->out.len > 0 && !walIsDurable(conn->session.commit_lsn))
+        waitForCommit(conn);
+    else if (!conn->send_pending && conn->out_sent == conn->sending.len && conn->out.len > 0)
     {
-        if (strcmp(order.status, status) == 0)
-        {
-            fprintf(stdout, "%d) Table: %s Course: %s Order: %s\n", nr, order.table_id, order.course, order.order);
-            nr++;
-        }
+        Reply swap = conn->sending;
+        conn->sending = conn->out;
+        conn->out = swap;
+        replyClear(&conn->out);
+        conn->out_sent = 0;
     }
+    if (!conn->send_pending && conn->out_sent < conn->sending.len)
+        uringQueueSend(ring, conn);
+    if (!conn->closing && !conn->recv_pending)
+        uringQueueRecv(ring, conn);
 
-    fclose(file);
+    if (!conn->closing)
+        return true;
+    // Wake up the pending receive so the connection can be released
+    if (conn->recv_pending && !conn->send_pending)
+        shutdown(conn->sock, SHUT_RD);
+    return conn->recv_pending || conn->send_pending;
 }
 
-void sendLongestWaitingOrder(int client_sock)
+void uringRelease(Connection *conn, int free_slots[], int *free_count)
 {
-    int found = 0;
-    char buffer[MAX_BUFFER_SIZE];
-    FILE *file = fopen(ORDERS_FILE, "rb");
-    if (file == NULL)
+    stopWaitingForCommit(conn);
+    unsubscribeConnection(conn);
+    unwatchTable(conn);
+    leaveStation(&conn->session);
+    releaseLease(&conn->session);
+    close(conn->sock);
+    replyFree(&conn->out);
+    replyFree(&conn->sending);
+    free_slots[(*free_count)++] = conn->slot;
+}
+
+void runUringLoop(int server_sock)
+{
+    Uring ring;
+    memset(&ring, 0, sizeof(ring));
+    if (uringSetup(&ring, URING_ENTRIES) < 0)
     {
-        found = -1;
-        send(client_sock, &found, sizeof(int), 0);
+        fprintf(stdout, "[-] io_uring is not available (%s), using epoll.\n", strerror(errno));
+        runEventLoop(server_sock);
+        return;
+    }
 
-        char error_msg[] = "[ERROR] Could not open file";
-        bzero(buffer, MAX_BUFFER_SIZE);
-        strcpy(buffer, error_msg);
-        send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-        fprintf(stdout, "[SERVER] %s\n", buffer);
+    // Connections come from a fixed pool whose receive buffers are registered once
+    Connection *pool = calloc(URING_MAX_CONNECTIONS, sizeof(Connection));
+    int *free_slots = calloc(URING_MAX_CONNECTIONS, sizeof(int));
+    struct iovec *buffers = calloc(URING_MAX_CONNECTIONS, sizeof(struct iovec));
+    int free_count = 0;
+    for (int i = URING_MAX_CONNECTIONS - 1; i >= 0; i--)
+    {
+        buffers[i].iov_base = pool[i].in;
+        buffers[i].iov_len = IN_BUFFER_SIZE;
+        free_slots[free_count++] = i;
     }
-    else
+    ring.fixed_buffers = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, buffers, URING_MAX_CONNECTIONS) == 0;
+    fprintf(stdout, "[+] Serving all connections from io_uring (%s buffers).\n", ring.fixed_buffers ? "registered" : "plain");
+
+    struct sockaddr_in accept_addr;
+    socklen_t accept_addr_size;
+    uringQueueAccept(&ring, server_sock, &accept_addr, &accept_addr_size);
+    uringQueuePoll(&ring, stop_event_fd, URING_OP_STOP);
+    int commit_fd = walAddListener();
+    uringQueuePoll(&ring, commit_fd, URING_OP_COMMIT);
+
+    while (server_running)
     {
-        Order order;
-        Order longest_waiting_order;
-        time_t longest_waiting_time = time(NULL);
+        if (uringSubmit(&ring, 1) < 0 && errno != EINTR)
+        {
+            perror("[-] io_uring error.\n");
+            break;
+        }
 
-        while (fread(&order, sizeof(Order), 1, file) == 1)
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
         {
-            if (strcmp(order.status, "waiting") == 0)
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            int op = cqe->user_data & URING_OP_MASK;
+            int result = cqe->res;
+            Connection *conn = (Connection *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+
+            if (op == URING_OP_STOP)
+            {
+                server_running = 0;
+                continue;
+            }
+            if (op == URING_OP_COMMIT)
             {
-                fprintf(stdout, "Order in waiting status: %s %s\n", order.table_id, order.course);
-                if (order.time < longest_waiting_time)
+                uint64_t commits;
+                read(commit_fd, &commits, sizeof(commits));
+                for (Connection *next, *waiter = commit_waiters; waiter != NULL; waiter = next)
                 {
-                    longest_waiting_time = order.time;
-                    longest_waiting_order = order;
-                    found = 1;
+                    next = waiter->commit_next;
+                    if (!walIsDurable(waiter->session.commit_lsn))
+                        continue;
+                    stopWaitingForCommit(waiter);
+                    if (!uringProgress(&ring, waiter))
+                        uringRelease(waiter, free_slots, &free_count);
                 }
+                // Subscribers of this loop get the events the commit made durable
+                for (Connection *next, *subscriber = feed_subscribers; subscriber != NULL; subscriber = next)
+                {
+                    next = subscriber->feed_next;
+                    if (subscriber->closing || collectKitchenEvents(&subscriber->session, &subscriber->out, KITCHEN_FEED_MAX_QUEUED) == 0)
+                        continue;
+                    if (!uringProgress(&ring, subscriber))
+                        uringRelease(subscriber, free_slots, &free_count);
+                }
+                // Table devices of this loop get the status changes of their reservation
+                Connection *changed[MAX_EPOLL_EVENTS];
+                int changed_count;
+                do
+                {
+                    changed_count = queueTableEvents(changed, MAX_EPOLL_EVENTS);
+                    for (int i = 0; i < changed_count; i++)
+                    {
+                        if (!uringProgress(&ring, changed[i]))
+                            uringRelease(changed[i], free_slots, &free_count);
+                    }
+                } while (changed_count == MAX_EPOLL_EVENTS);
+                uringQueuePoll(&ring, commit_fd, URING_OP_COMMIT);
+                continue;
+            }
+            if (op == URING_OP_ACCEPT)
+            {
+                if (result >= 0 && free_count == 0)
+                {
+                    fprintf(stdout, "[-] Connection limit reached, closing new connection.\n");
+                    close(result);
+                }
+                else if (result >= 0)
+                {
+                    int slot = free_slots[--free_count];
+                    conn = &pool[slot];
+                    memset(conn, 0, offsetof(Connection, in));
+                    memset(&conn->in_len, 0, sizeof(Connection) - offsetof(Connection, in_len));
+                    conn->sock = result;
+                    conn->slot = slot;
+                    conn->state = CONNECTION_AWAIT_COMMAND;
+                    conn->session.addr = accept_addr;
+                    fprintf(stdout, "[+] New connection accepted from: %s:%d.\n", inet_ntoa(accept_addr.sin_addr), ntohs(accept_addr.sin_port));
+                    uringProgress(&ring, conn);
+                }
+                if (server_running)
+                    uringQueueAccept(&ring, server_sock, &accept_addr, &accept_addr_size);
+                continue;
             }
-        }
 
-        fclose(file);
+            if (op == URING_OP_RECV)
+            {
+                conn->recv_pending = false;
+                if (result <= 0)
+                {
+                    if (!conn->closing)
+                        fprintf(stdout, "[+]Disconnected from: %s:%d\n", inet_ntoa(conn->session.addr.sin_addr), ntohs(conn->session.addr.sin_port));
+                    conn->closing = true;
+                }
+                else if (!conn->closing)
+                {
+                    conn->in_len += result;
+                    if (!consumeInput(conn))
+                        conn->closing = true;
+                }
+            }
+            else if (op == URING_OP_SEND)
+            {
+                conn->send_pending = false;
+                if (result < 0)
+                    conn->closing = true;
+                else
+                {
+                    conn->out_sent += result;
+                    if (conn->out_sent == conn->sending.len)
+                    {
+                        replyClear(&conn->sending);
+                        conn->out_sent = 0;
+                    }
+                }
+            }
 
-        send(client_sock, &found, sizeof(int), 0);
-        bzero(buffer, MAX_BUFFER_SIZE);
-        if (found == 0)
-        {
-            char no_order_msg[] = "There are no orders in \"waiting\" status";
-            strcpy(buffer, no_order_msg);
-        }
-        else if (found == 1)
-        {
-            // Send order to kitchen device
-            changeOrderStatus(longest_waiting_order.rsrv_code, longest_waiting_order.course, STATUS_PREPARING);
-            sprintf(buffer, "%d %s %s %s",
-                    longest_waiting_order.rsrv_code, longest_waiting_order.table_id,
-                    longest_waiting_order.course, longest_waiting_order.order);
+            if (!uringProgress(&ring, conn))
+                uringRelease(conn, free_slots, &free_count);
         }
-        send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-        fprintf(stdout, "[SERVER] %s\n", buffer);
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
     }
+
+    close(ring.fd);
+}
+#else
+void runUringLoop(int server_sock)
+{
+    fprintf(stdout, "[-] Server was built without io_uring support, using epoll.\n");
+    runEventLoop(server_sock);
 }
+#endif
 
-int changeOrderStatus(int rsrv_code, const char *course, const char *new_status)
+void runEventLoop(int server_sock)
 {
-    FILE *file = fopen("orders.bin", "rb+");
-    if (file == NULL)
-        return -1;
+    struct epoll_event event, events[MAX_EPOLL_EVENTS];
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+    {
+        perror("[-] Epoll error.\n");
+        exit(1);
+    }
 
-    Order order;
-    int changed = 0;
+    // Listening socket must never block the loop
+    fcntl(server_sock, F_SETFL, fcntl(server_sock, F_GETFL, 0) | O_NONBLOCK);
+    event.events = EPOLLIN;
+    event.data.ptr = &server_sock;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_sock, &event);
+
+    // Console thread wakes the loop through this descriptor on "stop"
+    event.events = EPOLLIN;
+    event.data.ptr = &stop_event_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_event_fd, &event);
 
-    while (fread(&order, sizeof(Order), 1, file) == 1)
+    // Commit thread wakes the loop through this descriptor when replies become sendable
+    int commit_fd = walAddListener();
+    event.events = EPOLLIN;
+    event.data.ptr = &commit_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, commit_fd, &event);
+    fprintf(stdout, "[+] Serving all connections from one event loop.\n");
+
+    while (server_running)
     {
-        if (order.rsrv_code == rsrv_code && strcmp(order.course, course) == 0)
+        int ready = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (ready < 0)
         {
-            strcpy(order.status, new_status);
-            fseek(file, -sizeof(Order), SEEK_CUR);
-            fwrite(&order, sizeof(Order), 1, file);
-            changed = 1;
+            if (errno == EINTR)
+                continue;
+            perror("[-] Epoll wait error.\n");
             break;
         }
-    }
-
-    fclose(file);
-    return changed ? 1 : 0;
-}
 
-void sendAllOrdersInPreparingStatus(int client_sock)
-{
-    int found = 0;
-    char buffer[MAX_BUFFER_SIZE];
-    FILE *file = fopen("orders.bin", "rb");
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.ptr == &stop_event_fd)
+                continue;
+            if (events[i].data.ptr == &commit_fd)
+            {
+                uint64_t commits;
+                read(commit_fd, &commits, sizeof(commits));
+                flushCommittedReplies(epoll_fd);
+                pushKitchenEvents(epoll_fd);
+                pushTableEvents(epoll_fd);
+                continue;
+            }
+            if (events[i].data.ptr == &server_sock)
+            {
+                acceptConnections(epoll_fd, server_sock);
+                continue;
+            }
+
+            Connection *conn = events[i].data.ptr;
+            bool keep_connection = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                keep_connection = readFromConnection(conn);
+            if (!keep_connection || !flushConnection(epoll_fd, conn))
+                closeConnection(epoll_fd, conn);
+        }
+    }
+
+    close(epoll_fd);
+}
+
+void runWorkerShards(int port, int workers)
+{
+    WorkerArgs *shards = calloc(workers, sizeof(WorkerArgs));
+    fprintf(stdout, "[+] Starting %d worker threads.\n", workers);
+
+    for (int i = 0; i < workers; i++)
+    {
+        shards[i].id = i;
+        shards[i].port = port;
+        pthread_create(&shards[i].thread, NULL, worker_shard, &shards[i]);
+    }
+    for (int i = 0; i < workers; i++)
+        pthread_join(shards[i].thread, NULL);
+
+    free(shards);
+}
+
+void *worker_shard(void *arg)
+{
+    WorkerArgs *shard = (WorkerArgs *)arg;
+
+    // The kernel spreads new connections over all listeners bound to the port,
+    // so a connection is accepted and served by the same thread on the same core
+    pinThreadToCore(shard->id);
+    int server_sock = createShardListener(shard->port);
+    fprintf(stdout, "[+] Worker %d listening.\n", shard->id);
+
+    runReactor(server_sock);
+    close(server_sock);
+    return NULL;
+}
+
+int createShardListener(int port)
+{
+    int server_sock, n;
+    struct sockaddr_in server_addr;
+
+    createSocket(&server_sock);
+    int reuse = 1;
+    if (setsockopt(server_sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+    {
+        perror("[-] SO_REUSEPORT error.\n");
+        exit(1);
+    }
+    prepareServerForConnections(&server_addr, &server_sock, "127.0.0.1", &port, &n);
+    return server_sock;
+}
+
+void pinThreadToCore(int core)
+{
+    cpu_set_t cpuset;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(core % (cores > 0 ? cores : 1), &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+        fprintf(stdout, "[-] Could not pin worker %d to a core\n", core);
+}
+
+void initSharedState()
+{
+    // Anonymous shared mapping survives fork(), so children use the same locks
+    shared = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        perror("[-] Shared memory error.\n");
+        exit(1);
+    }
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_rwlock_init(&shared->reservations_lock, &attr);
+    pthread_rwlock_init(&shared->orders_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->kitchen_lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    // Untouched pages of the index cost nothing, so it is sized for millions of reservations
+    reservation_index = mmap(NULL, sizeof(ReservationIndex), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation_index == MAP_FAILED)
+    {
+        perror("[-] Shared memory error.\n");
+        exit(1);
+    }
+
+    availability = mmap(NULL, sizeof(AvailabilityGrid), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (availability == MAP_FAILED)
+    {
+        perror("[-] Shared memory error.\n");
+        exit(1);
+    }
+    for (int i = 0; i < MAX_TABLES; i++)
+    {
+        if (ALL_TABLES[i].nr_seats <= MAX_TABLE_SEATS)
+            availability->by_seats[ALL_TABLES[i].nr_seats] |= (TableSet)1 << i;
+    }
+
+    kitchen_feed = mmap(NULL, sizeof(KitchenFeed), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (kitchen_feed == MAP_FAILED)
+    {
+        perror("[-] Shared memory error.\n");
+        exit(1);
+    }
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&kitchen_feed->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+}
+
+void acceptConnections(int epoll_fd, int server_sock)
+{
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t addr_size = sizeof(client_addr);
+        int client_sock = accept4(server_sock, (struct sockaddr *)&client_addr, &addr_size, SOCK_NONBLOCK);
+        if (client_sock < 0)
+            return;
+
+        Connection *conn = calloc(1, sizeof(Connection));
+        if (conn == NULL)
+        {
+            close(client_sock);
+            return;
+        }
+        conn->sock = client_sock;
+        conn->state = CONNECTION_AWAIT_COMMAND;
+        conn->session.addr = client_addr;
+        conn->events = EPOLLIN;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock, &event);
+        fprintf(stdout, "[+] New connection accepted from: %s:%d.\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+    }
+}
+
+bool readFromConnection(Connection *conn)
+{
+    // One recv per readiness event keeps a busy device from starving the others
+    ssize_t received = recv(conn->sock, conn->in + conn->in_len, IN_BUFFER_SIZE - conn->in_len, 0);
+    if (received == 0)
+    {
+        fprintf(stdout, "[+]Disconnected from: %s:%d\n", inet_ntoa(conn->session.addr.sin_addr), ntohs(conn->session.addr.sin_port));
+        return false;
+    }
+    if (received < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    conn->in_len += received;
+    return consumeInput(conn);
+}
+
+bool consumeInput(Connection *conn)
+{
+    size_t used = 0;
+    bool keep_connection = true;
+
+    // Every complete request already received is handled in order, so pipelined
+    // requests are answered in the order the device sent them
+    while (keep_connection)
+    {
+        size_t available = conn->in_len - used;
+        if (conn->state == CONNECTION_AWAIT_COMMAND)
+        {
+            char command[MAX_COMMAND_SIZE + 1];
+            if (available < MAX_COMMAND_SIZE)
+                break;
+            bzero(command, sizeof(command));
+            memcpy(command, conn->in + used, MAX_COMMAND_SIZE);
+            used += MAX_COMMAND_SIZE;
+
+            if (negotiateProtocol(&conn->session, command, &conn->out))
+            {
+                conn->state = CONNECTION_AWAIT_FRAME;
+                continue;
+            }
+            conn->type = protocolCommandType(command);
+            if (protocolLegacyPayloadSize(conn->type) > 0)
+                conn->state = CONNECTION_AWAIT_PAYLOAD;
+            else
+                keep_connection = dispatchRequest(&conn->session, conn->type, 0, NULL, 0, &conn->out);
+        }
+        else if (conn->state == CONNECTION_AWAIT_PAYLOAD)
+        {
+            size_t payload_len = protocolLegacyPayloadSize(conn->type);
+            if (available < payload_len)
+                break;
+            keep_connection = dispatchRequest(&conn->session, conn->type, 0, conn->in + used, payload_len, &conn->out);
+            used += payload_len;
+            conn->state = CONNECTION_AWAIT_COMMAND;
+        }
+        else
+        {
+            uint32_t body_len, request_id;
+            uint16_t type;
+            if (available < FRAME_HEADER_SIZE)
+                break;
+            protocolGetHeader(conn->in + used, &body_len, &type, &request_id);
+            if (body_len > MAX_REQUEST_BODY)
+            {
+                fprintf(stdout, "[ERROR] Frame of %u bytes is too large\n", body_len);
+                keep_connection = false;
+                break;
+            }
+            if (available < FRAME_HEADER_SIZE + body_len)
+                break;
+            keep_connection = handleFrame(&conn->session, type, request_id, conn->in + used + FRAME_HEADER_SIZE, body_len, &conn->out);
+            used += FRAME_HEADER_SIZE + body_len;
+        }
+    }
+
+    memmove(conn->in, conn->in + used, conn->in_len - used);
+    conn->in_len -= used;
+
+    // A subscribed device gets the kitchen events from the loop serving it
+    if (conn->session.subscribed && !conn->feed_listed)
+        subscribeConnection(conn);
+    if (conn->session.watching && !conn->table_listed)
+        watchTable(conn);
+    return keep_connection;
+}
+
+bool writeToConnection(Connection *conn)
+{
+    while (conn->out_sent < conn->out.len)
+    {
+        ssize_t sent = send(conn->sock, conn->out.data + conn->out_sent, conn->out.len - conn->out_sent, 0);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn->out_sent += sent;
+    }
+
+    replyClear(&conn->out);
+    conn->out_sent = 0;
+    return true;
+}
+
+bool flushConnection(int epoll_fd, Connection *conn)
+{
+    // A reply leaves only once the log records it reports on are durable
+    bool queued = conn->out.len > conn->out_sent;
+    if (queued && !walIsDurable(conn->session.commit_lsn))
+        waitForCommit(conn);
+    else if (queued && !writeToConnection(conn))
+        return false;
+
+    // Wait for writability only while part of a durable reply is still queued
+    uint32_t events = conn->out.len > conn->out_sent && !conn->awaiting_commit ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    if (events != conn->events)
+    {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = conn;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->sock, &event);
+        conn->events = events;
+    }
+    return true;
+}
+
+void flushCommittedReplies(int epoll_fd)
+{
+    for (Connection *next, *conn = commit_waiters; conn != NULL; conn = next)
+    {
+        next = conn->commit_next;
+        if (!walIsDurable(conn->session.commit_lsn))
+            continue;
+        stopWaitingForCommit(conn);
+        if (!flushConnection(epoll_fd, conn))
+            closeConnection(epoll_fd, conn);
+    }
+}
+
+void waitForCommit(Connection *conn)
+{
+    if (conn->awaiting_commit)
+        return;
+    conn->awaiting_commit = true;
+    conn->commit_prev = NULL;
+    conn->commit_next = commit_waiters;
+    if (commit_waiters != NULL)
+        commit_waiters->commit_prev = conn;
+    commit_waiters = conn;
+}
+
+void stopWaitingForCommit(Connection *conn)
+{
+    if (!conn->awaiting_commit)
+        return;
+    if (conn->commit_prev != NULL)
+        conn->commit_prev->commit_next = conn->commit_next;
+    else
+        commit_waiters = conn->commit_next;
+    if (conn->commit_next != NULL)
+        conn->commit_next->commit_prev = conn->commit_prev;
+    conn->awaiting_commit = false;
+}
+
+void closeConnection(int epoll_fd, Connection *conn)
+{
+    stopWaitingForCommit(conn);
+    unsubscribeConnection(conn);
+    unwatchTable(conn);
+    leaveStation(&conn->session);
+    releaseLease(&conn->session);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock, NULL);
+    close(conn->sock);
+    replyFree(&conn->out);
+    free(conn);
+}
+
+void stopServer(int server_sock)
+{
+    server_running = 0;
+
+    // Wake up the accept loop (fork mode) or the event loop (epoll mode)
+    shutdown(server_sock, SHUT_RDWR);
+    if (stop_event_fd >= 0)
+    {
+        uint64_t one = 1;
+        write(stop_event_fd, &one, sizeof(one));
+    }
+}
+
+bool negotiateProtocol(Session *session, const char *command, Reply *reply)
+{
+    int version = protocolHelloVersion(command);
+    if (version < PROTOCOL_MIN_VERSION)
+        return false;
+
+    // Answer with the newest version both sides speak
+    char hello[PROTOCOL_HELLO_SIZE];
+    session->version = version < PROTOCOL_VERSION ? version : PROTOCOL_VERSION;
+    protocolMakeHello(hello, session->version);
+    replyBytes(reply, hello, PROTOCOL_HELLO_SIZE);
+    fprintf(stdout, "[+] %s:%d switched to framed protocol v%d\n", inet_ntoa(session->addr.sin_addr), ntohs(session->addr.sin_port), session->version);
+    return true;
+}
+
+bool dispatchRequest(Session *session, int type, uint32_t request_id, const char *payload, size_t payload_len, Reply *reply)
+{
+    replyBegin(reply, session->version, type, request_id);
+    wal_last_lsn = 0;
+    bool keep_connection = handleCommand(session, type, payload, payload_len, reply);
+    replyEnd(reply);
+    if (wal_last_lsn > session->commit_lsn)
+        session->commit_lsn = wal_last_lsn;
+    return keep_connection;
+}
+
+bool handleFrame(Session *session, uint16_t type, uint32_t request_id, const char *body, uint32_t body_len, Reply *reply)
+{
+    // Table choice arrives as a big endian u32, handlers expect a host int
+    if (type == MSG_BOOK)
+    {
+        uint32_t net_choice = 0;
+        memcpy(&net_choice, body, body_len < sizeof(net_choice) ? body_len : sizeof(net_choice));
+        int choice = ntohl(net_choice);
+        return dispatchRequest(session, type, request_id, (const char *)&choice, sizeof(choice), reply);
+    }
+    return dispatchRequest(session, type, request_id, body, body_len, reply);
+}
+
+bool handleCommand(Session *session, int type, const char *payload, size_t payload_len, Reply *reply)
+{
+    // Parameters are handled as a NULL terminated string
+    char text[MAX_BUFFER_SIZE + 1];
+    bzero(text, sizeof(text));
+    if (payload != NULL)
+        memcpy(text, payload, payload_len);
+
+    // Handle reviced command
+    fprintf(stdout, "[COMMAND] %s\n", protocolCommandName(type));
+
+    // Handle client commands
+    if (type == MSG_FIND)
+        handleFind(session, text, reply);
+    else if (type == MSG_BOOK)
+        handleBook(session, text, reply);
+    // Handle table commands
+    else if (type == MSG_CHECK)
+        handleCheck(session, text, reply);
+    else if (type == MSG_ORDER)
+        handleOrder(session, text, reply);
+    else if (type == MSG_BILL)
+    {
+        // Get total value and send it to Table, it is kept per reservation by the server
+        int32_t bill = readBill(session);
+        replyInt(reply, bill);
+        fprintf(stdout, "[SERVER SEND] Total bill value: %d\n", bill);
+    }
+    // Handle kitchen device commands
+    else if (type == MSG_TAKE)
+    {
+        // Take the longest waiting orders and change their status
+        sendWaitingOrders(session, text, false, reply);
+    }
+    else if (type == MSG_COOK_BATCH)
+        sendWaitingOrders(session, text, true, reply);
+    else if (type == MSG_READY)
+        handleReady(session, text, reply);
+    else if (type == MSG_SHOW)
+        sendAllOrdersInPreparingStatus(reply);
+    else if (type == MSG_SLOTS)
+        handleSlots(text, reply);
+    else if (type == MSG_GRID)
+        handleGrid(text, reply);
+    else if (type == MSG_FEED)
+        handleFeed(session, reply);
+    else if (type == MSG_SERVE)
+        handleServe(session, text, reply);
+    else if (type == MSG_RENEW)
+        handleRenew(session, reply);
+    else if (type == MSG_WATCH)
+        handleWatch(session, reply);
+    else if (type == MSG_ESC)
+    {
+        fprintf(stdout, "[+]Disconnected from: %s:%d\n", inet_ntoa(session->addr.sin_addr), ntohs(session->addr.sin_port));
+        return false;
+    }
+    else
+        fprintf(stdout, "[-] Wrong command recived!\n");
+
+    return true;
+}
+
+void handleFind(Session *session, const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    FindRequest *reserv_params = &session->reserv_params;
+
+    // Recive detailed reservation request from client
+    fprintf(stdout, "[CLIENT] %s\n", payload);
+
+    // Write infromation from buffer to the FindRequest struct
+    bzero(reserv_params, sizeof(FindRequest));
+    sscanf(payload, "%19s %d %19s %19s", reserv_params->surname, &reserv_params->people, reserv_params->date, reserv_params->hour);
+    reserv_params->start = parseReservationStart(reserv_params->date, reserv_params->hour);
+
+    // Find avaible tables
+    int result = findAvailableTables(session->matching_tab, reserv_params);
+    session->found_tables = result > 0 ? result : 0;
+
+    replyInt(reply, result);
+    // Error occurred while finding available tables
+    if (result <= 0)
+    {
+        bzero(buffer, MAX_BUFFER_SIZE);
+        if (result < 0)
+        {
+            char error_msg[] = "[ERROR] Please give the date as DD-MM-YYYY and the hour as HH or HH:MM";
+            strcpy(buffer, error_msg);
+        }
+        else
+        {
+            char no_found_msg[] = "Sorry! All tables are reserved. Please try different data/hour.";
+            strcpy(buffer, no_found_msg);
+        }
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER]%s\n", buffer);
+    }
+    // Send found available tables
+    else
+    {
+        for (int k = 0; k < result; k++)
+        {
+            bzero(buffer, MAX_BUFFER_SIZE);
+            sprintf(buffer, "%s %s %s", session->matching_tab[k].table->id, session->matching_tab[k].table->room, session->matching_tab[k].table->place_desc);
+            replyText(reply, buffer);
+        }
+        fprintf(stdout, "[SERVER] Available tables send to client\n");
+    }
+}
+
+void handleBook(Session *session, const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+
+    // Recive client reservation choice
+    int choice;
+    memcpy(&choice, payload, sizeof(int));
+    fprintf(stdout, "[CLIENT] %d\n", choice);
+
+    // Book table for given client choice
+    Reservation reservation;
+    int result;
+    bzero(buffer, MAX_BUFFER_SIZE);
+    if (choice < 1 || choice > session->found_tables)
+    {
+        result = -1;
+        char choice_error_msg[] = "[ERROR] Wrong table choice, please find available tables first";
+        strcpy(buffer, choice_error_msg);
+        fprintf(stdout, "[SERVER]%s\n", choice_error_msg);
+    }
+    else
+    {
+        result = addReservation(&session->reserv_params, session->matching_tab[choice - 1].table, &reservation);
+        // Error occurred while finding available tables
+        if (result < 0)
+        {
+            char error_msg[] = "[ERROR] Could not open file";
+            strcpy(buffer, error_msg);
+            fprintf(stdout, "[SERVER]%s\n", error_msg);
+        }
+        // Table was booked by another device after the find
+        else if (result == 0)
+        {
+            result = -1;
+            char taken_msg[] = "[ERROR] Table was just booked by someone else, please find again";
+            strcpy(buffer, taken_msg);
+            fprintf(stdout, "[SERVER]%s\n", taken_msg);
+        }
+        // Send reservation confirmation to client
+        else
+        {
+            session->found_tables = 0;
+            sprintf(buffer, "%d %s %s", reservation.code, ALL_TABLES[reservation.table].room, ALL_TABLES[reservation.table].id);
+            fprintf(stdout, "[SERVER]Reservation details: %s\n", buffer);
+        }
+    }
+
+    replyInt(reply, result);
+    replyText(reply, buffer);
+}
+
+void handleSlots(const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE], date[20] = "";
+    int people = 0, free_tables[SLOTS_PER_DAY];
+
+    // Recive the party size and the date to search
+    fprintf(stdout, "[CLIENT] %s\n", payload);
+    sscanf(payload, "%d %19s", &people, date);
+
+    int result = findFreeSlots(people, date, free_tables);
+    replyInt(reply, result);
+    if (result <= 0)
+    {
+        bzero(buffer, MAX_BUFFER_SIZE);
+        if (result < 0)
+            strcpy(buffer, "[ERROR] Please give the number of people and a date as DD-MM-YYYY");
+        else
+            strcpy(buffer, "Sorry! All tables are reserved on this day.");
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER]%s\n", buffer);
+        return;
+    }
+
+    // One line for every slot with a free table
+    for (int slot = 0; slot < SLOTS_PER_DAY; slot++)
+    {
+        if (free_tables[slot] == 0)
+            continue;
+        bzero(buffer, MAX_BUFFER_SIZE);
+        sprintf(buffer, "%02d:%02d %d", slot * SLOT_MINUTES / 60, slot * SLOT_MINUTES % 60, free_tables[slot]);
+        replyText(reply, buffer);
+    }
+    fprintf(stdout, "[SERVER] Free slots send to client\n");
+}
+
+void handleGrid(const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    char first_date[20] = "", last_date[20] = "", first_hour[20] = "", last_hour[20] = "";
+    int people = 0, free_tables[GRID_MAX_DAYS][SLOTS_PER_DAY];
+
+    // Recive the party size, the dates and the hours to search, both ends included
+    fprintf(stdout, "[CLIENT] %s\n", payload);
+    sscanf(payload, "%d %19s %19s %19s %19s", &people, first_date, last_date, first_hour, last_hour);
+    int first_day = parseReservationDay(first_date);
+    int last_day = parseReservationDay(last_date);
+    int first_minute = parseReservationMinute(first_hour);
+    int last_minute = parseReservationMinute(last_hour);
+
+    int result = -1;
+    int days = last_day - first_day + 1;
+    int slots = last_minute / SLOT_MINUTES - first_minute / SLOT_MINUTES + 1;
+    if (first_day >= 0 && last_day >= 0 && first_minute >= 0 && last_minute >= 0 && days >= 1 && days <= GRID_MAX_DAYS && slots >= 1)
+        result = findFreeGrid(people, first_day, days, first_minute / SLOT_MINUTES, slots, free_tables);
+    if (result <= 0)
+    {
+        bzero(buffer, MAX_BUFFER_SIZE);
+        if (result < 0)
+            sprintf(buffer, "[ERROR] Please give the number of people, two dates as DD-MM-YYYY at most %d days apart and two hours as HH or HH:MM", GRID_MAX_DAYS - 1);
+        else
+            strcpy(buffer, "Sorry! All tables are reserved at these dates and hours.");
+        replyInt(reply, result);
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER]%s\n", buffer);
+        return;
+    }
+
+    // The whole grid goes in one reply: the hours, then one line per date with the free tables of every hour
+    replyInt(reply, days);
+    int length = 0;
+    for (int slot = 0; slot < slots; slot++)
+    {
+        int minute = (first_minute / SLOT_MINUTES + slot) * SLOT_MINUTES;
+        length += sprintf(buffer + length, "%s%02d:%02d", slot > 0 ? " " : "", minute / 60, minute % 60);
+    }
+    replyText(reply, buffer);
+    for (int day = 0; day < days; day++)
+    {
+        char date[11], hour[6];
+        formatReservationStart((uint32_t)(first_day + day) * MINUTES_PER_DAY, date, hour);
+        length = sprintf(buffer, "%s", date);
+        for (int slot = 0; slot < slots; slot++)
+            length += sprintf(buffer + length, " %d", free_tables[day][slot]);
+        replyText(reply, buffer);
+    }
+    fprintf(stdout, "[SERVER] Grid of %d dates and %d hours with %d free slots send to client\n", days, slots, result);
+}
+
+void handleCheck(Session *session, const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    char surname[20];
+    int code = 0;
+
+    // Recive surname and code from client to login to table
+    bzero(surname, sizeof(surname));
+    sscanf(payload, "%19s %d", surname, &code);
+    fprintf(stdout, "[TABLE] Surname: %s code:%d\n", surname, code);
+
+    // Check if there is reservation for given surname and code
+    Reservation reservation;
+    int result;
+    uint32_t position = 0;
+    result = findReservation(surname, code, &reservation, &position);
+
+    replyInt(reply, result);
+    bzero(buffer, MAX_BUFFER_SIZE);
+    // Error occurred while finding available tables
+    if (result < 0)
+    {
+        char error_msg[] = "[[ERROR] Could not open file";
+        strcpy(buffer, error_msg);
+    }
+    else if (result == 0)
+    {
+        char wrong_creds[] = "[ERROR] No reservation found.";
+        strcpy(buffer, wrong_creds);
+    }
+    else
+    {
+        char date[11], hour[6];
+        session->reservation = reservation;
+        session->bill_record = position;
+        formatReservationStart(reservation.start, date, hour);
+        sprintf(buffer, "%s %s %s", ALL_TABLES[reservation.table].id, date, hour);
+    }
+    replyText(reply, buffer);
+    fprintf(stdout, "[SERVER] %s\n", buffer);
+}
+
+void handleOrder(Session *session, const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    Order order;
+    bzero(&order, sizeof(order));
+
+    // Recive order from Table, the dishes are parsed straight from the request
+    int dishes_at = 0;
+    sscanf(payload, "Course: %4s Order: %n", order.course, &dishes_at);
+    int items = dishes_at > 0 ? parseOrderItems(payload + dishes_at, MAX_BUFFER_SIZE - dishes_at, &order) : -1;
+    fprintf(stdout, "[TABLE]Course: %s Order: %.*s\n", order.course, (int)strcspn(payload + dishes_at, "\n"), payload + dishes_at);
+
+    bzero(buffer, MAX_BUFFER_SIZE);
+    if (session->reservation.code == 0)
+    {
+        char no_reservation_msg[] = "[ERROR] Table is not checked in with a reservation";
+        strcpy(buffer, no_reservation_msg);
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER] %s\n", buffer);
+        return;
+    }
+    if (items <= 0)
+    {
+        sprintf(buffer, "[ERROR] Order dishes as CODE-QUANTITY, e.g. A1-2 D2-1, at most %d different dishes", MAX_ORDER_ITEMS);
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER] %s\n", buffer);
+        return;
+    }
+
+    // Fill missing Order information
+    order.rsrv_code = session->reservation.code;
+    order.reservation = session->bill_record;
+    order.table = session->reservation.table;
+    order.status = ORDER_WAITING;
+    order.time = time(NULL);
+
+    // Count value of the order
+    order.value = countReceipt(&order);
+
+    // Save order, the bill of the reservation grows with it
+    int result;
+    result = saveOrder(&order, session->bill_record);
+    if (result < 0)
+    {
+        char full_msg[] = "[ERROR] The order store is full until the server restarts";
+        strcpy(buffer, full_msg);
+    }
+    else
+    {
+        char success_msg[] = "Order was successfully saved!";
+        strcpy(buffer, success_msg);
+    }
+    replyText(reply, buffer);
+    fprintf(stdout, "[SERVER] %s\n", buffer);
+}
+
+void handleReady(Session *session, const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    int results[MAX_TAKE_BATCH];
+    int pairs = 0, offset = 0;
+
+    // Orders come as "rsrv_code course" pairs, a batch is changed under one hold of the lock;
+    // text that is no pair still gets one answer
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    while (pairs < MAX_TAKE_BATCH)
+    {
+        int rsrv_code = 0, length = 0;
+        char course[5];
+        bzero(course, sizeof(course));
+        if (sscanf(payload + offset, "%d %4s%n", &rsrv_code, course, &length) < 2 && pairs > 0)
+            break;
+        fprintf(stdout, "[KD] Rsrv Code: %d Course: %s\n", rsrv_code, course);
+
+        // Change order status
+        results[pairs++] = changeOrderStatus(rsrv_code, course, ORDER_SERVED);
+        if (length == 0)
+            break;
+        offset += length;
+    }
+    pthread_rwlock_unlock(&shared->orders_lock);
+
+    // Marking orders ready shows the device is alive as well as a heartbeat does
+    renewLease(session);
+
+    // One answer per order, in the order of the request
+    for (int i = 0; i < pairs; i++)
+    {
+        bzero(buffer, MAX_BUFFER_SIZE);
+        if (results[i] < 0)
+        {
+            char file_error_msg[] = "[ERROR] Could not open file";
+            strcpy(buffer, file_error_msg);
+        }
+        else if (results[i] == 0)
+        {
+            char change_error_msg[] = "[ERROR] Status was not change";
+            strcpy(buffer, change_error_msg);
+        }
+        else
+        {
+            char success_msg[] = "Status was succesfully changed to \"served\"";
+            strcpy(buffer, success_msg);
+        }
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER] %s\n", buffer);
+    }
+}
+
+void handleFeed(Session *session, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    int result = 0;
+
+    bzero(buffer, MAX_BUFFER_SIZE);
+    if (session->version == PROTOCOL_LEGACY)
+    {
+        // Legacy replies carry no request id, so a pushed event could not be told apart
+        char legacy_error_msg[] = "[ERROR] The kitchen feed needs the framed protocol";
+        strcpy(buffer, legacy_error_msg);
+    }
+    else
+    {
+        // Events after the last published one are pushed; subscribing again changes nothing
+        if (!session->subscribed)
+            session->feed_sequence = __atomic_load_n(&kitchen_feed->published, __ATOMIC_ACQUIRE);
+        session->subscribed = true;
+        result = 1;
+        sprintf(buffer, "Following the kitchen feed, %u orders are waiting", __atomic_load_n(&order_index->status_count[ORDER_WAITING], __ATOMIC_RELAXED));
+    }
+    replyInt(reply, result);
+    replyText(reply, buffer);
+    fprintf(stdout, "[SERVER] %s\n", buffer);
+}
+
+void handleServe(Session *session, const char *payload, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE], list[STATION_COURSES * MAX_COURSE_LENGTH];
+    char courses[STATION_COURSES][MAX_COURSE_LENGTH];
+    int count = 0, offset = 0, length = 0, result = 0;
+
+    // Course codes separated by spaces, a code given twice counts once
+    bzero(courses, sizeof(courses));
+    list[0] = '\0';
+    while (count < STATION_COURSES && sscanf(payload + offset, "%4s%n", courses[count], &length) == 1)
+    {
+        offset += length;
+        bool repeated = false;
+        for (int i = 0; i < count; i++)
+            repeated = repeated || strcmp(courses[i], courses[count]) == 0;
+        if (repeated)
+            continue;
+        sprintf(list + strlen(list), "%s%s", count > 0 ? " " : "", courses[count]);
+        count++;
+    }
+    if (count < STATION_COURSES)
+        bzero(courses[count], sizeof(courses[count]));
+
+    // A kitchen device serves one station at a time
+    leaveStation(session);
+    bzero(buffer, MAX_BUFFER_SIZE);
+    if (count == 0)
+    {
+        result = 1;
+        strcpy(buffer, "Kitchen device serves every course");
+    }
+    else
+    {
+        pthread_rwlock_rdlock(&shared->orders_lock);
+        pthread_mutex_lock(&shared->kitchen_lock);
+        int queue = joinStation(courses, count);
+        uint32_t waiting = queue > 0 ? order_index->queue_count[queue] : 0;
+        uint32_t devices = queue > 0 ? order_index->stations[queue - 1].devices : 0;
+        pthread_mutex_unlock(&shared->kitchen_lock);
+        pthread_rwlock_unlock(&shared->orders_lock);
+
+        if (queue == -1)
+            sprintf(buffer, "[ERROR] A course of %s is served by another station", list);
+        else if (queue == -2)
+            sprintf(buffer, "[ERROR] All %d kitchen stations are taken", KITCHEN_STATIONS);
+        else
+        {
+            result = 1;
+            session->station = queue;
+            sprintf(buffer, "Station %d serves courses %s with %u devices, %u orders are waiting", queue, list, devices, waiting);
+        }
+    }
+    replyInt(reply, result);
+    replyText(reply, buffer);
+    fprintf(stdout, "[SERVER] %s\n", buffer);
+}
+
+void handleRenew(Session *session, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    bzero(buffer, MAX_BUFFER_SIZE);
+
+    // Heartbeat of a kitchen device holding orders, a device that misses them for the
+    // lease time has its orders put back in the queue
+    int held = renewLease(session);
+    if (held < 0)
+    {
+        sprintf(buffer, "[ERROR] No heartbeat for %u seconds, the taken orders went back to the waiting queue", order_index->lease_seconds);
+        fprintf(stdout, "[SERVER] %s\n", buffer);
+    }
+    else
+        sprintf(buffer, "Holding %d orders for %u more seconds", held, order_index->lease_seconds);
+    replyInt(reply, held);
+    replyText(reply, buffer);
+}
+
+void handleWatch(Session *session, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    int result = 0;
+
+    bzero(buffer, MAX_BUFFER_SIZE);
+    if (session->version == PROTOCOL_LEGACY)
+    {
+        // Legacy replies carry no request id, so a pushed event could not be told apart
+        char legacy_error_msg[] = "[ERROR] Order notifications need the framed protocol";
+        strcpy(buffer, legacy_error_msg);
+    }
+    else if (session->reservation.code == 0)
+    {
+        char check_error_msg[] = "[ERROR] Check in with a reservation first";
+        strcpy(buffer, check_error_msg);
+    }
+    else
+    {
+        // Changes after the last published event are pushed; watching again changes nothing
+        if (!session->watching)
+            session->table_sequence = __atomic_load_n(&kitchen_feed->published, __ATOMIC_ACQUIRE);
+        session->watching = true;
+        result = 1;
+        sprintf(buffer, "The table is told when the kitchen starts and serves the orders of reservation %d", session->reservation.code);
+    }
+    replyInt(reply, result);
+    replyText(reply, buffer);
+    fprintf(stdout, "[SERVER] %s\n", buffer);
+}
+
+int isTableReserved(int table, uint32_t start)
+{
+    // Caller must hold reservations_lock
+    DayAvailability *availability_day = findDay(start / MINUTES_PER_DAY, false);
+    return availability_day != NULL && (availability_day->reserved[start % MINUTES_PER_DAY / SLOT_MINUTES] >> table & 1);
+}
+
+int findReservation(const char *surname, int code, Reservation *reservation, uint32_t *position)
+{
+    int found = 0;
+    pthread_rwlock_rdlock(&shared->reservations_lock);
+    uint32_t bucket = hashReservationCode(code, surname) & (RESERVATION_INDEX_BUCKETS - 1);
+    for (uint32_t i = reservation_index->by_code[bucket]; i != 0; i = reservation_index->records[i].next_by_code)
+    {
+        Reservation *foundReservation = &reservation_index->records[i].reservation;
+        if (foundReservation->code == code && strcmp(foundReservation->surname, surname) == 0)
+        {
+            *reservation = *foundReservation;
+            *position = reservation_index->records[i].position;
+            found = 1;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&shared->reservations_lock);
+    return found;
+}
+
+void loadReservationIndex()
+{
+    int fd = openRecordFile(RESERVATIONS_FILE, RESERVATIONS_MAGIC, sizeof(Reservation));
+    FILE *file = fdopen(fd, "rb");
+    fseek(file, sizeof(FileHeader), SEEK_SET);
+
+    // Read the file in large chunks, it is only scanned once at startup
+    Reservation *chunk = malloc(4096 * sizeof(Reservation));
+    size_t read;
+    while ((read = fread(chunk, sizeof(Reservation), 4096, file)) > 0)
+    {
+        for (size_t i = 0; i < read; i++, reservation_index->file_records++)
+        {
+            if (chunk[i].table >= MAX_TABLES || !markReserved(&chunk[i]))
+                reservation_index->skipped++;
+            else if (!indexReservation(&chunk[i], reservation_index->file_records))
+                break;
+        }
+    }
+    free(chunk);
+    fclose(file);
+
+    fprintf(stdout, "[+] Loaded %u reservations.\n", reservation_index->count);
+    if (reservation_index->skipped > 0)
+        fprintf(stdout, "[-] Skipped %u reservations of unknown tables or dates beyond the grid.\n", reservation_index->skipped);
+}
+
+bool indexReservation(const Reservation *reservation, uint32_t position)
+{
+    // Caller must hold reservations_lock for writing (or be the only thread)
+    if (reservation_index->count >= RESERVATION_INDEX_CAPACITY)
+    {
+        fprintf(stdout, "[ERROR] Reservation index is full\n");
+        return false;
+    }
+
+    uint32_t number = ++reservation_index->count;
+    IndexedReservation *record = &reservation_index->records[number];
+    uint32_t code_bucket = hashReservationCode(reservation->code, reservation->surname) & (RESERVATION_INDEX_BUCKETS - 1);
+
+    record->reservation = *reservation;
+    record->position = position;
+    record->next_by_code = reservation_index->by_code[code_bucket];
+    reservation_index->by_code[code_bucket] = number;
+    return true;
+}
+
+void loadBills()
+{
+    bills_fd = openRecordFile(BILLS_FILE, BILLS_MAGIC, sizeof(int32_t));
+    struct stat file_stat;
+    if (fstat(bills_fd, &file_stat) < 0)
+    {
+        perror("[-] Cannot open bills file.\n");
+        exit(1);
+    }
+
+    // Like orders, the mapping is reserved for every reservation the index can hold
+    bills_map = mmap(NULL, sizeof(FileHeader) + (size_t)RESERVATION_INDEX_CAPACITY * sizeof(int32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, bills_fd, 0);
+    if (bills_map == MAP_FAILED)
+    {
+        perror("[-] Cannot map bills file.\n");
+        exit(1);
+    }
+    bills = (int32_t *)(bills_map + sizeof(FileHeader));
+
+    // Reservations made before the file existed, or just before a crash, have no entry yet
+    uint32_t entries = (file_stat.st_size - sizeof(FileHeader)) / sizeof(int32_t);
+    if (entries < reservation_index->file_records)
+        rebuildBills(entries);
+    else if (entries > reservation_index->file_records)
+        ftruncate(bills_fd, sizeof(FileHeader) + (off_t)reservation_index->file_records * sizeof(int32_t));
+}
+
+void rebuildBills(uint32_t first)
+{
+    if (ftruncate(bills_fd, sizeof(FileHeader) + (off_t)reservation_index->file_records * sizeof(int32_t)) < 0)
+    {
+        perror("[-] Cannot grow bills file.\n");
+        exit(1);
+    }
+
+    // Every order knows the position of its reservation, so live and archived orders are read once
+    for (uint32_t slot = 0; slot < order_index->count; slot++)
+    {
+        if (orders[slot].rsrv_code != 0)
+            addOrderToBill(&orders[slot], first);
+    }
+    Order archived;
+    ArchiveBlock block;
+    for (off_t offset = sizeof(FileHeader); offset < archive_end; offset += sizeof(block) + (off_t)block.count * sizeof(Order))
+    {
+        if (pread(archive_fd, &block, sizeof(block), offset) != sizeof(block))
+            break;
+        for (uint32_t i = 0; i < block.count; i++)
+        {
+            if (pread(archive_fd, &archived, sizeof(archived), offset + sizeof(block) + (off_t)i * sizeof(Order)) == sizeof(archived))
+                addOrderToBill(&archived, first);
+        }
+    }
+    fprintf(stdout, "[+] Rebuilt the bills of %u reservations from %s and %s.\n", reservation_index->file_records - first, ORDERS_FILE, ORDERS_ARCHIVE_FILE);
+}
+
+void addOrderToBill(const Order *order, uint32_t first)
+{
+    // Bills before first are complete; an order without a known reservation is billed to none
+    if (order->reservation >= first && order->reservation < reservation_index->file_records)
+        bills[order->reservation] += order->value;
+}
+
+int32_t readBill(const Session *session)
+{
+    if (session->reservation.code == 0)
+        return 0;
+    return __atomic_load_n(&bills[session->bill_record], __ATOMIC_ACQUIRE);
+}
+
+uint32_t hashReservationCode(int code, const char *surname)
+{
+    uint32_t hash = hashBytes(FNV_OFFSET, &code, sizeof(code));
+    return hashBytes(hash, surname, strlen(surname));
+}
+
+uint32_t hashBytes(uint32_t hash, const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+int addReservation(FindRequest *rsrv_params, Table *table, Reservation *reservation)
+{
+    int table_number = table - ALL_TABLES;
+    pthread_rwlock_wrlock(&shared->reservations_lock);
+
+    // Another device may have booked the table since it was offered
+    if (isTableReserved(table_number, rsrv_params->start))
+    {
+        pthread_rwlock_unlock(&shared->reservations_lock);
+        return 0;
+    }
+
+    // Both in-memory structures must have room before the record reaches the file; the date
+    // is only added to the grid by markReserved, once the record is written
+    bool has_day = findDay(rsrv_params->start / MINUTES_PER_DAY, false) != NULL || availability->used < AVAILABILITY_DAYS / 2;
+    bool has_room = reservation_index->count < RESERVATION_INDEX_CAPACITY && has_day;
+    FILE *file = has_room ? fopen(RESERVATIONS_FILE, "ab") : NULL;
+
     if (file == NULL)
     {
-        found = -1;
-        send(client_sock, &found, sizeof(int), 0);
+        pthread_rwlock_unlock(&shared->reservations_lock);
+        return -1;
+    }
+    else
+    {
+        bzero(reservation, sizeof(Reservation));
+        reservation->code = generateReservationCode();
+        // The record is zeroed, so a surname cut to MAX_SURNAME_LENGTH - 1 keeps its terminator
+        memcpy(reservation->surname, rsrv_params->surname, strnlen(rsrv_params->surname, sizeof(reservation->surname) - 1));
+        reservation->nr_people = rsrv_params->people;
+        reservation->start = rsrv_params->start;
+        reservation->table = table_number;
+
+        // Write through: the index only learns about records that reached the file,
+        // the log makes the record durable before the device hears about it
+        fseek(file, 0, SEEK_END);
+        uint32_t position = (ftell(file) - sizeof(FileHeader)) / sizeof(Reservation);
+        walAppend(WAL_RESERVATIONS, position, reservation, sizeof(Reservation));
+        bool written = fwrite(reservation, sizeof(Reservation), 1, file) == 1;
+        written = fclose(file) == 0 && written;
+
+        // The bill starts at 0, the entry is part of BILLS_FILE before an order can reach it
+        written = written && ftruncate(bills_fd, sizeof(FileHeader) + (off_t)(position + 1) * sizeof(int32_t)) == 0;
+        if (written)
+        {
+            reservation_index->file_records = position + 1;
+            markReserved(reservation);
+            indexReservation(reservation, position);
+        }
+        pthread_rwlock_unlock(&shared->reservations_lock);
+        return written ? 1 : -1;
+    }
+}
+
+int findAvailableTables(MatchingTable matching_tab[], FindRequest *rsrv_params)
+{
+    int found_tab_nr = 0; // number of found matching tables for reservation request
+    int nr_people = roundToEven(rsrv_params->people);
+    if (rsrv_params->start < 0)
+        return -1;
+    if (nr_people < 1 || nr_people > MAX_TABLE_SEATS)
+        return 0;
+
+    // Free tables of the right size are one AND over the slot's table set
+    pthread_rwlock_rdlock(&shared->reservations_lock);
+    DayAvailability *availability_day = findDay(rsrv_params->start / MINUTES_PER_DAY, false);
+    TableSet reserved = availability_day != NULL ? availability_day->reserved[rsrv_params->start % MINUTES_PER_DAY / SLOT_MINUTES] : 0;
+    TableSet free_tables = availability->by_seats[nr_people] & ~reserved;
+    while (free_tables != 0)
+    {
+        matching_tab[found_tab_nr].table = &ALL_TABLES[__builtin_ctzll(free_tables)];
+        found_tab_nr++;
+        free_tables &= free_tables - 1;
+    }
+    pthread_rwlock_unlock(&shared->reservations_lock);
+    return found_tab_nr;
+}
+
+bool markReserved(const Reservation *reservation)
+{
+    // Caller must hold reservations_lock for writing (or be the only thread)
+    DayAvailability *availability_day = findDay(reservation->start / MINUTES_PER_DAY, true);
+    if (availability_day == NULL)
+    {
+        fprintf(stdout, "[ERROR] Availability grid is full\n");
+        return false;
+    }
+    availability_day->reserved[reservation->start % MINUTES_PER_DAY / SLOT_MINUTES] |= (TableSet)1 << reservation->table;
+    return true;
+}
+
+DayAvailability *findDay(int day, bool create)
+{
+    // Linear probing over the dates, an unused entry ends the search
+    uint32_t key = day + 1;
+    for (uint32_t probe = 0; probe < AVAILABILITY_DAYS; probe++)
+    {
+        DayAvailability *entry = &availability->days[(key * 2654435761u + probe) & (AVAILABILITY_DAYS - 1)];
+        if (entry->key == (int32_t)key)
+            return entry;
+        if (entry->key == 0)
+        {
+            if (!create || availability->used >= AVAILABILITY_DAYS / 2)
+                return NULL;
+            entry->key = key;
+            availability->used++;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int64_t parseReservationStart(const char *date, const char *time)
+{
+    // Dates beyond 9999 do not fit the minutes of a stored reservation
+    int day = parseReservationDay(date);
+    int minute = parseReservationMinute(time);
+    if (day < 0 || minute < 0 || day > parseReservationDay("31-12-9999"))
+        return -1;
+    return (int64_t)day * MINUTES_PER_DAY + minute;
+}
+
+int findFreeSlots(int people, const char *date, int free_tables[])
+{
+    int nr_people = roundToEven(people);
+    int day = parseReservationDay(date);
+    if (day < 0 || nr_people < 1 || nr_people > MAX_TABLE_SEATS)
+        return -1;
+
+    // Every slot of the day is one AND and one popcount
+    int free_slots = 0;
+    pthread_rwlock_rdlock(&shared->reservations_lock);
+    DayAvailability *availability_day = findDay(day, false);
+    TableSet tables = availability->by_seats[nr_people];
+    for (int slot = 0; slot < SLOTS_PER_DAY; slot++)
+    {
+        TableSet reserved = availability_day != NULL ? availability_day->reserved[slot] : 0;
+        free_tables[slot] = __builtin_popcountll(tables & ~reserved);
+        if (free_tables[slot] > 0)
+            free_slots++;
+    }
+    pthread_rwlock_unlock(&shared->reservations_lock);
+    return free_slots;
+}
+
+int findFreeGrid(int people, int first_day, int days, int first_slot, int slots, int free_tables[][SLOTS_PER_DAY])
+{
+    int nr_people = roundToEven(people);
+    if (nr_people < 1 || nr_people > MAX_TABLE_SEATS || first_slot < 0 || first_slot + slots > SLOTS_PER_DAY)
+        return -1;
+
+    // One hold of the lock for the whole range, every date is one lookup and every slot one AND,
+    // so the query does not depend on the number of stored reservations
+    int free_slots = 0;
+    pthread_rwlock_rdlock(&shared->reservations_lock);
+    TableSet tables = availability->by_seats[nr_people];
+    for (int day = 0; day < days; day++)
+    {
+        DayAvailability *availability_day = findDay(first_day + day, false);
+        for (int slot = 0; slot < slots; slot++)
+        {
+            TableSet reserved = availability_day != NULL ? availability_day->reserved[first_slot + slot] : 0;
+            free_tables[day][slot] = __builtin_popcountll(tables & ~reserved);
+            if (free_tables[day][slot] > 0)
+                free_slots++;
+        }
+    }
+    pthread_rwlock_unlock(&shared->reservations_lock);
+    return free_slots;
+}
+
+int openRecordFile(const char *path, const char *magic, uint16_t record_size)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        fprintf(stdout, "[-] Cannot open %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    // A new file gets its header, an existing one must already have this format
+    FileHeader header;
+    ssize_t read_size = pread(fd, &header, sizeof(header), 0);
+    if (read_size == 0)
+    {
+        recordMakeHeader(&header, magic, record_size);
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+        {
+            fprintf(stdout, "[-] Cannot write the header of %s\n", path);
+            exit(1);
+        }
+    }
+    else if (read_size != sizeof(header) || !recordHeaderMatches(&header, magic, record_size))
+    {
+        fprintf(stdout, "[-] %s is not in record format v%d, convert it with ./migrate\n", path, RECORD_FORMAT_VERSION);
+        exit(1);
+    }
+    return fd;
+}
+
+void walInit(int window_us)
+{
+    // Appends come from forked children too, so the batch lives in shared memory
+    wal = mmap(NULL, sizeof(WriteAheadLog), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (wal == MAP_FAILED)
+    {
+        perror("[-] Shared memory error.\n");
+        exit(1);
+    }
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&wal->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal->appended, &cond_attr);
+    pthread_cond_init(&wal->committed, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    wal->window_us = window_us;
+
+    // Data files are brought up to date before anything reads them
+    walReplay();
+    wal_fd = open(WAL_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wal_fd < 0)
+    {
+        perror("[-] Cannot open write-ahead log.\n");
+        exit(1);
+    }
+    pthread_create(&wal_thread, NULL, walCommitThread, NULL);
+    fprintf(stdout, "[WAL] Group commit window: %.1f ms\n", window_us / 1000.0);
+}
+
+void walReplay()
+{
+    FILE *log = fopen(WAL_FILE, "rb");
+    if (log == NULL)
+        return;
+
+    const char *files[] = {NULL, RESERVATIONS_FILE, ORDERS_FILE, ORDERS_FILE, ORDERS_FILE, ORDERS_FILE};
+    const size_t sizes[] = {0, sizeof(Reservation), sizeof(Order), 0, sizeof(OrderBill), sizeof(Order)};
+    int fds[] = {-1, openRecordFile(RESERVATIONS_FILE, RESERVATIONS_MAGIC, sizeof(Reservation)), openRecordFile(ORDERS_FILE, ORDERS_MAGIC, sizeof(Order))};
+    int bill_fd = openRecordFile(BILLS_FILE, BILLS_MAGIC, sizeof(int32_t));
+    char data[sizeof(OrderBill) > sizeof(Reservation) ? sizeof(OrderBill) : sizeof(Reservation)];
+    WalRecord record;
+    long replayed = 0;
+
+    // Records are redone in log order; the first torn or corrupt record ends the log
+    while (fread(&record, sizeof(record), 1, log) == 1)
+    {
+        if (record.magic != WAL_RECORD_MAGIC || record.file < WAL_RESERVATIONS || record.file > WAL_ORDER_RETURN ||
+            record.size != sizes[record.file] || (record.size > 0 && fread(data, record.size, 1, log) != 1))
+            break;
+        uint32_t checksum = recordChecksum(0, &record.file, sizeof(record) - offsetof(WalRecord, file));
+        if (recordChecksum(checksum, data, record.size) != record.checksum)
+            break;
+        int fd = fds[record.file >= WAL_ORDERS ? WAL_ORDERS : record.file];
+
+        // A new order is redone together with its bill; bills only grow, so one that
+        // reached BILLS_FILE through a later order is kept
+        if (record.file == WAL_ORDER_BILL)
+        {
+            OrderBill *billed = (OrderBill *)data;
+            int32_t current_bill = 0;
+            off_t bill_offset = sizeof(FileHeader) + (off_t)billed->order.reservation * sizeof(int32_t);
+            if (pread(bill_fd, &current_bill, sizeof(current_bill), bill_offset) == sizeof(current_bill) && current_bill > billed->bill)
+                billed->bill = current_bill;
+            if (pwrite(bill_fd, &billed->bill, sizeof(billed->bill), bill_offset) != sizeof(billed->bill))
+            {
+                fprintf(stdout, "[-] Cannot replay write-ahead log into %s\n", BILLS_FILE);
+                exit(1);
+            }
+            record.size = sizeof(Order);
+        }
+
+        // Status changes of one order reach the log in any order, but a status only goes back
+        // through a return of an expired lease, which has a record type of its own
+        Order current, *logged = (Order *)data;
+        if ((record.file == WAL_ORDERS || record.file == WAL_ORDER_BILL) && fd >= 0 &&
+            pread(fd, &current, sizeof(current), sizeof(FileHeader) + (off_t)record.index * sizeof(Order)) == sizeof(current) &&
+            current.rsrv_code == logged->rsrv_code && current.time == logged->time &&
+            strncmp(current.course, logged->course, sizeof(current.course)) == 0 && current.status > logged->status)
+            logged->status = current.status;
+        if (fd < 0 || (record.file == WAL_ORDER_SEGMENT ? freeOrderSegment(fd, record.index) < 0
+                                                        : pwrite(fd, data, record.size, sizeof(FileHeader) + (off_t)record.index * record.size) != record.size))
+        {
+            fprintf(stdout, "[-] Cannot replay write-ahead log into %s\n", files[record.file]);
+            exit(1);
+        }
+        replayed++;
+    }
+    long torn = 0;
+    if (!feof(log))
+    {
+        long end = ftell(log);
+        fseek(log, 0, SEEK_END);
+        torn = ftell(log) - end;
+    }
+    fclose(log);
+
+    // Only once the data files hold every record may the log be emptied
+    for (int i = WAL_RESERVATIONS; i <= WAL_ORDERS; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            fsync(fds[i]);
+            close(fds[i]);
+        }
+    }
+    fsync(bill_fd);
+    close(bill_fd);
+    truncate(WAL_FILE, 0);
+    fprintf(stdout, "[WAL] Replayed %ld records%s\n", replayed, torn > 0 ? " (dropped a torn tail)" : "");
+}
+
+uint64_t walAppend(int file, uint32_t index, const void *data, uint16_t size)
+{
+    WalRecord record = {WAL_RECORD_MAGIC, 0, file, size, index};
+    record.checksum = recordChecksum(recordChecksum(0, &record.file, sizeof(record) - offsetof(WalRecord, file)), data, size);
+    size_t len = sizeof(record) + size;
+
+    pthread_mutex_lock(&wal->lock);
+    while (wal->pending_len + len > WAL_BUFFER_SIZE)
+    {
+        pthread_cond_signal(&wal->appended);
+        pthread_cond_wait(&wal->committed, &wal->lock);
+    }
+    memcpy(wal->pending + wal->pending_len, &record, sizeof(record));
+    memcpy(wal->pending + wal->pending_len + sizeof(record), data, size);
+    // Commit thread sleeps on an empty buffer, or waits out the window unless the buffer fills up
+    if (wal->pending_len == 0 || wal->pending_len + len > WAL_BUFFER_SIZE / 2)
+        pthread_cond_signal(&wal->appended);
+    wal->pending_len += len;
+    wal->appended_lsn += len;
+    wal->records++;
+    uint64_t lsn = wal->appended_lsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    wal_last_lsn = lsn;
+    return lsn;
+}
+
+bool walIsDurable(uint64_t lsn)
+{
+    return __atomic_load_n(&wal->durable_lsn, __ATOMIC_ACQUIRE) >= lsn;
+}
+
+void walWaitDurable(uint64_t lsn)
+{
+    if (walIsDurable(lsn))
+        return;
+    pthread_mutex_lock(&wal->lock);
+    while (!walIsDurable(lsn))
+        pthread_cond_wait(&wal->committed, &wal->lock);
+    pthread_mutex_unlock(&wal->lock);
+}
+
+void *walCommitThread(void *arg)
+{
+    (void)arg;
+    char *batch = malloc(WAL_BUFFER_SIZE);
+
+    pthread_mutex_lock(&wal->lock);
+    while (1)
+    {
+        while (wal->pending_len == 0 && !wal->stopping)
+            pthread_cond_wait(&wal->appended, &wal->lock);
+        if (wal->pending_len == 0)
+            break;
+
+        // Give concurrent devices up to the window to join this commit
+        if (wal->window_us > 0 && !wal->stopping)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += (long)wal->window_us * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            while (!wal->stopping && wal->pending_len <= WAL_BUFFER_SIZE / 2 &&
+                   pthread_cond_timedwait(&wal->appended, &wal->lock, &deadline) != ETIMEDOUT)
+                ;
+        }
+
+        // Appends continue into the emptied buffer while the batch is written
+        size_t len = wal->pending_len;
+        uint64_t lsn = wal->appended_lsn;
+        memcpy(batch, wal->pending, len);
+        wal->pending_len = 0;
+        pthread_cond_broadcast(&wal->committed);
+        pthread_mutex_unlock(&wal->lock);
+
+        for (size_t written = 0; written < len;)
+        {
+            ssize_t n = write(wal_fd, batch + written, len - written);
+            if (n < 0 && errno != EINTR)
+            {
+                perror("[-] Cannot write write-ahead log.\n");
+                exit(1);
+            }
+            written += n > 0 ? n : 0;
+        }
+        if (fdatasync(wal_fd) < 0)
+        {
+            perror("[-] Cannot sync write-ahead log.\n");
+            exit(1);
+        }
+
+        pthread_mutex_lock(&wal->lock);
+        __atomic_store_n(&wal->durable_lsn, lsn, __ATOMIC_RELEASE);
+        wal->commits++;
+        pthread_cond_broadcast(&wal->committed);
+        pthread_mutex_unlock(&wal->lock);
+        walNotifyListeners();
+
+        if (lseek(wal_fd, 0, SEEK_END) > WAL_CHECKPOINT_SIZE)
+            walCheckpoint();
+        pthread_mutex_lock(&wal->lock);
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    free(batch);
+    return NULL;
+}
+
+void walCheckpoint()
+{
+    // Never block a device for a checkpoint, the next commit tries again
+    if (pthread_rwlock_trywrlock(&shared->reservations_lock) != 0)
+        return;
+    if (pthread_rwlock_trywrlock(&shared->orders_lock) != 0)
+    {
+        pthread_rwlock_unlock(&shared->reservations_lock);
+        return;
+    }
+
+    // A freed segment whose blocks are not released yet still needs its log record
+    if (order_index->freeing_segment)
+    {
+        pthread_rwlock_unlock(&shared->orders_lock);
+        pthread_rwlock_unlock(&shared->reservations_lock);
+        return;
+    }
+
+    // With both files synced every logged record is redundant; order pages
+    // dirtied since the last checkpoint are written back in one msync
+    int fd = open(RESERVATIONS_FILE, O_WRONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    if (order_index->count > 0)
+        msync(orders_map, sizeof(FileHeader) + (size_t)order_index->count * sizeof(Order), MS_SYNC);
+    fdatasync(orders_fd);
+    if (reservation_index->file_records > 0)
+        msync(bills_map, sizeof(FileHeader) + (size_t)reservation_index->file_records * sizeof(int32_t), MS_SYNC);
+    fdatasync(bills_fd);
+    ftruncate(wal_fd, 0);
+    fdatasync(wal_fd);
+
+    pthread_rwlock_unlock(&shared->orders_lock);
+    pthread_rwlock_unlock(&shared->reservations_lock);
+}
+
+int walAddListener()
+{
+    int fd = eventfd(0, EFD_NONBLOCK);
+    pthread_mutex_lock(&wal_listeners_lock);
+    if (wal_listener_count < MAX_WAL_LISTENERS)
+        wal_listeners[wal_listener_count++] = fd;
+    pthread_mutex_unlock(&wal_listeners_lock);
+    return fd;
+}
+
+void walNotifyListeners()
+{
+    // Only event loops listen, fork mode has none
+    uint64_t one = 1;
+    if (__atomic_load_n(&wal_listener_count, __ATOMIC_ACQUIRE) == 0)
+        return;
+    pthread_mutex_lock(&wal_listeners_lock);
+    for (int i = 0; i < wal_listener_count; i++)
+        write(wal_listeners[i], &one, sizeof(one));
+    pthread_mutex_unlock(&wal_listeners_lock);
+}
+
+void walShutdown()
+{
+    pthread_mutex_lock(&wal->lock);
+    wal->stopping = true;
+    pthread_cond_signal(&wal->appended);
+    pthread_mutex_unlock(&wal->lock);
+    pthread_join(wal_thread, NULL);
+
+    fprintf(stdout, "[WAL] %llu records in %llu group commits\n", (unsigned long long)wal->records, (unsigned long long)wal->commits);
+    close(wal_fd);
+}
+
+void loadOrderStore()
+{
+    orders_fd = openRecordFile(ORDERS_FILE, ORDERS_MAGIC, sizeof(Order));
+    struct stat file_stat;
+    if (fstat(orders_fd, &file_stat) < 0)
+    {
+        perror("[-] Cannot open orders file.\n");
+        exit(1);
+    }
+
+    // A partly written record at the end of the file is dropped
+    off_t count = (file_stat.st_size - sizeof(FileHeader)) / sizeof(Order);
+    if ((off_t)sizeof(FileHeader) + count * (off_t)sizeof(Order) != file_stat.st_size)
+        ftruncate(orders_fd, sizeof(FileHeader) + count * sizeof(Order));
+
+    // Segments freed by compaction are holes at the front of the file; the live
+    // records are moved to the front so the segments are numbered from 0 again
+    uint32_t first_live_segment = findFirstLiveSegment(count);
+    openOrderArchive(first_live_segment);
+    if (first_live_segment > 0)
+        count = rebaseOrderStore(first_live_segment, count);
+
+    // The index has room for the loaded orders and ORDER_INDEX_SPARE_SEGMENTS more segments;
+    // once they are used up new orders are refused until a restart renumbers the segments
+    uint64_t capacity = ((uint64_t)count / ORDER_SEGMENT_SIZE + 1 + ORDER_INDEX_SPARE_SEGMENTS) * ORDER_SEGMENT_SIZE;
+    if (capacity > ORDER_STORE_CAPACITY)
+        capacity = ORDER_STORE_CAPACITY;
+    if (count >= (off_t)capacity)
+    {
+        fprintf(stdout, "[-] %s holds %lld orders, more than the index can take\n", ORDERS_FILE, (long long)count);
+        exit(1);
+    }
+
+    // The whole capacity is reserved up front so the array never moves; only
+    // pages backed by the file are touched, and the file grows one record at a time
+    orders_map = mmap(NULL, sizeof(FileHeader) + (size_t)ORDER_STORE_CAPACITY * sizeof(Order), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, orders_fd, 0);
+    if (orders_map == MAP_FAILED)
+    {
+        perror("[-] Cannot map orders file.\n");
+        exit(1);
+    }
+    orders = (Order *)(orders_map + sizeof(FileHeader));
+    mapOrderIndex(capacity);
+
+    // The active segment is part of the file before its slots are handed out, so
+    // empty slots at the end do not count
+    while (count > 0 && orders[count - 1].rsrv_code == 0)
+        count--;
+    for (uint32_t slot = 0; slot < count; slot++)
+    {
+        // Slots skipped when a segment was sealed early stay empty
+        if (orders[slot].rsrv_code == 0)
+            continue;
+        indexOrder(slot);
+        markOrderStatus(slot, orders[slot].status);
+        if (orders[slot].status == ORDER_WAITING)
+            scheduleWaitingOrder(slot);
+    }
+    order_index->count = count;
+    order_index->active_segment = count / ORDER_SEGMENT_SIZE;
+    order_index->active_since = count % ORDER_SEGMENT_SIZE != 0 ? time(NULL) : 0;
+    if (ftruncate(orders_fd, orderSegmentOffset(order_index->active_segment + 1)) < 0)
+    {
+        perror("[-] Cannot grow orders file.\n");
+        exit(1);
+    }
+    fprintf(stdout, "[+] Loaded %u orders, %u waiting for the kitchen.\n",
+            order_index->status_count[ORDER_WAITING] + order_index->status_count[ORDER_PREPARING] + order_index->status_count[ORDER_SERVED],
+            order_index->waiting_count);
+}
+
+void mapOrderIndex(uint32_t capacity)
+{
+    order_index = mmap(NULL, sizeof(OrderIndex), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (order_index == MAP_FAILED)
+    {
+        perror("[-] Cannot map order index.\n");
+        exit(1);
+    }
+
+    // Every array with an entry per record is mapped on its own, sized for capacity records
+    size_t mapped = sizeof(OrderIndex);
+    order_index->capacity = capacity;
+    order_index->next_by_course = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    for (int queue = 0; queue < KITCHEN_QUEUES; queue++)
+        order_index->waiting[queue] = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->wait_key = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->taken_at = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->next_by_dishes = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->prev_by_dishes = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->heap_position = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->next_course_heap = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->course_child = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->course_sibling = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->course_prev = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->queue_of = mapIndexArray(capacity, sizeof(uint8_t), &mapped);
+    for (int status = 0; status < ORDER_STATUSES; status++)
+        order_index->status_bits[status] = mapIndexArray(capacity / 64, sizeof(uint64_t), &mapped);
+    order_index->lease_of = mapIndexArray(capacity, sizeof(uint16_t), &mapped);
+    order_index->next_in_lease = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    order_index->prev_in_lease = mapIndexArray(capacity, sizeof(uint32_t), &mapped);
+    fprintf(stdout, "[+] Order index has room for %u orders (%zu MB of address space).\n", capacity, mapped >> 20);
+}
+
+void *mapIndexArray(uint32_t count, size_t size, size_t *mapped)
+{
+    // Shared with forked children like the index; pages are only backed once touched
+    void *array = mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (array == MAP_FAILED)
+    {
+        perror("[-] Cannot map order index.\n");
+        exit(1);
+    }
+    *mapped += (size_t)count * size;
+    return array;
+}
+
+// Caller must hold orders_lock
+void indexOrder(uint32_t slot)
+{
+    // Every record is linked, a table may order the same course more than once;
+    // records are pushed on their bucket with a compare-and-swap; only compaction,
+    // holding orders_lock exclusively, takes them out again
+    uint32_t bucket = hashOrderCourse(orders[slot].rsrv_code, orders[slot].course) & (ORDER_INDEX_BUCKETS - 1);
+    uint32_t head = __atomic_load_n(&order_index->by_course[bucket], __ATOMIC_ACQUIRE);
+    do
+        order_index->next_by_course[slot] = head;
+    while (!__atomic_compare_exchange_n(&order_index->by_course[bucket], &head, slot + 1, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+// Caller must hold orders_lock
+int findOrder(int rsrv_code, const char *course)
+{
+    // Of several orders of a (code, course) the one a device is preparing comes first, then
+    // the one waiting, both oldest first; a served one only when all of them are served
+    int found = -1;
+    uint8_t found_rank = ORDER_STATUSES;
+    uint32_t bucket = hashOrderCourse(rsrv_code, course) & (ORDER_INDEX_BUCKETS - 1);
+    for (uint32_t next = __atomic_load_n(&order_index->by_course[bucket], __ATOMIC_ACQUIRE); next != 0; next = order_index->next_by_course[next - 1])
+    {
+        Order *order = &orders[next - 1];
+        if (order->rsrv_code != rsrv_code || strncmp(order->course, course, sizeof(order->course)) != 0)
+            continue;
+        uint8_t status = __atomic_load_n(&order->status, __ATOMIC_ACQUIRE);
+        uint8_t rank = status == ORDER_PREPARING ? 0 : status == ORDER_WAITING ? 1 : 2;
+        if (rank < found_rank || (rank == found_rank && next - 1 < (uint32_t)found))
+        {
+            found = next - 1;
+            found_rank = rank;
+        }
+    }
+    return found;
+}
+
+void markOrderStatus(uint32_t slot, int status)
+{
+    __atomic_fetch_or(&order_index->status_bits[status][slot / 64], 1ull << (slot % 64), __ATOMIC_RELEASE);
+    __atomic_add_fetch(&order_index->status_count[status], 1, __ATOMIC_RELEASE);
+}
+
+void clearOrderStatus(uint32_t slot, int status)
+{
+    __atomic_fetch_and(&order_index->status_bits[status][slot / 64], ~(1ull << (slot % 64)), __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&order_index->status_count[status], 1, __ATOMIC_RELEASE);
+}
+
+// Caller must hold orders_lock
+int nextOrderInStatus(int status, uint32_t slot)
+{
+    // Only the words of live segments are looked at, 64 records at a time
+    uint32_t end = __atomic_load_n(&order_index->count, __ATOMIC_ACQUIRE);
+    if (slot < order_index->first_live_segment * ORDER_SEGMENT_SIZE)
+        slot = order_index->first_live_segment * ORDER_SEGMENT_SIZE;
+    while (slot < end)
+    {
+        uint64_t word = __atomic_load_n(&order_index->status_bits[status][slot / 64], __ATOMIC_ACQUIRE) >> (slot % 64);
+        if (word != 0)
+        {
+            slot += __builtin_ctzll(word);
+            return slot < end ? (int)slot : -1;
+        }
+        slot = (slot / 64 + 1) * 64;
+    }
+    return -1;
+}
+
+uint32_t hashOrderCourse(int rsrv_code, const char *course)
+{
+    uint32_t hash = hashBytes(FNV_OFFSET, &rsrv_code, sizeof(rsrv_code));
+    return hashBytes(hash, course, strnlen(course, sizeof(((Order *)0)->course)));
+}
+
+int saveOrder(Order *order, uint32_t bill_record)
+{
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    int slot = orderSegmentIsDue(order->time) ? -1 : appendOrderRecord(order, bill_record);
+    pthread_rwlock_unlock(&shared->orders_lock);
+
+    // Sealing the active segment is the only step of an order that needs the lock exclusively
+    if (slot < 0)
+    {
+        pthread_rwlock_wrlock(&shared->orders_lock);
+        if (orderSegmentIsDue(order->time) || order_index->count == (order_index->active_segment + 1) * ORDER_SEGMENT_SIZE)
+            rotateOrderSegment();
+        slot = appendOrderRecord(order, bill_record);
+        pthread_rwlock_unlock(&shared->orders_lock);
+    }
+    return slot < 0 ? -1 : 1;
+}
+
+// Caller must hold orders_lock, shared is enough; returns -1 when the active segment is full.
+// A new order is added to the bill of the reservation at bill_record, a moved one (-1) is not
+int appendOrderRecord(const Order *order, int bill_record)
+{
+    // Slots are handed out by a compare-and-swap on count, so concurrent orders never share a record
+    uint32_t end = (order_index->active_segment + 1) * ORDER_SEGMENT_SIZE;
+    uint32_t slot = __atomic_load_n(&order_index->count, __ATOMIC_ACQUIRE);
+    do
+    {
+        if (slot >= end || slot >= order_index->capacity)
+            return -1;
+    } while (!__atomic_compare_exchange_n(&order_index->count, &slot, slot + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    // Log first, the mapped page reaches the file at the latest on the next checkpoint;
+    // the active segment is already part of the file, so the record is only filled in
+    uint64_t lsn = 0;
+    if (bill_record < 0)
+        walAppend(WAL_ORDERS, slot, order, sizeof(Order));
+    else
+    {
+        OrderBill billed = {*order, __atomic_add_fetch(&bills[bill_record], order->value, __ATOMIC_ACQ_REL)};
+        lsn = walAppend(WAL_ORDER_BILL, slot, &billed, sizeof(billed));
+    }
+    orders[slot] = *order;
+    indexOrder(slot);
+    markOrderStatus(slot, order->status);
+    if (order->status == ORDER_WAITING)
+    {
+        // A moved order keeps its key, compaction gives it back after the move
+        pthread_mutex_lock(&shared->kitchen_lock);
+        if (bill_record >= 0)
+            scheduleWaitingOrder(slot);
+        else
+        {
+            order_index->wait_key[slot] = order->time;
+            pushWaitingOrder(slot);
+        }
+        pthread_mutex_unlock(&shared->kitchen_lock);
+    }
+    uint32_t empty = 0;
+    __atomic_compare_exchange_n(&order_index->active_since, &empty, (uint32_t)time(NULL), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    // Kitchen devices hear of new orders only, not of the moves of compaction
+    if (bill_record >= 0)
+        publishKitchenEvent(FEED_NEW_ORDER, order, lsn);
+    return slot;
+}
+
+// Caller must hold orders_lock for writing
+void unindexOrder(uint32_t slot)
+{
+    removeWaitingOrder(slot);
+    unleaseOrder(slot);
+    clearOrderStatus(slot, orders[slot].status);
+    order_index->taken_at[slot] = 0;
+    uint32_t bucket = hashOrderCourse(orders[slot].rsrv_code, orders[slot].course) & (ORDER_INDEX_BUCKETS - 1);
+    for (uint32_t *link = &order_index->by_course[bucket]; *link != 0; link = &order_index->next_by_course[*link - 1])
+    {
+        if (*link == slot + 1)
+        {
+            *link = order_index->next_by_course[slot];
+            break;
+        }
+    }
+}
+
+void startOrderCompaction(int rotate_seconds)
+{
+    order_index->rotate_seconds = rotate_seconds;
+    pthread_create(&compaction_thread, NULL, orderCompactionThread, NULL);
+}
+
+void stopOrderCompaction()
+{
+    compaction_stopping = true;
+    pthread_join(compaction_thread, NULL);
+    fprintf(stdout, "[COMPACT] %llu orders archived, %llu open orders moved\n", (unsigned long long)order_index->archived, (unsigned long long)order_index->moved);
+    close(archive_fd);
+}
+
+void *orderCompactionThread(void *arg)
+{
+    (void)arg;
+    while (!compaction_stopping)
+    {
+        usleep(ORDER_COMPACTION_INTERVAL_US);
+
+        // Without new orders the active segment is sealed by age too, so served orders of a quiet evening get archived
+        pthread_rwlock_rdlock(&shared->orders_lock);
+        bool rotate = orderSegmentIsDue(time(NULL));
+        uint32_t active_segment = order_index->active_segment;
+        pthread_rwlock_unlock(&shared->orders_lock);
+        if (rotate)
+        {
+            pthread_rwlock_wrlock(&shared->orders_lock);
+            if (orderSegmentIsDue(time(NULL)))
+                rotateOrderSegment();
+            active_segment = order_index->active_segment;
+            pthread_rwlock_unlock(&shared->orders_lock);
+        }
+
+        // Only this thread advances first_live_segment
+        while (!compaction_stopping && order_index->first_live_segment < active_segment)
+            compactOrderSegment(order_index->first_live_segment);
+    }
+    return NULL;
+}
+
+void compactOrderSegment(uint32_t segment)
+{
+    uint32_t first = segment * ORDER_SEGMENT_SIZE;
+    Order *served = malloc(ORDER_SEGMENT_SIZE * sizeof(Order));
+    bool *archived = calloc(ORDER_SEGMENT_SIZE, sizeof(bool));
+
+    // Served orders never change again, so they are archived while devices keep working
+    uint32_t served_count = 0;
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    for (uint32_t i = 0; i < ORDER_SEGMENT_SIZE && first + i < order_index->count; i++)
+    {
+        if (orders[first + i].rsrv_code != 0 && orders[first + i].status == ORDER_SERVED)
+        {
+            served[served_count++] = orders[first + i];
+            archived[i] = true;
+        }
+    }
+    pthread_rwlock_unlock(&shared->orders_lock);
+
+    ArchiveBlock block = {segment, served_count};
+    struct iovec parts[2] = {{&block, sizeof(block)}, {served, served_count * sizeof(Order)}};
+    ssize_t size = sizeof(block) + served_count * sizeof(Order);
+    if (pwritev(archive_fd, parts, 2, archive_end) != size || fdatasync(archive_fd) < 0)
+    {
+        perror("[-] Cannot write orders archive.\n");
+        free(served);
+        free(archived);
+        return;
+    }
+    archive_end += size;
+
+    // Open orders move to the active segment in small batches, so devices get the lock in between;
+    // the segment is freed in the log after its last move
+    uint32_t moved_count = 0;
+    for (uint32_t batch = 0; batch < ORDER_SEGMENT_SIZE; batch += ORDER_COMPACTION_BATCH)
+    {
+        pthread_rwlock_wrlock(&shared->orders_lock);
+        for (uint32_t i = batch; i < batch + ORDER_COMPACTION_BATCH && first + i < order_index->count; i++)
+        {
+            uint32_t slot = first + i;
+            if (orders[slot].rsrv_code == 0)
+                continue;
+            Order order = orders[slot];
+            uint32_t wait_key = order_index->wait_key[slot];
+            uint32_t taken_at = order_index->taken_at[slot];
+            int lease = order_index->lease_of[slot];
+            unindexOrder(slot);
+            if (!archived[i])
+            {
+                int moved = appendOrderRecord(&order, -1);
+                if (moved < 0)
+                {
+                    rotateOrderSegment();
+                    moved = appendOrderRecord(&order, -1);
+                    if (moved < 0)
+                            fprintf(stdout, "[-] No room to move order %d %s, restart the server to renumber %s\n", order.rsrv_code, order.course, ORDERS_FILE);
+                }
+                // The order keeps its place in the kitchen queue, its take time and its lease
+                if (moved >= 0)
+                {
+                    order_index->taken_at[moved] = taken_at;
+                    if (lease != 0)
+                        leaseOrder(moved, lease - 1);
+                    if (order_index->heap_position[moved] != 0)
+                    {
+                        removeWaitingOrder(moved);
+                        order_index->wait_key[moved] = wait_key;
+                        pushWaitingOrder(moved);
+                    }
+                }
+                moved_count++;
+            }
+        }
+        if (batch + ORDER_COMPACTION_BATCH < ORDER_SEGMENT_SIZE)
+            pthread_rwlock_unlock(&shared->orders_lock);
+    }
+    uint64_t lsn = walAppend(WAL_ORDER_SEGMENT, segment, &segment, 0);
+    order_index->first_live_segment = segment + 1;
+    order_index->freeing_segment = true;
+    order_index->archived += served_count;
+    order_index->moved += moved_count;
+    uint32_t live = order_index->status_count[ORDER_WAITING] + order_index->status_count[ORDER_PREPARING] + order_index->status_count[ORDER_SERVED];
+    pthread_rwlock_unlock(&shared->orders_lock);
+
+    // The blocks are released only once the log can redo the moves
+    walWaitDurable(lsn);
+    freeOrderSegment(orders_fd, segment);
+    __atomic_store_n(&order_index->freeing_segment, false, __ATOMIC_RELEASE);
+    fprintf(stdout, "[COMPACT] Segment %u: %u orders archived, %u open orders moved, %u orders live\n", segment, served_count, moved_count, live);
+
+    free(served);
+    free(archived);
+}
+
+// Caller must hold orders_lock for writing
+void rotateOrderSegment()
+{
+    uint32_t next_segment = order_index->active_segment + 1;
+    if (order_index->count == order_index->active_segment * ORDER_SEGMENT_SIZE || next_segment * ORDER_SEGMENT_SIZE >= order_index->capacity)
+        return;
+    // Slots left in the sealed segment are never used, the file keeps them as a hole;
+    // the whole new segment joins the file, so appends never have to grow it
+    if (ftruncate(orders_fd, orderSegmentOffset(next_segment + 1)) < 0)
+        return;
+    order_index->active_segment = next_segment;
+    order_index->count = next_segment * ORDER_SEGMENT_SIZE;
+    order_index->active_since = 0;
+}
+
+// Caller must hold orders_lock
+bool orderSegmentIsDue(uint32_t now)
+{
+    // Sealing a segment without served orders would only move the open ones
+    return order_index->rotate_seconds > 0 && order_index->active_since != 0 && order_index->status_count[ORDER_SERVED] > 0 &&
+           now - order_index->active_since >= order_index->rotate_seconds;
+}
+
+off_t orderSegmentOffset(uint32_t segment)
+{
+    return sizeof(FileHeader) + (off_t)segment * ORDER_SEGMENT_SIZE * sizeof(Order);
+}
+
+int freeOrderSegment(int fd, uint32_t segment)
+{
+    // Segments are freed in order, so the page shared with the previous segment
+    // can go too; the one shared with the next segment goes with that segment
+    long page = sysconf(_SC_PAGESIZE);
+    off_t start = segment > 0 ? orderSegmentOffset(segment) / page * page : orderSegmentOffset(segment);
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, orderSegmentOffset(segment + 1) - start) == 0)
+        return 0;
+
+    size_t size = ORDER_SEGMENT_SIZE * sizeof(Order);
+
+    // Without hole punching the records are zeroed, which frees them but not their blocks
+    char *zeros = calloc(1, size);
+    ssize_t written = pwrite(fd, zeros, size, orderSegmentOffset(segment));
+    free(zeros);
+    return written == (ssize_t)size ? 0 : -1;
+}
+
+bool orderSegmentHasData(int fd, uint32_t segment)
+{
+    // Only a quick filter: a page shared with a neighbouring segment reports data
+    // too, the records are looked at afterwards
+    off_t data = lseek(fd, orderSegmentOffset(segment), SEEK_DATA);
+    if (data < 0)
+        return errno != ENXIO;
+    return data < orderSegmentOffset(segment + 1);
+}
+
+uint32_t findFirstLiveSegment(uint32_t count)
+{
+    uint32_t segments = (count + ORDER_SEGMENT_SIZE - 1) / ORDER_SEGMENT_SIZE;
+    Order *records = malloc(ORDER_SEGMENT_SIZE * sizeof(Order));
+    for (uint32_t segment = 0; segment < segments; segment++)
+    {
+        if (!orderSegmentHasData(orders_fd, segment))
+            continue;
+        ssize_t size = pread(orders_fd, records, ORDER_SEGMENT_SIZE * sizeof(Order), orderSegmentOffset(segment));
+        for (ssize_t i = 0; i < size / (ssize_t)sizeof(Order); i++)
+        {
+            if (records[i].rsrv_code != 0)
+            {
+                free(records);
+                return segment;
+            }
+        }
+    }
+    free(records);
+    return segments;
+}
+
+void openOrderArchive(uint32_t first_live_segment)
+{
+    archive_fd = openRecordFile(ORDERS_ARCHIVE_FILE, ORDERS_ARCHIVE_MAGIC, sizeof(Order));
+    struct stat file_stat;
+    fstat(archive_fd, &file_stat);
+
+    // Blocks are walked by their headers; a torn block at the end is dropped
+    off_t offset = sizeof(FileHeader), last = -1;
+    uint64_t archived = 0;
+    ArchiveBlock block, last_block = {ARCHIVE_REBASE, 0};
+    while (pread(archive_fd, &block, sizeof(block), offset) == sizeof(block) &&
+           offset + (off_t)sizeof(block) + (off_t)block.count * (off_t)sizeof(Order) <= file_stat.st_size)
+    {
+        last = offset;
+        last_block = block;
+        archived += block.count;
+        offset += sizeof(block) + (off_t)block.count * sizeof(Order);
+    }
+
+    // A block of a segment that is still live comes from a compaction that did not finish, it is done again
+    if (last >= 0 && last_block.segment != ARCHIVE_REBASE && last_block.segment >= first_live_segment)
+    {
+        offset = last;
+        archived -= last_block.count;
+    }
+    if (offset != file_stat.st_size)
+        ftruncate(archive_fd, offset);
+    archive_end = offset;
+    fprintf(stdout, "[+] Archive holds %llu served orders.\n", (unsigned long long)archived);
+}
+
+uint32_t rebaseOrderStore(uint32_t first_live_segment, uint32_t count)
+{
+    uint32_t shift = (uint64_t)first_live_segment * ORDER_SEGMENT_SIZE < count ? first_live_segment * ORDER_SEGMENT_SIZE : count;
+
+    // Older blocks of the archive name segments by their old numbers
+    ArchiveBlock marker = {ARCHIVE_REBASE, 0};
+    if (pwrite(archive_fd, &marker, sizeof(marker), archive_end) != sizeof(marker) || fdatasync(archive_fd) < 0)
+    {
+        perror("[-] Cannot write orders archive.\n");
+        exit(1);
+    }
+    archive_end += sizeof(marker);
+
+    // Same steps as ./migrate: write the new file next to the old one, sync it, rename it over
+    const char *path = ORDERS_FILE ".new";
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    FileHeader header;
+    recordMakeHeader(&header, ORDERS_MAGIC, sizeof(Order));
+    Order *records = malloc(ORDER_SEGMENT_SIZE * sizeof(Order));
+    bool failed = fd < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header);
+    for (uint32_t from = shift; from < count && !failed; from += ORDER_SEGMENT_SIZE)
+    {
+        size_t size = (count - from < ORDER_SEGMENT_SIZE ? count - from : ORDER_SEGMENT_SIZE) * sizeof(Order);
+        failed = pread(orders_fd, records, size, sizeof(FileHeader) + (off_t)from * sizeof(Order)) != (ssize_t)size;
+        bool empty = true;
+        for (size_t i = 0; i < size / sizeof(Order) && empty; i++)
+            empty = records[i].rsrv_code == 0;
+        // Empty stretches, like the unused end of the active segment, stay holes
+        if (!failed && !empty)
+            failed = pwrite(fd, records, size, sizeof(FileHeader) + (off_t)(from - shift) * sizeof(Order)) != (ssize_t)size;
+    }
+    free(records);
+    if (failed || ftruncate(fd, sizeof(FileHeader) + (off_t)(count - shift) * sizeof(Order)) < 0 || fsync(fd) < 0 || rename(path, ORDERS_FILE) < 0)
+    {
+        perror("[-] Cannot renumber orders file.\n");
+        exit(1);
+    }
+    close(orders_fd);
+    orders_fd = fd;
+    fprintf(stdout, "[+] Dropped %u compacted segments from %s.\n", first_live_segment, ORDERS_FILE);
+    return count - shift;
+}
+
+void printOrderStatusByTable(const char *table_id)
+{
+    int table = tableNumber(table_id);
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    int nr = 1;
+    // Only live orders have a status bit, compacted ones are in the archive
+    for (int status = 0; status < ORDER_STATUSES; status++)
+    {
+        for (int slot = nextOrderInStatus(status, 0); slot >= 0; slot = nextOrderInStatus(status, slot + 1))
+        {
+            Order *order = &orders[slot];
+            if (order->table == table)
+            {
+                char text[ORDER_TEXT_SIZE];
+                formatOrderItems(order, text);
+                fprintf(stdout, "%d) Order: %s, Status: %s\n", nr, text, ORDER_STATUS_NAMES[order->status]);
+                nr++;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&shared->orders_lock);
+}
+
+void printOrderStatusByStatus(const char *status)
+{
+    int status_number = orderStatusNumber(status);
+    if (status_number < 0)
+        return;
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    int nr = 1;
+    for (int slot = nextOrderInStatus(status_number, 0); slot >= 0; slot = nextOrderInStatus(status_number, slot + 1))
+    {
+        Order *order = &orders[slot];
+        char text[ORDER_TEXT_SIZE];
+        formatOrderItems(order, text);
+        fprintf(stdout, "%d) Table: %s Course: %s Order: %s\n", nr, ALL_TABLES[order->table].id, order->course, text);
+        nr++;
+    }
+    pthread_rwlock_unlock(&shared->orders_lock);
+}
+
+void sendWaitingOrders(Session *session, const char *payload, bool cook_batch, Reply *reply)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    char course[MAX_COURSE_LENGTH];
+    Order taken[MAX_TAKE_BATCH];
+
+    // A take without a body claims one order, like devices did before batches; for a
+    // cook batch the number is the room of the device
+    int count = 1;
+    bzero(course, sizeof(course));
+    sscanf(payload, "%d %4s", &count, course);
+    count = count < 1 ? 1 : count > MAX_TAKE_BATCH ? MAX_TAKE_BATCH : count;
+    int found = claimWaitingOrders(session, taken, count, course[0] != '\0' ? course : NULL, cook_batch);
+    if (cook_batch && found > 1)
+        fprintf(stdout, "[KITCHEN] Cook batch of %d orders of the same dishes\n", found);
+
+    replyInt(reply, found);
+    bzero(buffer, MAX_BUFFER_SIZE);
+    if (found == 0)
+    {
+        if (course[0] != '\0')
+            sprintf(buffer, "There are no orders of course %s in \"waiting\" status", course);
+        else
+            strcpy(buffer, "There are no orders in \"waiting\" status");
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER] %s\n", buffer);
+    }
+    for (int i = 0; i < found; i++)
+    {
+        // Send every order to kitchen device, its dishes as text like they were ordered
+        char text[ORDER_TEXT_SIZE];
+        formatOrderItems(&taken[i], text);
+        sprintf(buffer, "%d %s %s %s", taken[i].rsrv_code, ALL_TABLES[taken[i].table].id, taken[i].course, text);
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER] %s\n", buffer);
+    }
+}
+
+// Caller must hold orders_lock
+int changeOrderStatus(int rsrv_code, const char *course, int new_status)
+{
+    int slot = findOrder(rsrv_code, course);
+    if (slot < 0)
+        return 0;
+    return advanceOrderStatus(slot, new_status) ? 1 : 0;
+}
+
+// Caller must hold orders_lock, shared is enough
+bool advanceOrderStatus(uint32_t slot, int new_status)
+{
+    // A status only moves forward; the compare-and-swap on the record decides which
+    // device makes a change, and only that device updates the indexes
+    uint8_t old_status = __atomic_load_n(&orders[slot].status, __ATOMIC_ACQUIRE);
+    do
+    {
+        if (old_status >= new_status)
+            return false;
+    } while (!__atomic_compare_exchange_n(&orders[slot].status, &old_status, new_status, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    // An order leaves the kitchen queue with its first change, e.g. ready without take
+    if (old_status == ORDER_WAITING)
+    {
+        pthread_mutex_lock(&shared->kitchen_lock);
+        removeWaitingOrder(slot);
+        pthread_mutex_unlock(&shared->kitchen_lock);
+    }
+    else if (old_status == ORDER_PREPARING)
+    {
+        // A served order leaves the lease of the device that took it
+        pthread_mutex_lock(&shared->kitchen_lock);
+        unleaseOrder(slot);
+        learnOrderPrepTime(slot);
+        pthread_mutex_unlock(&shared->kitchen_lock);
+    }
+    recordStatusChange(slot, old_status, new_status);
+    return true;
+}
+
+void recordStatusChange(uint32_t slot, int old_status, int new_status)
+{
+    markOrderStatus(slot, new_status);
+    clearOrderStatus(slot, old_status);
+
+    // The record is changed in place in the mapping, the log makes it durable; a later
+    // change may already be in the record, so the logged copy carries this one
+    Order logged = orders[slot];
+    logged.status = new_status;
+    uint64_t lsn = walAppend(new_status < old_status ? WAL_ORDER_RETURN : WAL_ORDERS, slot, &logged, sizeof(Order));
+    publishKitchenEvent(new_status == ORDER_WAITING ? FEED_RETURNED : new_status == ORDER_PREPARING ? FEED_CLAIMED : FEED_SERVED, &logged, lsn);
+}
+
+int claimWaitingOrders(Session *session, Order claimed[], int max, const char *course, bool cook_batch)
+{
+    // The heaps only decide which orders are offered; marking one preparing is the
+    // compare-and-swap, so two kitchen devices never get the same order. A cook batch is
+    // the first order of the schedule with the orders of the same dishes placed around it
+    uint32_t slots[MAX_TAKE_BATCH];
+    int station = session->station;
+    int count = 0;
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    pthread_mutex_lock(&shared->kitchen_lock);
+    if (course == NULL)
+    {
+        while (count < max && order_index->waiting_count > 0)
+        {
+            int queue = nextKitchenQueue(station);
+            uint32_t top = order_index->waiting[queue][0];
+            removeWaitingOrder(top);
+            if (!claimOrderSlot(top))
+                continue;
+            int taken = 1;
+            slots[count] = top;
+            if (cook_batch)
+                taken += claimSameDishes(top, NULL, slots + count + 1, max - count - 1);
+            count += taken;
+            if (station > 0 && queue != station && queue > 0)
+                order_index->stations[queue - 1].stolen += taken;
+            if (cook_batch)
+                break;
+        }
+    }
+    else
+    {
+        // Every course has a heap of its own, its first order is the root
+        uint32_t top;
+        while (count < max && findWaitingCourse(course, &top))
+        {
+            removeWaitingOrder(top);
+            if (!claimOrderSlot(top))
+                continue;
+            slots[count++] = top;
+            if (cook_batch)
+            {
+                count += claimSameDishes(top, course, slots + count, max - count);
+                break;
+            }
+        }
+    }
+
+    // The taken orders are held under the lease of the device until they are ready
+    int lease = count > 0 ? acquireLease(session) : -1;
+    for (int i = 0; i < count && lease >= 0; i++)
+        leaseOrder(slots[i], lease);
+    pthread_mutex_unlock(&shared->kitchen_lock);
+
+    uint32_t now = time(NULL);
+    for (int i = 0; i < count; i++)
+    {
+        order_index->taken_at[slots[i]] = now;
+        recordStatusChange(slots[i], ORDER_WAITING, ORDER_PREPARING);
+        claimed[i] = orders[slots[i]];
+        claimed[i].status = ORDER_PREPARING;
+    }
+    pthread_rwlock_unlock(&shared->orders_lock);
+    return count;
+}
+
+// Caller must hold kitchen_lock, some queue must hold a waiting order
+int nextKitchenQueue(int station)
+{
+    // A station works on its own queue; once that is empty it steals from the longest
+    // queue. A device of no station takes the first order of the schedule in any queue
+    int next = -1;
+    if (station > 0 && order_index->queue_count[station] > 0)
+        return station;
+    for (int queue = 0; queue < KITCHEN_QUEUES; queue++)
+    {
+        if (order_index->queue_count[queue] == 0)
+            continue;
+        if (next < 0 || (station > 0 ? order_index->queue_count[queue] > order_index->queue_count[next]
+                                      : takenBefore(order_index->waiting[queue][0], order_index->waiting[next][0])))
+            next = queue;
+    }
+    return next;
+}
+
+// Caller must hold kitchen_lock
+bool findWaitingCourse(const char *course, uint32_t *slot)
+{
+    uint32_t root = *findCourseHeap(course);
+    if (root == 0)
+        return false;
+    *slot = root - 1;
+    return true;
+}
+
+bool claimOrderSlot(uint32_t slot)
+{
+    // A ready that got there first leaves its heap removal to the claim
+    uint8_t waiting = ORDER_WAITING;
+    return __atomic_compare_exchange_n(&orders[slot].status, &waiting, ORDER_PREPARING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void pushWaitingOrder(uint32_t slot)
+{
+    // Orders go to the queue of the station that serves their course
+    int queue = findStationQueue(orders[slot].course);
+    uint32_t position = order_index->queue_count[queue]++;
+    order_index->waiting_count++;
+    order_index->queue_of[slot] = queue;
+    order_index->waiting[queue][position] = slot;
+    order_index->heap_position[slot] = position + 1;
+    siftWaitingUp(queue, position);
+    linkSameDishes(slot);
+    pushCourseHeap(slot);
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void removeWaitingOrder(uint32_t slot)
+{
+    if (order_index->heap_position[slot] == 0)
+        return;
+
+    // The last record of the heap fills the hole and moves to its place
+    int queue = order_index->queue_of[slot];
+    uint32_t position = order_index->heap_position[slot] - 1;
+    uint32_t last = order_index->waiting[queue][--order_index->queue_count[queue]];
+    order_index->waiting_count--;
+    order_index->heap_position[slot] = 0;
+    unlinkSameDishes(slot);
+    removeCourseHeap(slot);
+    if (last == slot)
+        return;
+    order_index->waiting[queue][position] = last;
+    order_index->heap_position[last] = position + 1;
+    siftWaitingUp(queue, position);
+    siftWaitingDown(queue, order_index->heap_position[last] - 1);
+}
+
+void siftWaitingUp(int queue, uint32_t position)
+{
+    uint32_t *heap = order_index->waiting[queue];
+    uint32_t slot = heap[position];
+    while (position > 0)
+    {
+        uint32_t parent = (position - 1) / 2;
+        if (!takenBefore(slot, heap[parent]))
+            break;
+        heap[position] = heap[parent];
+        order_index->heap_position[heap[position]] = position + 1;
+        position = parent;
+    }
+    heap[position] = slot;
+    order_index->heap_position[slot] = position + 1;
+}
+
+void siftWaitingDown(int queue, uint32_t position)
+{
+    uint32_t *heap = order_index->waiting[queue];
+    uint32_t count = order_index->queue_count[queue];
+    uint32_t slot = heap[position];
+    while (2 * position + 1 < count)
+    {
+        uint32_t child = 2 * position + 1;
+        if (child + 1 < count && takenBefore(heap[child + 1], heap[child]))
+            child++;
+        if (!takenBefore(heap[child], slot))
+            break;
+        heap[position] = heap[child];
+        order_index->heap_position[heap[position]] = position + 1;
+        position = child;
+    }
+    heap[position] = slot;
+    order_index->heap_position[slot] = position + 1;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+int findStationQueue(const char *course)
+{
+    for (int station = 0; station < KITCHEN_STATIONS; station++)
+    {
+        for (int i = 0; i < STATION_COURSES; i++)
+        {
+            const char *served = order_index->stations[station].courses[i];
+            if (served[0] != '\0' && strncmp(served, course, MAX_COURSE_LENGTH) == 0)
+                return station + 1;
+        }
+    }
+    return 0;
+}
+
+// Caller must hold orders_lock and kitchen_lock; returns the queue of the station,
+// -1 when another station serves one of the courses or -2 when every station is taken
+int joinStation(char courses[][MAX_COURSE_LENGTH], int count)
+{
+    // Devices giving the same courses form one station, a course is served by one station only
+    int free_station = -1;
+    for (int station = 0; station < KITCHEN_STATIONS; station++)
+    {
+        KitchenStation *entry = &order_index->stations[station];
+        int served = 0, matching = 0;
+        for (int i = 0; i < STATION_COURSES; i++)
+        {
+            if (entry->courses[i][0] == '\0')
+                continue;
+            served++;
+            for (int j = 0; j < count; j++)
+                matching += strncmp(entry->courses[i], courses[j], MAX_COURSE_LENGTH) == 0;
+        }
+        if (entry->devices == 0 && free_station < 0)
+            free_station = station;
+        if (entry->devices > 0 && matching == served && matching == count)
+        {
+            entry->devices++;
+            return station + 1;
+        }
+        if (matching > 0)
+            return -1;
+    }
+    if (free_station < 0)
+        return -2;
+
+    // Waiting orders of the courses leave the shared queue for the new station
+    KitchenStation *entry = &order_index->stations[free_station];
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->courses, courses, count * sizeof(courses[0]));
+    entry->devices = 1;
+    rerouteWaitingOrders(0);
+    return free_station + 1;
+}
+
+void leaveStation(Session *session)
+{
+    if (session->station == 0)
+        return;
+
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    pthread_mutex_lock(&shared->kitchen_lock);
+    KitchenStation *station = &order_index->stations[session->station - 1];
+    // The last device of a station hands its waiting orders back to the shared queue
+    if (--station->devices == 0)
+    {
+        fprintf(stdout, "[KITCHEN] Station %d closed, %llu of its orders were taken by other stations\n", session->station, (unsigned long long)station->stolen);
+        memset(station->courses, 0, sizeof(station->courses));
+        rerouteWaitingOrders(session->station);
+    }
+    pthread_mutex_unlock(&shared->kitchen_lock);
+    pthread_rwlock_unlock(&shared->orders_lock);
+    session->station = 0;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void rerouteWaitingOrders(int queue)
+{
+    // Orders whose course now belongs to another queue are collected first, as moving one reorders the heap
+    uint32_t moving = 0;
+    uint32_t *slots = malloc((order_index->queue_count[queue] + 1) * sizeof(uint32_t));
+    for (uint32_t position = 0; position < order_index->queue_count[queue]; position++)
+    {
+        uint32_t slot = order_index->waiting[queue][position];
+        if (findStationQueue(orders[slot].course) != queue)
+            slots[moving++] = slot;
+    }
+    for (uint32_t i = 0; i < moving; i++)
+    {
+        removeWaitingOrder(slots[i]);
+        pushWaitingOrder(slots[i]);
+    }
+    free(slots);
+}
+
+bool takenBefore(uint32_t slot, uint32_t other)
+{
+    // Orders with the same key are taken in the order they arrived
+    if (order_index->wait_key[slot] != order_index->wait_key[other])
+        return order_index->wait_key[slot] < order_index->wait_key[other];
+    if (orders[slot].time != orders[other].time)
+        return orders[slot].time < orders[other].time;
+    return slot < other;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void pushCourseHeap(uint32_t slot)
+{
+    order_index->course_child[slot] = 0;
+    order_index->course_sibling[slot] = 0;
+    order_index->course_prev[slot] = 0;
+    uint32_t *link = findCourseHeap(orders[slot].course);
+    if (*link == 0)
+    {
+        order_index->next_course_heap[slot] = 0;
+        *link = slot + 1;
+    }
+    else
+        setCourseHeapRoot(link, *link, meldCourseHeaps(*link, slot + 1));
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void removeCourseHeap(uint32_t slot)
+{
+    // The children of the order become one heap, melded back with the rest of the course
+    uint32_t *link = findCourseHeap(orders[slot].course);
+    uint32_t children = mergeCoursePairs(order_index->course_child[slot]);
+    order_index->course_child[slot] = 0;
+    if (*link == slot + 1)
+    {
+        setCourseHeapRoot(link, slot + 1, children);
+        return;
+    }
+
+    uint32_t prev = order_index->course_prev[slot], next = order_index->course_sibling[slot];
+    if (order_index->course_child[prev - 1] == slot + 1)
+        order_index->course_child[prev - 1] = next;
+    else
+        order_index->course_sibling[prev - 1] = next;
+    if (next != 0)
+        order_index->course_prev[next - 1] = prev;
+    order_index->course_sibling[slot] = 0;
+    order_index->course_prev[slot] = 0;
+    setCourseHeapRoot(link, *link, meldCourseHeaps(*link, children));
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing; returns the link holding the
+// root + 1 of the heap of the course, or the 0 ending the chain of its bucket
+uint32_t *findCourseHeap(const char *course)
+{
+    // Only roots are chained, a course without waiting orders has no heap
+    uint32_t bucket = hashBytes(FNV_OFFSET, course, strnlen(course, MAX_COURSE_LENGTH)) & (COURSE_HEAP_BUCKETS - 1);
+    uint32_t *link = &order_index->course_heaps[bucket];
+    while (*link != 0 && strncmp(orders[*link - 1].course, course, MAX_COURSE_LENGTH) != 0)
+        link = &order_index->next_course_heap[*link - 1];
+    return link;
+}
+
+void setCourseHeapRoot(uint32_t *link, uint32_t old_root, uint32_t root)
+{
+    uint32_t next = order_index->next_course_heap[old_root - 1];
+    if (root != 0)
+        order_index->next_course_heap[root - 1] = next;
+    *link = root != 0 ? root : next;
+}
+
+uint32_t meldCourseHeaps(uint32_t first, uint32_t second)
+{
+    // The root taken later becomes the first child of the other
+    if (first == 0 || second == 0)
+        return first != 0 ? first : second;
+    if (takenBefore(second - 1, first - 1))
+    {
+        uint32_t swap = first;
+        first = second;
+        second = swap;
+    }
+    uint32_t child = order_index->course_child[first - 1];
+    order_index->course_sibling[second - 1] = child;
+    if (child != 0)
+        order_index->course_prev[child - 1] = second;
+    order_index->course_prev[second - 1] = first;
+    order_index->course_child[first - 1] = second;
+    return first;
+}
+
+uint32_t mergeCoursePairs(uint32_t first)
+{
+    // Two passes of a pairing heap: siblings are melded in pairs left to right, the pairs
+    // are kept on a stack through their sibling links and melded right to left
+    uint32_t pairs = 0;
+    while (first != 0)
+    {
+        uint32_t second = order_index->course_sibling[first - 1];
+        uint32_t rest = second != 0 ? order_index->course_sibling[second - 1] : 0;
+        order_index->course_sibling[first - 1] = 0;
+        order_index->course_prev[first - 1] = 0;
+        if (second != 0)
+        {
+            order_index->course_sibling[second - 1] = 0;
+            order_index->course_prev[second - 1] = 0;
+        }
+        uint32_t pair = meldCourseHeaps(first, second);
+        order_index->course_sibling[pair - 1] = pairs;
+        pairs = pair;
+        first = rest;
+    }
+
+    uint32_t root = 0;
+    while (pairs != 0)
+    {
+        uint32_t next = order_index->course_sibling[pairs - 1];
+        order_index->course_sibling[pairs - 1] = 0;
+        root = meldCourseHeaps(root, pairs);
+        pairs = next;
+    }
+    return root;
+}
+
+// Caller must hold kitchen_lock; claims the waiting orders of the queue of first with its dishes,
+// placed at most the batch window apart from it
+int claimSameDishes(uint32_t first, const char *course, uint32_t slots[], int max)
+{
+    uint32_t window = kitchen_schedule->batch_window;
+    if (window == 0)
+        return 0;
+
+    // Orders join their list when they come in, so it is sorted by time but for orders moved to
+    // another station. First was just unlinked but still points to its neighbours: the walk starts
+    // there and goes both ways to the ends of the window, closest orders first, so only orders
+    // placed inside the window count towards the scan
+    int count = 0, scanned = 0;
+    uint32_t placed = orders[first].time;
+    uint32_t older = order_index->prev_by_dishes[first], newer = order_index->next_by_dishes[first];
+    while ((older != 0 || newer != 0) && count < max && scanned < DISH_BATCH_MAX_SCAN)
+    {
+        uint32_t slot;
+        if (newer == 0 || (older != 0 && (int64_t)placed - orders[older - 1].time <= (int64_t)orders[newer - 1].time - placed))
+        {
+            slot = older - 1;
+            older = order_index->prev_by_dishes[slot];
+            if (orders[slot].time + window < placed)
+            {
+                older = 0;
+                continue;
+            }
+        }
+        else
+        {
+            slot = newer - 1;
+            newer = order_index->next_by_dishes[slot];
+            if (orders[slot].time > placed + window)
+            {
+                newer = 0;
+                continue;
+            }
+        }
+        scanned++;
+        Order *order = &orders[slot];
+        if (!haveSameDishes(order, &orders[first]) || (course != NULL && strncmp(order->course, course, MAX_COURSE_LENGTH) != 0))
+            continue;
+        removeWaitingOrder(slot);
+        if (claimOrderSlot(slot))
+            slots[count++] = slot;
+    }
+    return count;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void linkSameDishes(uint32_t slot)
+{
+    uint32_t bucket = findDishBucket(slot);
+    uint32_t last = order_index->last_by_dishes[bucket];
+    order_index->prev_by_dishes[slot] = last;
+    order_index->next_by_dishes[slot] = 0;
+    if (last != 0)
+        order_index->next_by_dishes[last - 1] = slot + 1;
+    else
+        order_index->by_dishes[bucket] = slot + 1;
+    order_index->last_by_dishes[bucket] = slot + 1;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void unlinkSameDishes(uint32_t slot)
+{
+    uint32_t bucket = findDishBucket(slot);
+    uint32_t prev = order_index->prev_by_dishes[slot], next = order_index->next_by_dishes[slot];
+    if (prev != 0)
+        order_index->next_by_dishes[prev - 1] = next;
+    else
+        order_index->by_dishes[bucket] = next;
+    if (next != 0)
+        order_index->prev_by_dishes[next - 1] = prev;
+    else
+        order_index->last_by_dishes[bucket] = prev;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+uint32_t findDishBucket(uint32_t slot)
+{
+    // Every queue has its own lists, so a batch never walks over the orders of other stations
+    uint8_t queue = order_index->queue_of[slot];
+    return hashBytes(hashOrderDishes(&orders[slot]), &queue, sizeof(queue)) & (DISH_BATCH_BUCKETS - 1);
+}
+
+uint32_t hashOrderDishes(const Order *order)
+{
+    // The dishes of an order come in any order, so the hashes of their codes are added up
+    uint32_t hash = 0;
+    for (int i = 0; i < order->item_count && i < MAX_ORDER_ITEMS; i++)
+        hash += hashBytes(FNV_OFFSET, order->items[i].dish, DISH_CODE_SIZE);
+    return hash ^ hash >> 16;
+}
+
+bool haveSameDishes(const Order *order, const Order *other)
+{
+    // Quantities may differ, every code is in an order at most once
+    if (order->item_count != other->item_count)
+        return false;
+    for (int i = 0; i < order->item_count && i < MAX_ORDER_ITEMS; i++)
+    {
+        int j = 0;
+        while (j < other->item_count && memcmp(order->items[i].dish, other->items[j].dish, DISH_CODE_SIZE) != 0)
+            j++;
+        if (j == other->item_count)
+            return false;
+    }
+    return true;
+}
+
+void loadKitchenSchedule(int policy, int batch_window)
+{
+    kitchen_schedule = mmap(NULL, sizeof(KitchenSchedule), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (kitchen_schedule == MAP_FAILED)
+    {
+        perror("[-] Shared memory error.\n");
+        exit(1);
+    }
+    kitchen_schedule->policy = policy;
+    kitchen_schedule->batch_window = batch_window;
+
+    // Without the file every dish starts at the default and the estimates are only learned
+    if (loadPrepTimes(PREP_TIMES_FILE, &kitchen_schedule->prep))
+        fprintf(stdout, "[+] Loaded prep times of %d dishes from %s, kitchen schedule: %s.\n", kitchen_schedule->prep.count, PREP_TIMES_FILE, SCHEDULE_NAMES[policy]);
+    else
+        fprintf(stdout, "[+] No prep times in %s, dishes start at %d seconds, kitchen schedule: %s.\n", PREP_TIMES_FILE, PREP_DEFAULT_SECONDS, SCHEDULE_NAMES[policy]);
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void scheduleWaitingOrder(uint32_t slot)
+{
+    // The key is fixed when the order comes in, so the heaps never have to be reordered
+    Order *order = &orders[slot];
+    uint32_t prep = estimatePrepTime(&kitchen_schedule->prep, order);
+    uint32_t *paced_until = kitchen_schedule->policy == SCHEDULE_PACING ? findPacing(order->rsrv_code, order->time) : NULL;
+    order_index->wait_key[slot] = scheduleKey(kitchen_schedule->policy, order->time, prep, paced_until);
+    pushWaitingOrder(slot);
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing; returns NULL when every
+// probed bucket paces another reservation, its courses are then not paced
+uint32_t *findPacing(int rsrv_code, uint32_t now)
+{
+    // A bucket whose last course should be done is free for another reservation
+    uint32_t hash = hashBytes(FNV_OFFSET, &rsrv_code, sizeof(rsrv_code));
+    PacedReservation *free_bucket = NULL;
+    for (int probe = 0; probe < PACING_PROBES; probe++)
+    {
+        PacedReservation *bucket = &kitchen_schedule->paced[(hash + probe) & (PACING_BUCKETS - 1)];
+        if (bucket->rsrv_code == rsrv_code)
+            return &bucket->until;
+        if (free_bucket == NULL && (bucket->rsrv_code == 0 || bucket->until <= now))
+            free_bucket = bucket;
+    }
+    if (free_bucket == NULL)
+        return NULL;
+    free_bucket->rsrv_code = rsrv_code;
+    free_bucket->until = 0;
+    return &free_bucket->until;
+}
+
+// Caller must hold kitchen_lock
+void learnOrderPrepTime(uint32_t slot)
+{
+    // Only orders taken since the server started have a take time
+    uint32_t taken_at = __atomic_exchange_n(&order_index->taken_at[slot], 0, __ATOMIC_ACQ_REL);
+    uint32_t now = time(NULL);
+    if (taken_at == 0 || now < taken_at)
+        return;
+    learnPrepTime(&kitchen_schedule->prep, &orders[slot], now - taken_at);
+}
+
+void printPrepTimes()
+{
+    pthread_mutex_lock(&shared->kitchen_lock);
+    fprintf(stdout, "[SERVER STAT] Kitchen schedule: %s\n", SCHEDULE_NAMES[kitchen_schedule->policy]);
+    for (int i = 0; i < kitchen_schedule->prep.count; i++)
+        fprintf(stdout, "%.*s: %u seconds, learned from %u orders\n", DISH_CODE_SIZE, kitchen_schedule->prep.dishes[i],
+                kitchen_schedule->prep.seconds[i], kitchen_schedule->prep.samples[i]);
+    pthread_mutex_unlock(&shared->kitchen_lock);
+}
+
+void sendAllOrdersInPreparingStatus(Reply *reply)
+{
+    int found = 0;
+    char buffer[MAX_BUFFER_SIZE];
+
+    // Statuses keep changing while the list is walked, so the reply is built from a copy
+    int last_order = 0, capacity = 0;
+    Order *preparing = NULL;
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    for (int slot = nextOrderInStatus(ORDER_PREPARING, 0); slot >= 0; slot = nextOrderInStatus(ORDER_PREPARING, slot + 1))
+    {
+        if (last_order == capacity)
+        {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            preparing = realloc(preparing, capacity * sizeof(Order));
+        }
+        preparing[last_order++] = orders[slot];
+    }
+    pthread_rwlock_unlock(&shared->orders_lock);
+    if (last_order > 0)
+        found = 1;
+
+    replyInt(reply, found);
+    if (found == 0)
+    {
+        char no_found_msg[] = "There are no orders in \"in preparation\" status right now.";
+        bzero(buffer, MAX_BUFFER_SIZE);
+        strcpy(buffer, no_found_msg);
+        replyText(reply, buffer);
+        fprintf(stdout, "[SERVER] %s\n", buffer);
+    }
+    else if (found == 1)
+    {
+        replyInt(reply, last_order);
+        for (int i = 0; i < last_order; i++)
+        {
+            Order *order = &preparing[i];
+            char text[ORDER_TEXT_SIZE];
+            formatOrderItems(order, text);
+            fprintf(stdout, "Order in preparing status: %s %s\n", ALL_TABLES[order->table].id, order->course);
+            bzero(buffer, MAX_BUFFER_SIZE);
+            sprintf(buffer, "%s %s %s", ALL_TABLES[order->table].id, order->course, text);
+            replyText(reply, buffer);
+        }
+        fprintf(stdout, "[SERVER]Orders in preparation send to kitchen device\n");
+    }
+    free(preparing);
+}
+
+void startLeaseTimer(int lease_seconds)
+{
+    order_index->lease_seconds = lease_seconds;
+    order_index->lease_tick = time(NULL);
+    for (int lease = MAX_KITCHEN_LEASES - 1; lease >= 0; lease--)
+    {
+        order_index->leases[lease].next_due = order_index->free_leases;
+        order_index->free_leases = lease + 1;
+    }
+
+    // No device holds the orders that were being prepared before a restart; they share
+    // one lease and go back to the queue unless they are marked ready in time
+    uint32_t held = 0;
+    int orphans = -1;
+    for (int slot = nextOrderInStatus(ORDER_PREPARING, 0); slot >= 0; slot = nextOrderInStatus(ORDER_PREPARING, slot + 1))
+    {
+        if (orphans < 0)
+        {
+            orphans = order_index->free_leases - 1;
+            order_index->free_leases = order_index->leases[orphans].next_due;
+            order_index->leases[orphans].expires = order_index->lease_tick + lease_seconds;
+            scheduleLease(orphans);
+        }
+        leaseOrder(slot, orphans);
+        held++;
+    }
+    if (held > 0)
+        fprintf(stdout, "[+] %u orders were in preparation before the restart, they go back to the queue in %d seconds unless marked ready.\n", held, lease_seconds);
+    pthread_create(&lease_thread, NULL, leaseTimerThread, NULL);
+}
+
+void stopLeaseTimer()
+{
+    lease_stopping = true;
+    pthread_join(lease_thread, NULL);
+    fprintf(stdout, "[KITCHEN] %llu orders of kitchen devices without heartbeat went back to the queue\n", (unsigned long long)order_index->returned);
+}
+
+void *leaseTimerThread(void *arg)
+{
+    (void)arg;
+    while (!lease_stopping)
+    {
+        usleep(LEASE_TICK_US);
+        uint32_t now = time(NULL);
+        if (now <= __atomic_load_n(&order_index->lease_tick, __ATOMIC_RELAXED))
+            continue;
+
+        // Every second of the wheel lists only the leases due in it, so a tick never
+        // looks at the leases of devices that keep sending heartbeats
+        pthread_rwlock_rdlock(&shared->orders_lock);
+        pthread_mutex_lock(&shared->kitchen_lock);
+        if (now - order_index->lease_tick > LEASE_WHEEL_SIZE)
+            order_index->lease_tick = now - LEASE_WHEEL_SIZE;
+        while (order_index->lease_tick < now)
+        {
+            uint32_t tick = ++order_index->lease_tick;
+            uint32_t next = order_index->lease_wheel[tick & (LEASE_WHEEL_SIZE - 1)];
+            while (next != 0)
+            {
+                int lease = next - 1;
+                next = order_index->leases[lease].next_due;
+                // After a late tick a renewed lease can sit in a second that comes round before it is due
+                if (order_index->leases[lease].expires <= tick)
+                    expireLease(lease);
+            }
+        }
+        pthread_mutex_unlock(&shared->kitchen_lock);
+        pthread_rwlock_unlock(&shared->orders_lock);
+    }
+    return NULL;
+}
+
+// Caller must hold kitchen_lock; returns -1 when every lease is in use, the orders are then held without one
+int acquireLease(Session *session)
+{
+    // A device keeps one lease for all the orders it holds, taking more renews it
+    int lease = session->lease - 1;
+    if (lease < 0 || order_index->leases[lease].generation != session->lease_generation || order_index->leases[lease].expires == 0)
+    {
+        if (order_index->free_leases == 0)
+            return -1;
+        lease = order_index->free_leases - 1;
+        order_index->free_leases = order_index->leases[lease].next_due;
+        session->lease = lease + 1;
+        session->lease_generation = order_index->leases[lease].generation;
+    }
+    else
+        unscheduleLease(lease);
+    order_index->leases[lease].expires = time(NULL) + order_index->lease_seconds;
+    scheduleLease(lease);
+    return lease;
+}
+
+// Returns the number of orders the device holds, -1 when its lease expired
+int renewLease(Session *session)
+{
+    if (session->lease == 0)
+        return 0;
+
+    int held = -1;
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    pthread_mutex_lock(&shared->kitchen_lock);
+    KitchenLease *lease = &order_index->leases[session->lease - 1];
+    if (lease->generation == session->lease_generation && lease->expires != 0)
+    {
+        unscheduleLease(session->lease - 1);
+        lease->expires = time(NULL) + order_index->lease_seconds;
+        scheduleLease(session->lease - 1);
+        held = lease->orders;
+    }
+    else
+        session->lease = 0;
+    pthread_mutex_unlock(&shared->kitchen_lock);
+    pthread_rwlock_unlock(&shared->orders_lock);
+    return held;
+}
+
+void releaseLease(Session *session)
+{
+    if (session->lease == 0)
+        return;
+
+    // Orders still held keep the lease until it expires, as the cook may still finish them
+    pthread_rwlock_rdlock(&shared->orders_lock);
+    pthread_mutex_lock(&shared->kitchen_lock);
+    KitchenLease *lease = &order_index->leases[session->lease - 1];
+    if (lease->generation == session->lease_generation && lease->expires != 0 && lease->orders == 0)
+        freeLease(session->lease - 1);
+    pthread_mutex_unlock(&shared->kitchen_lock);
+    pthread_rwlock_unlock(&shared->orders_lock);
+    session->lease = 0;
+}
+
+// Caller must hold kitchen_lock, the lease must hold no orders
+void freeLease(int lease)
+{
+    unscheduleLease(lease);
+    order_index->leases[lease].expires = 0;
+    order_index->leases[lease].generation++;
+    order_index->leases[lease].next_due = order_index->free_leases;
+    order_index->free_leases = lease + 1;
+}
+
+// Caller must hold kitchen_lock
+void scheduleLease(int lease)
+{
+    uint32_t *first = &order_index->lease_wheel[order_index->leases[lease].expires & (LEASE_WHEEL_SIZE - 1)];
+    order_index->leases[lease].prev_due = 0;
+    order_index->leases[lease].next_due = *first;
+    if (*first != 0)
+        order_index->leases[*first - 1].prev_due = lease + 1;
+    *first = lease + 1;
+}
+
+// Caller must hold kitchen_lock
+void unscheduleLease(int lease)
+{
+    KitchenLease *due = &order_index->leases[lease];
+    if (due->prev_due != 0)
+        order_index->leases[due->prev_due - 1].next_due = due->next_due;
+    else
+        order_index->lease_wheel[due->expires & (LEASE_WHEEL_SIZE - 1)] = due->next_due;
+    if (due->next_due != 0)
+        order_index->leases[due->next_due - 1].prev_due = due->prev_due;
+    due->next_due = 0;
+    due->prev_due = 0;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void leaseOrder(uint32_t slot, int lease)
+{
+    KitchenLease *holder = &order_index->leases[lease];
+    order_index->lease_of[slot] = lease + 1;
+    order_index->prev_in_lease[slot] = 0;
+    order_index->next_in_lease[slot] = holder->first_order;
+    if (holder->first_order != 0)
+        order_index->prev_in_lease[holder->first_order - 1] = slot + 1;
+    holder->first_order = slot + 1;
+    holder->orders++;
+}
+
+// Caller must hold kitchen_lock, or orders_lock for writing
+void unleaseOrder(uint32_t slot)
+{
+    if (order_index->lease_of[slot] == 0)
+        return;
+
+    KitchenLease *holder = &order_index->leases[order_index->lease_of[slot] - 1];
+    uint32_t prev = order_index->prev_in_lease[slot];
+    uint32_t next = order_index->next_in_lease[slot];
+    if (prev != 0)
+        order_index->next_in_lease[prev - 1] = next;
+    else
+        holder->first_order = next;
+    if (next != 0)
+        order_index->prev_in_lease[next - 1] = prev;
+    holder->orders--;
+    order_index->lease_of[slot] = 0;
+}
+
+// Caller must hold orders_lock and kitchen_lock
+void expireLease(int lease)
+{
+    // The orders of a device that stopped sending heartbeats are cooked by another one
+    uint32_t returned = 0;
+    KitchenLease *holder = &order_index->leases[lease];
+    while (holder->first_order != 0)
+    {
+        uint32_t slot = holder->first_order - 1;
+        unleaseOrder(slot);
+        if (returnOrderToQueue(slot))
+            returned++;
+    }
+    freeLease(lease);
+    if (returned > 0)
+    {
+        order_index->returned += returned;
+        fprintf(stdout, "[KITCHEN] A kitchen device missed its heartbeats, %u of its orders are back at the front of the queue\n", returned);
+    }
+}
 
-        char error_msg[] = "[ERROR] Could not open file";
-        bzero(buffer, MAX_BUFFER_SIZE);
-        strcpy(buffer, error_msg);
-        send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-        fprintf(stdout, "[SERVER] %s\n", buffer);
+// Caller must hold orders_lock and kitchen_lock
+bool returnOrderToQueue(uint32_t slot)
+{
+    // A ready that got there first wins, the order is then served
+    uint8_t preparing = ORDER_PREPARING;
+    if (!__atomic_compare_exchange_n(&orders[slot].status, &preparing, ORDER_WAITING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return false;
+
+    // The order already waited its turn once, a key of 0 puts it before every scheduled order
+    order_index->taken_at[slot] = 0;
+    order_index->wait_key[slot] = 0;
+    pushWaitingOrder(slot);
+
+    // Logged under kitchen_lock, so a device that takes the order again logs after it
+    recordStatusChange(slot, ORDER_PREPARING, ORDER_WAITING);
+    return true;
+}
+
+void publishKitchenEvent(int event, const Order *order, uint64_t lsn)
+{
+    pthread_mutex_lock(&kitchen_feed->lock);
+    uint32_t sequence = kitchen_feed->published + 1;
+    KitchenEvent *entry = &kitchen_feed->events[sequence % KITCHEN_FEED_SIZE];
+    entry->lsn = lsn;
+    entry->event = event;
+    entry->order = *order;
+    entry->table_prev = 0;
+    // Status changes are also chained per bucket of reservations, for the table devices
+    uint32_t bucket = hashTableWatch(order->rsrv_code);
+    if (event != FEED_NEW_ORDER)
+    {
+        entry->table_prev = kitchen_feed->table_last[bucket];
+        __atomic_store_n(&kitchen_feed->table_last[bucket], sequence, __ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&kitchen_feed->published, sequence, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&kitchen_feed->lock);
+
+    // Forked subscribers sleep on the event number. Event loops push events when the commit
+    // of their log record wakes them, so they are woken here if that commit is already done
+    if (__atomic_load_n(&kitchen_feed->sleepers, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &kitchen_feed->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    if (event != FEED_NEW_ORDER && __atomic_load_n(&kitchen_feed->table_sleepers, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &kitchen_feed->table_last[bucket], FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    if (walIsDurable(lsn))
+        walNotifyListeners();
+}
+
+int collectKitchenEvents(Session *session, Reply *reply, size_t max_len)
+{
+    int queued = 0;
+    char buffer[MAX_BUFFER_SIZE];
+
+    pthread_mutex_lock(&kitchen_feed->lock);
+    uint32_t published = kitchen_feed->published;
+    // Events older than the ring were overwritten, the device only learns how many it missed
+    if (published - session->feed_sequence > KITCHEN_FEED_SIZE)
+    {
+        uint32_t missed = published - session->feed_sequence - KITCHEN_FEED_SIZE;
+        session->feed_sequence += missed;
+        sprintf(buffer, "%u kitchen events were missed", missed);
+        replyKitchenEvent(reply, session->version, FEED_MISSED, session->feed_sequence, buffer);
+        queued++;
+    }
+    // Events are pushed in the order of their numbers, so one not durable yet holds back the rest
+    while (session->feed_sequence != published && reply->len < max_len)
+    {
+        const KitchenEvent *event = &kitchen_feed->events[(session->feed_sequence + 1) % KITCHEN_FEED_SIZE];
+        if (!walIsDurable(event->lsn))
+            break;
+        char text[ORDER_TEXT_SIZE];
+        formatOrderItems(&event->order, text);
+        sprintf(buffer, "%d %s %s %s", event->order.rsrv_code, ALL_TABLES[event->order.table].id, event->order.course, text);
+        session->feed_sequence++;
+        replyKitchenEvent(reply, session->version, event->event, session->feed_sequence, buffer);
+        queued++;
     }
+    pthread_mutex_unlock(&kitchen_feed->lock);
+    return queued;
+}
+
+void replyKitchenEvent(Reply *reply, int version, int event, uint32_t sequence, const char *text)
+{
+    // A pushed event answers no request, request ids start at 1
+    replyBegin(reply, version, MSG_FEED_EVENT, 0);
+    replyInt(reply, event);
+    replyInt(reply, (int)sequence);
+    replyText(reply, text);
+    replyEnd(reply);
+}
+
+void subscribeConnection(Connection *conn)
+{
+    conn->feed_listed = true;
+    conn->feed_prev = NULL;
+    conn->feed_next = feed_subscribers;
+    if (feed_subscribers != NULL)
+        feed_subscribers->feed_prev = conn;
+    feed_subscribers = conn;
+}
+
+void unsubscribeConnection(Connection *conn)
+{
+    if (!conn->feed_listed)
+        return;
+    if (conn->feed_prev != NULL)
+        conn->feed_prev->feed_next = conn->feed_next;
     else
+        feed_subscribers = conn->feed_next;
+    if (conn->feed_next != NULL)
+        conn->feed_next->feed_prev = conn->feed_prev;
+    conn->feed_listed = false;
+}
+
+void pushKitchenEvents(int epoll_fd)
+{
+    // Kitchen events become sendable with the commit of their log records
+    for (Connection *next, *conn = feed_subscribers; conn != NULL; conn = next)
     {
-        // Calculate the number of orders in the file
-        fseek(file, 0, SEEK_END);
-        long file_size = ftell(file);
-        int num_all_orders = file_size / sizeof(Order);
-        rewind(file);
+        next = conn->feed_next;
+        if (collectKitchenEvents(&conn->session, &conn->out, KITCHEN_FEED_MAX_QUEUED) > 0 && !flushConnection(epoll_fd, conn))
+            closeConnection(epoll_fd, conn);
+    }
+}
+
+void startKitchenFeedThread(int client_sock, Session *session, void *(*feed)(void *))
+{
+    pthread_t thread;
+    KitchenFeedArgs *args = malloc(sizeof(KitchenFeedArgs));
+    args->sock = client_sock;
+    args->session = session;
+    if (pthread_create(&thread, NULL, feed, args) != 0)
+    {
+        fprintf(stdout, "[-] Could not start the kitchen feed of %s:%d\n", inet_ntoa(session->addr.sin_addr), ntohs(session->addr.sin_port));
+        free(args);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+void *kitchenFeedThread(void *arg)
+{
+    KitchenFeedArgs *args = (KitchenFeedArgs *)arg;
+    Reply events = {NULL, 0, 0, PROTOCOL_LEGACY, 0, 0, 0};
+    bool connected = true;
+
+    // The thread ends with the child, when the device disconnects
+    while (connected)
+    {
+        // Sleep until an event is published, then until the log holds every record appended so far
+        waitForKitchenEvent(args->session->feed_sequence);
+        walWaitDurable(__atomic_load_n(&wal->appended_lsn, __ATOMIC_ACQUIRE));
+
+        replyClear(&events);
+        collectKitchenEvents(args->session, &events, KITCHEN_FEED_MAX_QUEUED);
+        pthread_mutex_lock(&feed_send_lock);
+        if (events.len > 0 && sendAll(args->sock, events.data, events.len) < 0)
+            connected = false;
+        pthread_mutex_unlock(&feed_send_lock);
+    }
+    replyFree(&events);
+    free(args);
+    return NULL;
+}
+
+void waitForKitchenEvent(uint32_t seen)
+{
+    // Futex on the shared event number, so publishers in any process wake the sleeper
+    __atomic_add_fetch(&kitchen_feed->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&kitchen_feed->published, __ATOMIC_SEQ_CST) == seen)
+        syscall(SYS_futex, &kitchen_feed->published, FUTEX_WAIT, seen, NULL, NULL, 0);
+    __atomic_sub_fetch(&kitchen_feed->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+int collectTableEvents(Session *session, Reply *reply)
+{
+    uint32_t found[TABLE_WATCH_MAX_EVENTS];
+    int count = 0, queued = 0;
+    char buffer[MAX_BUFFER_SIZE];
+    int rsrv_code = session->reservation.code;
+
+    // Only the chain of the reservation's bucket is walked, newest first, until the last
+    // change the device got or the first one that left the ring
+    pthread_mutex_lock(&kitchen_feed->lock);
+    uint32_t published = kitchen_feed->published;
+    uint32_t sequence = kitchen_feed->table_last[hashTableWatch(rsrv_code)];
+    while (sequence > session->table_sequence && published - sequence < KITCHEN_FEED_SIZE && count < TABLE_WATCH_MAX_EVENTS)
+    {
+        const KitchenEvent *event = &kitchen_feed->events[sequence % KITCHEN_FEED_SIZE];
+        if (event->order.rsrv_code == rsrv_code)
+            found[count++] = sequence;
+        sequence = event->table_prev;
+    }
 
-        Order order;
-        Order inPreparationOrders[num_all_orders];
-        int last_order = 0;
+    // Changes are pushed oldest first, one not durable yet holds back the rest
+    while (count > 0)
+    {
+        const KitchenEvent *event = &kitchen_feed->events[found[count - 1] % KITCHEN_FEED_SIZE];
+        if (!walIsDurable(event->lsn))
+            break;
+        char text[ORDER_TEXT_SIZE];
+        formatOrderItems(&event->order, text);
+        sprintf(buffer, "%d %s %s %s", event->order.rsrv_code, ALL_TABLES[event->order.table].id, event->order.course, text);
+        session->table_sequence = found[--count];
+        replyKitchenEvent(reply, session->version, event->event, session->table_sequence, buffer);
+        queued++;
+    }
+    pthread_mutex_unlock(&kitchen_feed->lock);
+    return queued;
+}
+
+uint32_t hashTableWatch(int rsrv_code)
+{
+    return hashBytes(FNV_OFFSET, &rsrv_code, sizeof(rsrv_code)) & (TABLE_WATCH_BUCKETS - 1);
+}
+
+void watchTable(Connection *conn)
+{
+    // The loop hands over events from the moment its first table device watches
+    if (table_watchers == NULL)
+    {
+        table_watchers = calloc(TABLE_WATCH_BUCKETS, sizeof(Connection *));
+        table_feed_seen = __atomic_load_n(&kitchen_feed->published, __ATOMIC_ACQUIRE);
+    }
+    Connection **first = &table_watchers[hashTableWatch(conn->session.reservation.code)];
+    conn->table_listed = true;
+    conn->table_prev = NULL;
+    conn->table_next = *first;
+    if (*first != NULL)
+        (*first)->table_prev = conn;
+    *first = conn;
+}
+
+void unwatchTable(Connection *conn)
+{
+    if (!conn->table_listed)
+        return;
+    if (conn->table_prev != NULL)
+        conn->table_prev->table_next = conn->table_next;
+    else
+        table_watchers[hashTableWatch(conn->session.reservation.code)] = conn->table_next;
+    if (conn->table_next != NULL)
+        conn->table_next->table_prev = conn->table_prev;
+    conn->table_listed = false;
+}
 
-        while (fread(&order, sizeof(Order), 1, file) == 1)
+int queueTableEvents(Connection *changed[], int max)
+{
+    // Every durable event is looked at once and handed only to the table devices of its
+    // bucket of reservations, so the cost does not grow with the connections of the loop
+    int count = 0;
+    if (table_watchers == NULL)
+        return 0;
+    uint32_t published = __atomic_load_n(&kitchen_feed->published, __ATOMIC_ACQUIRE);
+    if (published - table_feed_seen > KITCHEN_FEED_SIZE)
+        table_feed_seen = published - KITCHEN_FEED_SIZE;
+    while (table_feed_seen != published)
+    {
+        pthread_mutex_lock(&kitchen_feed->lock);
+        const KitchenEvent *event = &kitchen_feed->events[(table_feed_seen + 1) % KITCHEN_FEED_SIZE];
+        uint64_t lsn = event->lsn;
+        int type = event->event;
+        int rsrv_code = event->order.rsrv_code;
+        pthread_mutex_unlock(&kitchen_feed->lock);
+        if (!walIsDurable(lsn))
+            break;
+
+        // With changed full the event is looked at again by the next call; devices that
+        // already got it then queue nothing
+        bool full = false;
+        for (Connection *conn = table_watchers[hashTableWatch(rsrv_code)]; conn != NULL && type != FEED_NEW_ORDER; conn = conn->table_next)
         {
-            if (strcmp(order.status, STATUS_PREPARING) == 0)
+            if (conn->closing || conn->session.reservation.code != rsrv_code)
+                continue;
+            if (count == max)
             {
-                fprintf(stdout, "Order in preparing status: %s %s\n", order.table_id, order.course);
-                inPreparationOrders[last_order] = order;
-                last_order++;
-                found = 1;
+                full = true;
+                break;
             }
+            if (collectTableEvents(&conn->session, &conn->out) > 0)
+                changed[count++] = conn;
         }
+        if (full)
+            break;
+        table_feed_seen++;
+    }
+    return count;
+}
 
-        fclose(file);
-
-        send(client_sock, &found, sizeof(int), 0);
-        if (found == 0)
-        {
-            char no_found_msg[] = "There are no orders in \"in preparation\" status right now.";
-            bzero(buffer, MAX_BUFFER_SIZE);
-            strcpy(buffer, no_found_msg);
-            send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-            fprintf(stdout, "[SERVER] %s\n", buffer);
-        }
-        else if (found == 1)
+void pushTableEvents(int epoll_fd)
+{
+    Connection *changed[MAX_EPOLL_EVENTS];
+    int count;
+    do
+    {
+        count = queueTableEvents(changed, MAX_EPOLL_EVENTS);
+        for (int i = 0; i < count; i++)
         {
-            send(client_sock, &last_order, sizeof(int), 0);
-            for (int k = 0; k < last_order; k++)
-            {
-                bzero(buffer, MAX_BUFFER_SIZE);
-                sprintf(buffer, "%s %s %s", inPreparationOrders[k].table_id, inPreparationOrders[k].course, inPreparationOrders[k].order);
-                send(client_sock, buffer, MAX_BUFFER_SIZE, 0);
-            }
-            fprintf(stdout, "[SERVER]Orders in preparation send to kitchen device\n");
+            if (!flushConnection(epoll_fd, changed[i]))
+                closeConnection(epoll_fd, changed[i]);
         }
+    } while (count == MAX_EPOLL_EVENTS);
+}
+
+void *tableFeedThread(void *arg)
+{
+    KitchenFeedArgs *args = (KitchenFeedArgs *)arg;
+    Reply events = {NULL, 0, 0, PROTOCOL_LEGACY, 0, 0, 0};
+    bool connected = true;
+    uint32_t bucket = hashTableWatch(args->session->reservation.code);
+
+    // Only status changes of the reservation's bucket wake the thread, it ends with the child
+    while (connected)
+    {
+        uint32_t last = __atomic_load_n(&kitchen_feed->table_last[bucket], __ATOMIC_SEQ_CST);
+        walWaitDurable(__atomic_load_n(&wal->appended_lsn, __ATOMIC_ACQUIRE));
+
+        replyClear(&events);
+        collectTableEvents(args->session, &events);
+        pthread_mutex_lock(&feed_send_lock);
+        if (events.len > 0 && sendAll(args->sock, events.data, events.len) < 0)
+            connected = false;
+        pthread_mutex_unlock(&feed_send_lock);
+        waitForTableEvent(bucket, last);
     }
+    replyFree(&events);
+    free(args);
+    return NULL;
+}
+
+void waitForTableEvent(uint32_t bucket, uint32_t seen)
+{
+    __atomic_add_fetch(&kitchen_feed->table_sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&kitchen_feed->table_last[bucket], __ATOMIC_SEQ_CST) == seen)
+        syscall(SYS_futex, &kitchen_feed->table_last[bucket], FUTEX_WAIT, seen, NULL, NULL, 0);
+    __atomic_sub_fetch(&kitchen_feed->table_sleepers, 1, __ATOMIC_SEQ_CST);
 }
 
-int countReceipt(const char *order)
+int countReceipt(const Order *order)
 {
-    MenuItem menu[MAX_MENU_ITEMS];
+    // Orders are priced from the cached menu, a reload meanwhile does not touch it
+    uint32_t version;
+    const Menu *menu = acquireMenu(&version);
 
-    // Load the menu from the file
-    FILE *menuFile = fopen("menu.txt", "r");
-    if (menuFile == NULL)
+    // The dishes were parsed when the order came in, only the prices are added up
+    int totalPrice = 0;
+    for (int i = 0; i < order->item_count; i++)
     {
-        printf("Error opening menu file.\n");
-        return -1;
+        char code[DISH_CODE_SIZE + 1] = {0};
+        memcpy(code, order->items[i].dish, DISH_CODE_SIZE);
+        const MenuItem *dish = findDish(menu, code);
+        if (dish != NULL)
+            totalPrice += dish->price * order->items[i].quantity;
+    }
+    releaseMenu(version);
+    fprintf(stdout, "Total price: %d\n", totalPrice);
+
+    return totalPrice;
+}
+
+void loadMenuCache()
+{
+    menu_cache = mmap(NULL, sizeof(MenuCache), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (menu_cache == MAP_FAILED)
+    {
+        perror("[-] Shared memory error.\n");
+        exit(1);
+    }
+    if (!parseMenu(MENU_FILE, &menu_cache->versions[0]) || !hashMenu(&menu_cache->versions[0]))
+    {
+        fprintf(stdout, "[-] Cannot load menu from %s\n", MENU_FILE);
+        exit(1);
     }
+    fprintf(stdout, "[+] Loaded %d dishes from %s.\n", menu_cache->versions[0].count, MENU_FILE);
+}
+
+bool parseMenu(const char *path, Menu *menu)
+{
+    FILE *menuFile = fopen(path, "r");
+    if (menuFile == NULL)
+        return false;
+    bzero(menu, sizeof(*menu));
 
     // Skip the header and separator lines
     char line[100];
@@ -770,67 +4844,154 @@ int countReceipt(const char *order)
     fgets(line, sizeof(line), menuFile); // Skip the separator
 
     // Read the menu items
-    int i = 0;
-    while (fgets(line, sizeof(line), menuFile) != NULL && i < MAX_MENU_ITEMS)
+    while (fgets(line, sizeof(line), menuFile) != NULL && menu->count < MAX_MENU_ITEMS)
     {
-        if (line[0] == '|' && line[1] != '=')
-        {
-            sscanf(line, "| %3s | %30[^|] | %d", menu[i].code, menu[i].name, &menu[i].price);
-            i++;
-        }
+        MenuItem *item = &menu->items[menu->count];
+        if (line[0] == '|' && line[1] != '=' &&
+            sscanf(line, "| %3s | %30[^|] | %d", item->code, item->name, &item->price) == 3)
+            menu->count++;
     }
 
     fclose(menuFile);
+    return menu->count > 0;
+}
 
-    // Parse the order string and calculate the total price
-    char orderCopy[100];
-    strcpy(orderCopy, order);
+bool hashMenu(Menu *menu)
+{
+    // Dish codes are known when the menu is loaded, so a seed is searched for that
+    // puts every code in a slot of its own; a lookup is then one hash and one compare
+    for (uint32_t seed = 0; seed < MENU_MAX_SEEDS; seed++)
+    {
+        bool collision = false;
+        bzero(menu->slots, sizeof(menu->slots));
+        for (int i = 0; i < menu->count && !collision; i++)
+        {
+            uint32_t slot = hashDishCode(menu->items[i].code, seed);
+            collision = menu->slots[slot] != 0;
+            menu->slots[slot] = i + 1;
+        }
+        if (!collision)
+        {
+            menu->seed = seed;
+            return true;
+        }
+    }
+    return false;
+}
 
-    char *token = strtok(orderCopy, " ");
-    int totalPrice = 0;
+uint32_t hashDishCode(const char *code, uint32_t seed)
+{
+    uint32_t hash = hashBytes(FNV_OFFSET ^ seed * FNV_PRIME, code, strlen(code));
+    return (hash ^ hash >> 16) & (MENU_HASH_SIZE - 1);
+}
 
-    while (token != NULL)
-    {
-        char code[MAX_CODE_LENGTH + 1];
-        int quantity;
-        sscanf(token, "%[^-]-%d", code, &quantity);
+const MenuItem *findDish(const Menu *menu, const char *code)
+{
+    int index = menu->slots[hashDishCode(code, menu->seed)];
+    if (index == 0 || strcmp(menu->items[index - 1].code, code) != 0)
+        return NULL;
+    return &menu->items[index - 1];
+}
 
-        // Find the code in the menu and update the total price
-        for (int i = 0; i < MAX_MENU_ITEMS; i++)
+const Menu *acquireMenu(uint32_t *version)
+{
+    // A reader counts itself on a version and then checks it is still the current one;
+    // the reload only rewrites a version after its readers are gone
+    while (1)
+    {
+        uint32_t current = __atomic_load_n(&menu_cache->current, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&menu_cache->readers[current], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&menu_cache->current, __ATOMIC_SEQ_CST) == current)
         {
-            if (strcmp(menu[i].code, code) == 0)
-            {
-                totalPrice += menu[i].price * quantity;
-                break;
-            }
+            *version = current;
+            return &menu_cache->versions[current];
         }
-
-        token = strtok(NULL, " ");
+        __atomic_sub_fetch(&menu_cache->readers[current], 1, __ATOMIC_SEQ_CST);
     }
-    fprintf(stdout, "Total price: %d\n", totalPrice);
+}
 
-    return totalPrice;
+void releaseMenu(uint32_t version)
+{
+    __atomic_sub_fetch(&menu_cache->readers[version], 1, __ATOMIC_SEQ_CST);
 }
 
-int allOrdersAreServed()
+// Only the menu watch thread reloads, so there is one writer
+bool reloadMenu()
 {
-    FILE *file = fopen(ORDERS_FILE, "rb");
-    if (file == NULL)
+    // The file is parsed aside, a menu that is half written or has clashing codes is not used
+    Menu menu;
+    if (!parseMenu(MENU_FILE, &menu) || !hashMenu(&menu))
+        return false;
+
+    // Wait until nobody prices with the old version any more, then fill and publish it
+    uint32_t next = (__atomic_load_n(&menu_cache->current, __ATOMIC_SEQ_CST) + 1) % MENU_VERSIONS;
+    while (__atomic_load_n(&menu_cache->readers[next], __ATOMIC_SEQ_CST) != 0)
+        usleep(100);
+    menu_cache->versions[next] = menu;
+    __atomic_store_n(&menu_cache->current, next, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+void startMenuWatch()
+{
+    // Editors often replace the file instead of writing it, so the directory is watched
+    menu_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (menu_watch_fd < 0 || inotify_add_watch(menu_watch_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
     {
-        fprintf(stdout, "[SERVER STOP] Cannot open a file\n");
-        return -1;
+        perror("[-] Cannot watch menu file, it is not reloaded.\n");
+        return;
     }
-    Order order;
-    while (fread(&order, sizeof(Order), 1, file) == 1)
+    pthread_create(&menu_watch_thread, NULL, menuWatchThread, NULL);
+}
+
+void stopMenuWatch()
+{
+    if (menu_watch_fd < 0)
+        return;
+    menu_watch_stopping = true;
+    pthread_join(menu_watch_thread, NULL);
+    close(menu_watch_fd);
+}
+
+void *menuWatchThread(void *arg)
+{
+    (void)arg;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd watch = {.fd = menu_watch_fd, .events = POLLIN};
+
+    while (!menu_watch_stopping)
     {
-        if (strcmp(order.status, STATUS_SERVED) != 0)
+        if (poll(&watch, 1, MENU_WATCH_INTERVAL_MS) <= 0)
+            continue;
+        ssize_t len = read(menu_watch_fd, events, sizeof(events));
+        bool changed = false;
+        for (ssize_t offset = 0; offset < len; offset += sizeof(struct inotify_event) + ((struct inotify_event *)(events + offset))->len)
         {
-            fprintf(stdout, "[SERVER STOP] Not all orders are served, server cannot be closed now\n");
-            return 0;
+            struct inotify_event *event = (struct inotify_event *)(events + offset);
+            changed |= event->len > 0 && strcmp(event->name, MENU_FILE) == 0;
         }
+        if (!changed)
+            continue;
+
+        if (reloadMenu())
+            fprintf(stdout, "[MENU] Reloaded %d dishes from %s\n", menu_cache->versions[menu_cache->current].count, MENU_FILE);
+        else
+            fprintf(stdout, "[MENU] %s could not be read, orders are still priced with the previous menu\n", MENU_FILE);
+    }
+    return NULL;
+}
+
+int allOrdersAreServed()
+{
+    // The counters are kept by every status change, no lock or scan is needed
+    uint32_t unserved = __atomic_load_n(&order_index->status_count[ORDER_WAITING], __ATOMIC_ACQUIRE) +
+                        __atomic_load_n(&order_index->status_count[ORDER_PREPARING], __ATOMIC_ACQUIRE);
+    if (unserved != 0)
+    {
+        fprintf(stdout, "[SERVER STOP] %u orders are not served, server cannot be closed now\n", unserved);
+        return 0;
     }
 
-    fclose(file);
     fprintf(stdout, "[SERVER STOP] All orders are served...\n");
     return 1;
 }
@@ -850,6 +5011,9 @@ void createSocket(int *server_sock)
         perror("[-] Socket error.\n");
         exit(1);
     }
+    // Allow restarting the server while old connections are in TIME_WAIT
+    int reuse = 1;
+    setsockopt(*server_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
     fprintf(stdout, "[+] TCP server socket created.\n");
 }
 
@@ -874,7 +5038,7 @@ void bindServer(struct sockaddr_in *server_addr, int *server_sock, int *port, in
 
 void listenForIncomingConnections(int *server_sock)
 {
-    if (listen(*server_sock, 30) == 0)
+    if (listen(*server_sock, SOMAXCONN) == 0)
     {
         fprintf(stdout, "[+] Listening...\n");
     }
@@ -889,6 +5053,9 @@ void establishNewConnection(struct sockaddr_in *client_addr, socklen_t *addr_siz
     *client_sock = accept(*server_sock, (struct sockaddr *)client_addr, addr_size);
     if (*client_sock < 0)
     {
+        // Listening socket was shut down by the "stop" command
+        if (!server_running)
+            return;
         exit(1);
     }
     fprintf(stdout, "[+] New connection accepted from: %s:%d.\n", inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
@@ -927,3 +5094,219 @@ int roundToEven(int num)
     }
     return num;
 }
+
+void parseServerOptions(int argc, const char *argv[], ServerOptions *options)
+{
+    if (argc < 2)
+    {
+        fprintf(stdout, "Usage: %s <port> [--mode fork|epoll|threads] [--workers N] [--io epoll|uring] [--commit-window MS] [--rotate SECONDS] [--schedule fifo|sjf|pacing] [--batch-window SECONDS] [--lease SECONDS]\n", argv[0]);
+        exit(1);
+    }
+
+    options->port = atoi(argv[1]);
+    options->mode = SERVER_MODE_FORK;
+    options->workers = sysconf(_SC_NPROCESSORS_ONLN);
+    options->io = SERVER_IO_EPOLL;
+    options->commit_window_us = WAL_DEFAULT_WINDOW_US;
+    options->rotate_seconds = ORDER_DEFAULT_ROTATE_SECONDS;
+    options->schedule = SCHEDULE_FIFO;
+    options->batch_window = DISH_BATCH_DEFAULT_WINDOW;
+    options->lease_seconds = LEASE_DEFAULT_SECONDS;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "fork") == 0)
+                options->mode = SERVER_MODE_FORK;
+            else if (strcmp(argv[i], "epoll") == 0)
+                options->mode = SERVER_MODE_EPOLL;
+            else if (strcmp(argv[i], "threads") == 0)
+                options->mode = SERVER_MODE_THREADS;
+            else
+            {
+                fprintf(stdout, "[-] Unknown mode: %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            options->workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--commit-window") == 0 && i + 1 < argc)
+            options->commit_window_us = atof(argv[++i]) * 1000;
+        else if (strcmp(argv[i], "--rotate") == 0 && i + 1 < argc)
+            options->rotate_seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch-window") == 0 && i + 1 < argc)
+            options->batch_window = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--lease") == 0 && i + 1 < argc)
+            options->lease_seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc)
+        {
+            options->schedule = schedulePolicyNumber(argv[++i]);
+            if (options->schedule < 0)
+            {
+                fprintf(stdout, "[-] Unknown kitchen schedule: %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "epoll") == 0)
+                options->io = SERVER_IO_EPOLL;
+            else if (strcmp(argv[i], "uring") == 0)
+                options->io = SERVER_IO_URING;
+            else
+            {
+                fprintf(stdout, "[-] Unknown io backend: %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else
+        {
+            fprintf(stdout, "[-] Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if (options->workers < 1)
+        options->workers = 1;
+    if (options->commit_window_us < 0)
+        options->commit_window_us = 0;
+    if (options->rotate_seconds < 0)
+        options->rotate_seconds = 0;
+    if (options->batch_window < 0)
+        options->batch_window = 0;
+    // A device must be able to miss a heartbeat, and a lease must fit in the timer wheel
+    if (options->lease_seconds < 2 * KITCHEN_HEARTBEAT_SECONDS)
+        options->lease_seconds = 2 * KITCHEN_HEARTBEAT_SECONDS;
+    if (options->lease_seconds >= LEASE_WHEEL_SIZE)
+        options->lease_seconds = LEASE_WHEEL_SIZE - 1;
+}
+
+void replyBegin(Reply *reply, int version, int type, uint32_t request_id)
+{
+    reply->version = version;
+    if (version == PROTOCOL_LEGACY)
+        return;
+
+    // Header is completed by replyEnd() once the body size is known
+    char header[FRAME_HEADER_SIZE];
+    bzero(header, FRAME_HEADER_SIZE);
+    reply->frame_start = reply->len;
+    reply->frame_type = type | MSG_REPLY;
+    reply->frame_id = request_id;
+    replyBytes(reply, header, FRAME_HEADER_SIZE);
+}
+
+void replyEnd(Reply *reply)
+{
+    if (reply->version == PROTOCOL_LEGACY)
+        return;
+    size_t body_len = reply->len - reply->frame_start - FRAME_HEADER_SIZE;
+    protocolPutHeader(reply->data + reply->frame_start, body_len, reply->frame_type, reply->frame_id);
+}
+
+void replyBytes(Reply *reply, const void *data, size_t len)
+{
+    if (reply->len + len > reply->cap)
+    {
+        size_t cap = reply->cap == 0 ? MAX_BUFFER_SIZE : reply->cap;
+        while (cap < reply->len + len)
+            cap *= 2;
+
+        char *grown = realloc(reply->data, cap);
+        if (grown == NULL)
+        {
+            perror("[-] Memory error.\n");
+            exit(1);
+        }
+        reply->data = grown;
+        reply->cap = cap;
+    }
+    memcpy(reply->data + reply->len, data, len);
+    reply->len += len;
+}
+
+void replyInt(Reply *reply, int value)
+{
+    if (reply->version != PROTOCOL_LEGACY)
+    {
+        char field[1 + sizeof(uint32_t)];
+        uint32_t net_value = htonl((uint32_t)value);
+        field[0] = FIELD_INT;
+        memcpy(field + 1, &net_value, sizeof(net_value));
+        replyBytes(reply, field, sizeof(field));
+        return;
+    }
+    replyBytes(reply, &value, sizeof(int));
+}
+
+void replyText(Reply *reply, const char *text)
+{
+    if (reply->version != PROTOCOL_LEGACY)
+    {
+        char field[1 + sizeof(uint16_t)];
+        size_t len = strnlen(text, UINT16_MAX);
+        uint16_t net_len = htons((uint16_t)len);
+        field[0] = FIELD_TEXT;
+        memcpy(field + 1, &net_len, sizeof(net_len));
+        replyBytes(reply, field, sizeof(field));
+        replyBytes(reply, text, len);
+        return;
+    }
+
+    // Legacy devices always read texts as whole MAX_BUFFER_SIZE buffers
+    char buffer[MAX_BUFFER_SIZE];
+    bzero(buffer, MAX_BUFFER_SIZE);
+    strncpy(buffer, text, MAX_BUFFER_SIZE - 1);
+    replyBytes(reply, buffer, MAX_BUFFER_SIZE);
+}
+
+void replyClear(Reply *reply)
+{
+    reply->len = 0;
+}
+
+void replyFree(Reply *reply)
+{
+    free(reply->data);
+    reply->data = NULL;
+    reply->len = 0;
+    reply->cap = 0;
+}
+
+int recvAll(int sock, void *data, size_t len)
+{
+    size_t received = 0;
+    while (received < len)
+    {
+        ssize_t n = recv(sock, (char *)data + received, len - received, 0);
+        if (n == 0)
+            return 0;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        received += n;
+    }
+    return 1;
+}
+
+int sendAll(int sock, const void *data, size_t len)
+{
+    size_t sent = 0;
+    while (sent < len)
+    {
+        ssize_t n = send(sock, (const char *)data + sent, len - sent, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += n;
+    }
+    return 1;
+}
@@ -3,12 +3,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 #include <arpa/inet.h>
+#include "protocol.h"
 
-#define MAX_BUFFER_SIZE 1024
-#define MAX_COMMAND_SIZE 6
-#define MAX_ORDER_SIZE 50
-#define SERVER_PORT 4242
+#define MAX_ORDER_SIZE 57 // Size of the dishes of an order: 8 dishes like A1-255, terminator included
 
 char TABLE_ID;
 
@@ -16,28 +15,40 @@ void prepareClientConnection(char *ip, int *client_socket, struct sockaddr_in *a
 void createClientSocket(int *client_socket);
 void initializeServerAddress(char *ip, struct sockaddr_in *addr);
 void connectToServer(int *client_socket, struct sockaddr_in *addr);
-bool checkSurnameAndCode(int client_socket);
+bool checkSurnameAndCode(Link *link);
+void sendOrderBurst(Link *link);
+bool watchOrders(Link *link);
+int recvReply(Link *link);
+bool waitForCommand(Link *link);
+void printOrderEvent(Link *link);
 void displayMenuAction();
 void printMenu();
 bool startsWith(const char *pre, const char *str);
 FILE *openFile(const char *file_name, const char *mode);
 
-int main(int argc, const char *argv[])
+int main()
 {
     fprintf(stdout, "--------------------------------TABLE--------------------------------\n");
     char *ip = "127.0.0.1";
-    int port = atoi(argv[1]);
 
-    int client_socket, ret, n;
+    int client_socket;
 
     struct sockaddr_in addr;
-    socklen_t addr_size;
 
+    // Commands are read straight from the descriptor, so poll() sees every typed command
+    setvbuf(stdin, NULL, _IONBF, 0);
     prepareClientConnection(ip, &client_socket, &addr);
 
-    if (checkSurnameAndCode(client_socket))
-    {
+    // Use the framed protocol when the server supports it
+    Link link;
+    linkInit(&link, client_socket);
+    if (linkNegotiate(&link) > PROTOCOL_LEGACY)
+        fprintf(stdout, "[+]Using framed protocol v%d.\n", link.version);
 
+    if (checkSurnameAndCode(&link))
+    {
+        // The server tells the table when its orders are being prepared and served
+        bool watching = watchOrders(&link);
         displayMenuAction();
 
         while (1)
@@ -45,7 +56,13 @@ int main(int argc, const char *argv[])
             char command[MAX_COMMAND_SIZE];
             char buffer[MAX_BUFFER_SIZE];
             bzero(command, MAX_COMMAND_SIZE);
-            scanf("%s", &command);
+            if (watching && !waitForCommand(&link))
+            {
+                fprintf(stdout, "[-]Disconnected from the server.\n");
+                linkClose(&link);
+                return 0;
+            }
+            scanf("%5s", command);
 
             if (startsWith("help", command) || startsWith("menu", command))
             {
@@ -55,6 +72,7 @@ int main(int argc, const char *argv[])
                     fprintf(stdout, "Commands description:\n");
                     fprintf(stdout, "menu   --> will show detailed menu with dishes and prices\n");
                     fprintf(stdout, "order  --> will send order to the kitchen\n");
+                    fprintf(stdout, "burst  --> will send up to %d orders at once, one per line, ended with 'send'\n", MAX_ORDERS_PER_TABLE);
                     fprintf(stdout, "bill   --> will send request for reparing the final bill\n");
                 }
                 else if (startsWith("menu", command) == true)
@@ -63,45 +81,47 @@ int main(int argc, const char *argv[])
                     printMenu();
                 }
             }
+            else if (startsWith("burst", command) == true)
+                sendOrderBurst(&link);
             else if (startsWith("order", command) || startsWith("bill", command) || startsWith("esc", command))
             {
                 printf("[SEND COMMAND] %s\n", command);
-                if (send(client_socket, command, MAX_COMMAND_SIZE, 0) < 0)
-                    printf("[SENDING ERROR]\n");
-                else
+                if (startsWith("order", command) == true)
                 {
-                    if (startsWith("order", command) == true)
-                    {
-                        // Take order from client
-                        char course[5], order[30];
-                        scanf("%[^:]: %[^\n]", course, order);
+                    // Take order from client
+                    char course[5], order[MAX_ORDER_SIZE];
+                    scanf(" %4[^:]: %56[^\n]", course, order);
 
-                        // Send order to server
-                        sprintf(buffer, "Course: %s Order: %s", course, order);
-                        send(client_socket, buffer, MAX_BUFFER_SIZE, 0);
+                    // Send order to server
+                    sprintf(buffer, "Course: %s Order: %s", course, order);
+                    if (linkSendRequest(&link, MSG_ORDER, buffer, strlen(buffer)) == 0 || recvReply(&link) <= 0)
+                        printf("[SENDING ERROR]\n");
+                    else
+                    {
                         fprintf(stdout, "[TABLE] %s send to server!\n", buffer);
-
-                        bzero(buffer, MAX_BUFFER_SIZE);
-                        recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
+                        linkRecvText(&link, buffer, MAX_BUFFER_SIZE);
                         fprintf(stdout, "[SERVER]%s\n", buffer);
                     }
-                    else if (startsWith("bill", command) == true)
+                }
+                else if (startsWith("bill", command) == true)
+                {
+                    fprintf(stdout, "[TABLE] Bill request\n");
+                    int result = 0;
+                    if (linkSendRequest(&link, MSG_BILL, NULL, 0) == 0 || recvReply(&link) <= 0)
+                        printf("[SENDING ERROR]\n");
+                    else
                     {
-                        fprintf(stdout, "[TABLE] Bill request\n");
-                        int result = 0;
-                        recv(client_socket, &result, sizeof(int), 0);
+                        linkRecvInt(&link, &result);
                         fprintf(stdout, "[SERVER] Total value: %d\n", result);
                     }
-                    else if (startsWith("esc", command) == true)
-                    {
-                        // send esc command to server and disconect from server
-                        bzero(buffer, MAX_BUFFER_SIZE);
-                        strcpy(buffer, command);
-                        send(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                        close(client_socket);
-                        fprintf(stdout, "[+]Disconnected from the server.\n");
-                        return 0;
-                    }
+                }
+                else if (startsWith("esc", command) == true)
+                {
+                    // send esc command to server and disconect from server
+                    linkSendRequest(&link, MSG_ESC, NULL, 0);
+                    linkClose(&link);
+                    fprintf(stdout, "[+]Disconnected from the server.\n");
+                    return 0;
                 }
             }
             else
@@ -120,7 +140,7 @@ void prepareClientConnection(char *ip, int *client_socket, struct sockaddr_in *a
 void createClientSocket(int *client_socket)
 {
     *client_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (client_socket < 0)
+    if (*client_socket < 0)
     {
         perror("[-]Socket error.\n");
         exit(1);
@@ -147,9 +167,9 @@ void connectToServer(int *client_socket, struct sockaddr_in *addr)
     printf("[+]Connected to the server.\n");
 }
 
-bool checkSurnameAndCode(int client_socket)
+bool checkSurnameAndCode(Link *link)
 {
-    char surname[20], buffer[MAX_BUFFER_SIZE], command[MAX_COMMAND_SIZE] = "check";
+    char surname[20], buffer[MAX_BUFFER_SIZE];
     char table_id[5], date[20], hour[20];
     int code = 0;
 
@@ -157,43 +177,149 @@ bool checkSurnameAndCode(int client_socket)
     {
         fprintf(stdout, "Please enter surname and reservation code\n");
         fprintf(stdout, "Enter your surname: ");
-        scanf("%s", surname);
+        if (scanf("%19s", surname) != 1)
+            exit(1);
         fprintf(stdout, "Enter reservation code: ");
-        scanf("%d", &code);
-        if (send(client_socket, command, MAX_COMMAND_SIZE, 0) < 0)
-            fprintf(stdout, "[SENDING ERROR]\n");
+        if (scanf("%d", &code) != 1)
+            exit(1);
+
+        sprintf(buffer, "%s %d", surname, code);
+        fprintf(stdout, "[TABLE SEND] surname: %s, code: %d\n", surname, code);
+
+        // Send parameters to server
+        if (linkSendRequest(link, MSG_CHECK, buffer, strlen(buffer)) == 0 || linkRecvReply(link) <= 0)
+            fprintf(stdout, "[ERROR] Cannot send to server socket\n");
         else
         {
-            sprintf(buffer, "%s %d", surname, code);
-            fprintf(stdout, "[TABLE SEND] surname: %s, code: %d\n", surname, code);
-
-            // Send parameters to server
-            if (send(client_socket, buffer, MAX_BUFFER_SIZE, 0) < 0)
-                fprintf(stdout, "[ERROR] Cannot send to server socket\n");
+            // Recive checking result
+            int result = 0;
+            linkRecvInt(link, &result);
+            linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+            if (result > 0)
+            {
+                sscanf(buffer, "%4s %19s %19s", table_id, date, hour);
+                fprintf(stdout, "======================================\n");
+                fprintf(stdout, "\nTable: %s %s %s\nWelcome Mr/Mrs %s! \n", table_id, date, hour, surname);
+                fprintf(stdout, "======================================\n");
+                return true;
+            }
             else
             {
-                // Recive checking result
-                int result;
-                recv(client_socket, &result, sizeof(int), 0);
-                bzero(buffer, MAX_BUFFER_SIZE);
-                recv(client_socket, buffer, MAX_BUFFER_SIZE, 0);
-                if (result > 0)
-                {
-                    sscanf(buffer, "%s %s %s", table_id, date, hour);
-                    fprintf(stdout, "======================================\n", table_id, date, hour, surname);
-                    fprintf(stdout, "\nTable: %s %s %s\nWelcome Mr/Mrs %s! \n", table_id, date, hour, surname);
-                    fprintf(stdout, "======================================\n", table_id, date, hour, surname);
-                    return true;
-                }
-                else
-                {
-                    fprintf(stdout, "%s\n", buffer);
-                }
+                fprintf(stdout, "%s\n", buffer);
             }
         }
     }
 }
 
+void sendOrderBurst(Link *link)
+{
+    char lines[MAX_ORDERS_PER_TABLE][MAX_BUFFER_SIZE], buffer[MAX_BUFFER_SIZE];
+    uint32_t ids[MAX_ORDERS_PER_TABLE];
+    int count = 0;
+
+    // Collect the courses first, so they leave in one burst
+    fprintf(stdout, "Enter up to %d orders as {course}: {dishes}, finish with 'send'\n", MAX_ORDERS_PER_TABLE);
+    while (count < MAX_ORDERS_PER_TABLE && scanf(" %1023[^\n]", buffer) == 1 && strcmp(buffer, "send") != 0)
+    {
+        char course[5], order[MAX_ORDER_SIZE];
+        if (sscanf(buffer, "%4[^:]: %56[^\n]", course, order) != 2)
+        {
+            fprintf(stdout, "Wrong order format, please use {course}: {dishes}.\n");
+            continue;
+        }
+        sprintf(lines[count], "Course: %s Order: %s", course, order);
+        count++;
+    }
+
+    // Every order is sent without waiting for the reply of the previous one
+    for (int i = 0; i < count; i++)
+    {
+        ids[i] = linkSendRequest(link, MSG_ORDER, lines[i], strlen(lines[i]));
+        if (ids[i] == 0)
+        {
+            printf("[SENDING ERROR]\n");
+            count = i;
+            break;
+        }
+    }
+    fprintf(stdout, "[TABLE] %d orders send to server!\n", count);
+
+    // Match every reply with its order by the request id
+    for (int received = 0; received < count; received++)
+    {
+        if (recvReply(link) <= 0)
+        {
+            fprintf(stdout, "[ERROR] Cannot recive from server socket\n");
+            return;
+        }
+        linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+        for (int i = 0; i < count; i++)
+        {
+            if (ids[i] == link->reply_id)
+                fprintf(stdout, "[SERVER] %s -> %s\n", lines[i], buffer);
+        }
+    }
+}
+
+bool watchOrders(Link *link)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    int result = 0;
+
+    // Pushed events need request ids, an old server only answers legacy commands
+    if (link->version == PROTOCOL_LEGACY)
+        return false;
+    if (linkSendRequest(link, MSG_WATCH, NULL, 0) == 0 || recvReply(link) <= 0)
+        return false;
+    linkRecvInt(link, &result);
+    linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+    if (result <= 0)
+        fprintf(stdout, "[SERVER]%s\n", buffer);
+    return result > 0;
+}
+
+int recvReply(Link *link)
+{
+    // Events pushed before the reply are printed on the way, a reply never has id 0
+    int result;
+    while ((result = linkRecvReply(link)) > 0 && link->version != PROTOCOL_LEGACY && link->reply_id == 0)
+        printOrderEvent(link);
+    return result;
+}
+
+bool waitForCommand(Link *link)
+{
+    // Pushed events are printed until the next command is typed
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {link->sock, POLLIN, 0}};
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0)
+            continue;
+        if (fds[1].revents != 0)
+        {
+            if (linkRecvReply(link) <= 0)
+                return false;
+            printOrderEvent(link);
+        }
+        if (fds[0].revents != 0)
+            return true;
+    }
+}
+
+void printOrderEvent(Link *link)
+{
+    char buffer[MAX_BUFFER_SIZE];
+    char table_id[5] = "", course[5] = "", order[MAX_ORDER_SIZE] = "";
+    int event = 0, sequence = 0, rsrv_code = 0;
+    linkRecvInt(link, &event);
+    linkRecvInt(link, &sequence);
+    linkRecvText(link, buffer, MAX_BUFFER_SIZE);
+
+    const char *what = event == FEED_CLAIMED ? "is being prepared" : event == FEED_SERVED ? "is served, enjoy your meal!" : "waits for a cook again";
+    sscanf(buffer, "%d %4s %4s %56[^\n]", &rsrv_code, table_id, course, order);
+    fprintf(stdout, "[KITCHEN] Your course %s (%s) %s\n", course, order, what);
+}
+
 void displayMenuAction()
 {
     fprintf(stdout, "\n--------------------------------------------------\n");
@@ -201,7 +327,8 @@ void displayMenuAction()
     fprintf(stdout, "1)   help       --> show the details of the commands\n");
     fprintf(stdout, "2)   menu       --> show the dishes menu\n");
     fprintf(stdout, "3)   order      --> send an order\n");
-    fprintf(stdout, "4)   bill       --> ask for the bill\n");
+    fprintf(stdout, "4)   burst      --> send several orders at once\n");
+    fprintf(stdout, "5)   bill       --> ask for the bill\n");
 }
 
 void printMenu()